@@ -0,0 +1,5 @@
+#! /bin/bash
+
+# CGCV_DEVICE_TYPE=cpu ./bench.sh to run on a software implementation
+cd build
+./CGCV_Benchmarks bench_results.json
\ No newline at end of file
@@ -0,0 +1,337 @@
+#include "vk_engine.h"
+#include "vk_pipelines.h"
+#include "vk_descriptors.h"
+#include "vk_initializers.h"
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// Repeatable measurements of engine hot paths. Writes JSON to the path given as the first
+// argument, or to stdout, so results can be diffed between commits.
+// Set CGCV_DEVICE_TYPE=cpu to run on a software implementation. The swapchain is created without
+// vsync when the device supports it, unless CGCV_VSYNC is set, so frame times are not the refresh
+// interval.
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkResult {
+    std::string name;
+    uint32_t iterations;
+    double meanMs;
+    double minMs;
+    double maxMs;
+    // benchmark specific value, e.g. throughput
+    const char* extraName;
+    double extra;
+};
+
+static std::vector<BenchmarkResult> results;
+
+static double elapsed_ms(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static BenchmarkResult& measure(const std::string& name, uint32_t iterations, const std::function<void()>& body)
+{
+    // one untimed run, to get lazy initialization out of the way
+    body();
+
+    std::vector<double> times;
+    for (uint32_t i = 0; i < iterations; i++) {
+        Clock::time_point start = Clock::now();
+        body();
+        times.push_back(elapsed_ms(start));
+    }
+
+    BenchmarkResult result = {};
+    result.name = name;
+    result.iterations = iterations;
+    result.minMs = *std::min_element(times.begin(), times.end());
+    result.maxMs = *std::max_element(times.begin(), times.end());
+    for (double time : times) {
+        result.meanMs += time / iterations;
+    }
+    std::cerr << name << ": " << result.meanMs << " ms" << std::endl;
+
+    results.push_back(result);
+    return results.back();
+}
+
+static void bench_upload_mesh(VkEngine& engine)
+{
+    for (uint32_t vertexCount : { 1024u, 16384u, 262144u }) {
+        std::vector<Vertex> vertices(vertexCount);
+        std::vector<uint32_t> indices(vertexCount * 3 / 2);
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            vertices[i] = { glm::vec3(float(i)), 0.f, glm::vec3(0.f, 0.f, 1.f), 0.f, glm::vec4(1.f) };
+        }
+        for (uint32_t i = 0; i < indices.size(); i++) {
+            indices[i] = i % vertexCount;
+        }
+
+        BenchmarkResult& result = measure("upload_mesh/" + std::to_string(vertexCount), 20, [&]() {
+            GPUMeshBuffers mesh = engine.uploadMesh(indices, vertices);
+            engine.destroy_buffer(mesh.indexBuffer);
+            engine.destroy_buffer(mesh.vertexBuffer);
+        });
+
+        double bytes = double(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t));
+        result.extraName = "MiB_per_s";
+        result.extra = bytes / (1024.0 * 1024.0) / (result.meanMs / 1000.0);
+    }
+}
+
+static void bench_build_pipeline(VkEngine& engine)
+{
+    measure("build_pipeline/colored_mesh", 50, [&]() {
+        VkPipeline pipeline = engine.build_colored_pipeline(engine._meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER, DepthMode::Write);
+        vkDestroyPipeline(engine._device, pipeline, nullptr);
+    });
+    // the same state through the pipeline cache, which already holds it
+    measure("build_pipeline/colored_mesh_cached", 50, [&]() {
+        engine.colored_pipeline(engine._meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL, DepthMode::Write);
+    });
+}
+
+static void bench_shader_objects(VkEngine& engine)
+{
+    if (!engine._shaderObjectsSupported) {
+        std::cerr << "shader_objects: VK_EXT_shader_object is not supported, skipped" << std::endl;
+        return;
+    }
+
+    // startup, the shaders of build_pipeline/colored_mesh as shader objects
+    std::vector<uint32_t> vertexCode = engine._shaderVariants.get_code("colored_triangle.vert", SHADER_FEATURE_VERTEX_BUFFER);
+    std::vector<uint32_t> fragmentCode = engine._shaderVariants.get_code("colored_triangle.frag", SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL);
+    ShaderObjectStage stages[2] = {
+        { VK_SHADER_STAGE_VERTEX_BIT, vertexCode },
+        { VK_SHADER_STAGE_FRAGMENT_BIT, fragmentCode },
+    };
+    VkPushConstantRange bufferRange = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants) };
+    for (bool linked : { false, true }) {
+        measure(std::string("shader_objects/create_") + (linked ? "linked" : "unlinked"), 50, [&]() {
+            std::vector<VkShaderEXT> shaders = engine._shaderObjects.create(stages, linked, { &engine._meshDescriptorLayout, 1 }, { &bufferRange, 1 });
+            engine._shaderObjects.destroy(shaders);
+        });
+    }
+
+    // state switches, recording only: the two mesh pipelines against the two dynamic states that tell them apart
+    constexpr uint32_t SWITCH_COUNT = 1000;
+
+    VkCommandPool pool;
+    VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(engine._graphicsQueueFamily);
+    check_vk_result(vkCreateCommandPool(engine._device, &poolInfo, nullptr, &pool));
+    VkCommandBuffer cmd;
+    VkCommandBufferAllocateInfo cmdInfo = vkinit::command_buffer_allocate_info(pool);
+    check_vk_result(vkAllocateCommandBuffers(engine._device, &cmdInfo, &cmd));
+
+    auto record = [&](const std::function<void(uint32_t)>& body) {
+        check_vk_result(vkResetCommandPool(engine._device, pool, 0));
+        VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        check_vk_result(vkBeginCommandBuffer(cmd, &beginInfo));
+        for (uint32_t i = 0; i < SWITCH_COUNT; i++) {
+            body(i);
+        }
+        check_vk_result(vkEndCommandBuffer(cmd));
+    };
+
+    BenchmarkResult& pipelines = measure("state_switch/pipelines_1000", 50, [&]() {
+        record([&](uint32_t i) {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, (i & 1) ? engine._meshEqualPipeline : engine._meshPipeline);
+        });
+    });
+    pipelines.extraName = "ns_per_switch";
+    pipelines.extra = pipelines.meanMs * 1000000.0 / SWITCH_COUNT;
+
+    GraphicsState state;
+    state.depthTest = true;
+    BenchmarkResult& shaderObjects = measure("state_switch/shader_objects_1000", 50, [&]() {
+        record([&](uint32_t i) {
+            if (i == 0) {
+                engine._shaderObjects.set_state(cmd, state, { engine._drawImage.imageExtent.width, engine._drawImage.imageExtent.height });
+                engine._shaderObjects.bind(cmd, engine._meshVertexObject, engine._meshFragmentObject);
+            }
+            vkCmdSetDepthWriteEnable(cmd, (i & 1) ? VK_FALSE : VK_TRUE);
+            vkCmdSetDepthCompareOp(cmd, (i & 1) ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_GREATER_OR_EQUAL);
+        });
+    });
+    shaderObjects.extraName = "ns_per_switch";
+    shaderObjects.extra = shaderObjects.meanMs * 1000000.0 / SWITCH_COUNT;
+
+    vkDestroyCommandPool(engine._device, pool, nullptr);
+}
+
+static void bench_descriptor_allocate(VkEngine& engine)
+{
+    constexpr uint32_t SET_COUNT = 1000;
+
+    std::vector<DescriptorAllocator::PoolSizeRatio> sizes = { { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 } };
+    DescriptorAllocator allocator;
+    allocator.init_pool(engine._device, SET_COUNT, sizes);
+
+    BenchmarkResult& result = measure("descriptor_allocate/1000", 50, [&]() {
+        for (uint32_t i = 0; i < SET_COUNT; i++) {
+            allocator.allocate(engine._device, engine._drawImageDescriptorLayout);
+        }
+        allocator.clear_descriptors(engine._device);
+    });
+    result.extraName = "sets_per_ms";
+    result.extra = SET_COUNT / result.meanMs;
+
+    allocator.destroy_pool(engine._device);
+}
+
+static void bench_material_upload(VkEngine& engine)
+{
+    TransientBufferAllocator staging;
+    staging.init(engine._device, engine._allocator, MAX_MATERIALS * sizeof(GPUMaterial), 16);
+
+    // every material is one copy region, every other one a region per material
+    uint32_t count = engine._materials.count();
+    for (uint32_t stride : { 1u, 2u }) {
+        std::string name = std::string("material_upload/") + (stride == 1 ? "all_" : "every_other_") + std::to_string(count);
+        BenchmarkResult& result = measure(name, 50, [&]() {
+            for (MaterialId id = 0; id < count; id += stride) {
+                engine._materials.update(id, engine._materials.parameters(id));
+            }
+            staging.reset();
+            engine.immediate_submit([&](VkCommandBuffer cmd) {
+                engine._materials.record_upload(cmd, staging.allocate(engine._materials.upload_size()));
+            });
+        });
+        result.extraName = "materials_per_ms";
+        result.extra = ((count + stride - 1) / stride) / result.meanMs;
+    }
+
+    staging.destroy(engine._allocator);
+}
+
+static void bench_simulation_interpolate(VkEngine& engine)
+{
+    // ticking alongside, as when the scene is shown
+    engine._simulation.start(SIMULATION_TICK_RATE);
+    std::vector<BodyState> bodies;
+    BenchmarkResult& result = measure("simulation/interpolate_" + std::to_string(engine._simulatedTransforms.size()), 1000, [&]() {
+        engine._simulation.interpolate(std::chrono::steady_clock::now(), bodies);
+    });
+    result.extraName = "ns_per_body";
+    result.extra = bodies.empty() ? 0 : result.meanMs * 1000000.0 / bodies.size();
+    engine._simulation.stop();
+}
+
+static void bench_deletion_queue()
+{
+    constexpr uint32_t PUSH_COUNT = 100000;
+
+    uint64_t counter = 0;
+    BenchmarkResult& result = measure("deletion_queue/push_flush_100000", 20, [&]() {
+        DeletionQueue queue;
+        for (uint32_t i = 0; i < PUSH_COUNT; i++) {
+            queue.push_function([&counter]() { counter++; });
+        }
+        queue.flush();
+    });
+    result.extraName = "ns_per_entry";
+    result.extra = result.meanMs * 1000000.0 / PUSH_COUNT;
+}
+
+static void bench_frames(VkEngine& engine)
+{
+    constexpr uint32_t FRAME_COUNT = 200;
+
+    for (int effect = 0; effect < (int)engine.backgroundEffects.size(); effect++) {
+        for (bool animated : { false, true }) {
+            engine.currentBackgroundEffect = effect;
+            engine.backgroundEffects[effect].animated = animated;
+            engine._backgroundCacheDirty = true;
+
+            std::string name = std::string("frame/") + engine.backgroundEffects[effect].name + (animated ? "/animated" : "/cached");
+
+            // GPU time of the graphics submission, read back from the timestamps a couple of frames later
+            double gpuMs = 0;
+            uint32_t gpuSamples = 0;
+            BenchmarkResult& result = measure(name, FRAME_COUNT, [&]() {
+                glfwPollEvents();
+                engine.frame();
+                const GpuTimings& timings = engine._lastGpuTimings;
+                if (engine._gpuTimestamps && timings.graphicsEnd > timings.graphicsBegin) {
+                    gpuMs += (timings.graphicsEnd - timings.graphicsBegin) * engine._gpuProperties.limits.timestampPeriod / 1000000.0;
+                    gpuSamples++;
+                }
+            });
+            result.extraName = "gpu_graphics_ms";
+            result.extra = gpuSamples > 0 ? gpuMs / gpuSamples : 0;
+
+            engine.backgroundEffects[effect].animated = false;
+        }
+    }
+    vkDeviceWaitIdle(engine._device);
+}
+
+static std::string to_json(const VkEngine& engine)
+{
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"device\": \"" << engine._gpuProperties.deviceName << "\",\n";
+    json << "  \"driver_version\": " << engine._gpuProperties.driverVersion << ",\n";
+    json << "  \"present_mode\": \"" << string_VkPresentModeKHR(engine._swapchainPresentMode) << "\",\n";
+    json << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        json << "    { \"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+             << ", \"mean_ms\": " << result.meanMs << ", \"min_ms\": " << result.minMs << ", \"max_ms\": " << result.maxMs;
+        if (result.extraName) {
+            json << ", \"" << result.extraName << "\": " << result.extra;
+        }
+        json << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n";
+    json << "}\n";
+    return json.str();
+}
+
+int main(int argc, char** argv)
+{
+    // read when the engine creates the swapchain
+    if (!std::getenv("CGCV_VSYNC")) {
+#ifdef _WIN32
+        _putenv_s("CGCV_VSYNC", "0");
+#else
+        setenv("CGCV_VSYNC", "0", 0);
+#endif
+    }
+
+    VkEngine engine;
+    // the simulation thread would take a core from every other benchmark
+    engine._simulation.stop();
+
+    bench_upload_mesh(engine);
+    bench_build_pipeline(engine);
+    bench_shader_objects(engine);
+    bench_descriptor_allocate(engine);
+    bench_material_upload(engine);
+    bench_simulation_interpolate(engine);
+    bench_deletion_queue();
+    bench_frames(engine);
+
+    std::string json = to_json(engine);
+    if (argc > 1) {
+        std::ofstream file(argv[1]);
+        if (!file.is_open()) {
+            std::cerr << "Error when writing " << argv[1] << std::endl;
+            return 1;
+        }
+        file << json;
+    } else {
+        std::cout << json;
+    }
+
+    return 0;
+}
@@ -1,13 +1,48 @@
 #version 450
 
+// Variants, see ShaderFeature:
+//  TEXTURE  - the color is multiplied with the mesh texture
+//  MATERIAL - the color is shaded with the draw's material, see GPUMaterial. With TEXTURE the
+//             material's textureStrength blends the texture in
+
 //shader input
 layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterial;
+
+#ifdef TEXTURE
+layout(set = 0, binding = 0) uniform sampler2D colorTexture;
+#endif
+
+#ifdef MATERIAL
+// GPUMaterial
+struct Material {
+	vec4 baseColor;
+	vec3 emissive;
+	float textureStrength;
+};
+
+layout(set = 0, binding = 1, std430) readonly buffer MaterialBuffer{
+	Material materials[];
+};
+#endif
 
 //output write
 layout (location = 0) out vec4 outFragColor;
 
 void main() 
 {
+#ifdef MATERIAL
+	Material material = materials[inMaterial];
+	vec3 color = inColor * material.baseColor.rgb;
+#ifdef TEXTURE
+	color *= mix(vec3(1.0f), texture(colorTexture, inUV).rgb, material.textureStrength);
+#endif
+	outFragColor = vec4(color + material.emissive, material.baseColor.a);
+#elif defined(TEXTURE)
+	outFragColor = vec4(inColor * texture(colorTexture, inUV).rgb, 1.0f);
+#else
 	//return red
 	outFragColor = vec4(inColor,1.0f);
+#endif
 }
@@ -1,9 +1,105 @@
 #version 450
 
+// Variants, see ShaderFeature:
+//  VERTEX_BUFFER - vertices come from the buffer in the push constants, otherwise a built in triangle is drawn
+//  MULTIVIEW     - with VERTEX_BUFFER, every view of a multiview pass applies its own matrix from the view buffer
+//  OBJECT_BUFFER - with VERTEX_BUFFER, for indirect draws: the instance index selects the object, which
+//                  has the world matrix, vertex buffer and material. render_matrix is the view-projection
+#ifdef VERTEX_BUFFER
+#extension GL_EXT_buffer_reference : require
+#endif
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : require
+#endif
+
 layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 outUV;
+// index into the material buffer, read by the MATERIAL fragment variant
+layout (location = 2) flat out uint outMaterial;
+
+// must match depth_prepass.vert bit for bit for the EQUAL depth test
+invariant gl_Position;
+
+#ifdef VERTEX_BUFFER
+struct Vertex {
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+}; 
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
+	Vertex vertices[];
+};
+
+#ifdef MULTIVIEW
+layout(buffer_reference, std430) readonly buffer ViewBuffer{ 
+	mat4 viewProj[];
+};
+#endif
+
+#ifdef OBJECT_BUFFER
+// GPUObject
+struct Object {
+	mat4 world;
+	vec4 bounds;
+	uint indexCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint materialIndex;
+	VertexBuffer vertexBuffer;
+	uvec2 pad2;
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectBuffer{ 
+	Object objects[];
+};
+#endif
+
+//push constants block
+layout( push_constant ) uniform constants
+{	
+	mat4 render_matrix;
+	VertexBuffer vertexBuffer;
+#ifdef MULTIVIEW
+	ViewBuffer viewBuffer;
+#endif
+#ifdef OBJECT_BUFFER
+	layout(offset = 80) ObjectBuffer objectBuffer;
+#endif
+	layout(offset = 88) uint materialIndex;
+} PushConstants;
+#endif
 
 void main() 
 {
+#ifdef VERTEX_BUFFER
+#ifdef OBJECT_BUFFER
+	Object object = PushConstants.objectBuffer.objects[gl_InstanceIndex];
+	Vertex v = object.vertexBuffer.vertices[gl_VertexIndex];
+#else
+	//load vertex data from device adress
+	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+#endif
+
+	//output data
+#ifdef MULTIVIEW
+	gl_Position = PushConstants.viewBuffer.viewProj[gl_ViewIndex] * PushConstants.render_matrix * vec4(v.position, 1.0f);
+#elif defined(OBJECT_BUFFER)
+	gl_Position = PushConstants.render_matrix * object.world * vec4(v.position, 1.0f);
+#else
+	gl_Position = PushConstants.render_matrix *vec4(v.position, 1.0f);
+#endif
+	outColor = v.color.xyz;
+	outUV.x = v.uv_x;
+	outUV.y = v.uv_y;
+#ifdef OBJECT_BUFFER
+	outMaterial = object.materialIndex;
+#else
+	outMaterial = PushConstants.materialIndex;
+#endif
+#else
 	//const array of positions for the triangle
 	const vec3 positions[3] = vec3[3](
 		vec3(1.f,1.f, 0.0f),
@@ -21,4 +117,7 @@ void main()
 	//output the position of each vertex
 	gl_Position = vec4(positions[gl_VertexIndex], 1.0f);
 	outColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+	outUV = vec2(0.0f);
+	outMaterial = 0;
+#endif
+}
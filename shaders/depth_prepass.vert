@@ -0,0 +1,26 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+// Position only vertex pulling for the depth prepass. Reads the first vec4 of each 48 byte
+// Vertex (position + uv_x) instead of the whole struct. Computes gl_Position exactly like
+// colored_triangle.vert so the main pass can test with EQUAL.
+
+layout(buffer_reference, std430) readonly buffer PositionBuffer{ 
+	vec4 data[];
+};
+
+//push constants block, same layout as GPUDrawPushConstants
+layout( push_constant ) uniform constants
+{	
+	mat4 render_matrix;
+	PositionBuffer vertexBuffer;
+} PushConstants;
+
+invariant gl_Position;
+
+void main() 
+{
+	vec3 position = PushConstants.vertexBuffer.data[gl_VertexIndex * 3].xyz;
+
+	gl_Position = PushConstants.render_matrix *vec4(position, 1.0f);
+}
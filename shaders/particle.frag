@@ -0,0 +1,14 @@
+#version 450
+
+// Round soft sprite, added to the draw image weighted by its alpha
+
+layout (location = 0) in vec4 inColor;
+layout (location = 1) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+	float falloff = max(1.0 - dot(inUV, inUV), 0.0);
+	outFragColor = vec4(inColor.rgb, inColor.a * falloff);
+}
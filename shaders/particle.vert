@@ -0,0 +1,53 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+
+// A quad of two triangles per alive particle, drawn by an indirect draw whose vertex count the
+// simulation wrote. Like the scene, the view-projection is the identity and positions are in NDC
+
+layout (location = 0) out vec4 outColor;
+// -1 to 1 across the quad
+layout (location = 1) out vec2 outUV;
+
+// GPUParticle
+struct Particle {
+	vec3 position;
+	float age;
+	vec3 velocity;
+	float lifetime;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer ParticleBuffer{ 
+	Particle particles[];
+};
+
+layout(buffer_reference, std430) readonly buffer IndexBuffer{ 
+	uint indices[];
+};
+
+layout( push_constant ) uniform constants
+{
+	ParticleBuffer particleBuffer;
+	// the alive list the simulation wrote
+	IndexBuffer aliveBuffer;
+	// half extent of a quad, corrected for the aspect ratio
+	vec2 size;
+} PushConstants;
+
+void main()
+{
+	const vec2 corners[6] = vec2[6](
+		vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+		vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+	);
+
+	uint particle = PushConstants.aliveBuffer.indices[gl_VertexIndex / 6];
+	Particle p = PushConstants.particleBuffer.particles[particle];
+	vec2 corner = corners[gl_VertexIndex % 6];
+
+	gl_Position = vec4(p.position.xy + corner * PushConstants.size, p.position.z, 1.0);
+	// fades out over the last part of its life
+	float fade = 1.0 - smoothstep(0.6, 1.0, p.age / p.lifetime);
+	outColor = vec4(p.color.rgb, p.color.a * fade);
+	outUV = corner;
+}
@@ -0,0 +1,142 @@
+#include "vk_buffers.h"
+
+#include <algorithm>
+#include <iostream>
+
+vkutil::BufferUsageInfo vkutil::buffer_usage_info(BufferUsage usage)
+{
+    switch (usage) {
+    case BufferUsage::ComputeRead:
+        return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_UNIFORM_READ_BIT, false };
+    case BufferUsage::ComputeWrite:
+        return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, true };
+    case BufferUsage::VertexRead:
+        return { VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_UNIFORM_READ_BIT, false };
+    case BufferUsage::FragmentRead:
+        return { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_UNIFORM_READ_BIT, false };
+    case BufferUsage::IndexRead:
+        return { VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT, false };
+    case BufferUsage::IndirectRead:
+        return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, false };
+    case BufferUsage::TransferSrc:
+        return { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, false };
+    case BufferUsage::TransferDst:
+        return { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, true };
+    case BufferUsage::HostRead:
+        return { VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT, false };
+    default:
+        return { VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT, true };
+    }
+}
+
+bool vkutil::is_write_usage(BufferUsage usage)
+{
+    return buffer_usage_info(usage).write;
+}
+
+vkutil::BufferState vkutil::unknown_buffer_state()
+{
+    BufferState state = {};
+    state.writeStage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    state.writeAccess = VK_ACCESS_2_MEMORY_WRITE_BIT;
+    return state;
+}
+
+bool vkutil::update_buffer_state(BufferState& state, BufferUsage usage, VkBufferMemoryBarrier2& barrier)
+{
+    BufferUsageInfo info = buffer_usage_info(usage);
+    bool needed;
+
+    if (info.write) {
+        needed = state.writeStage != 0 || state.readStages != 0;
+        barrier.srcStageMask = state.writeStage | state.readStages;
+        barrier.srcAccessMask = state.writeAccess;
+    } else {
+        needed = state.writeStage != 0 &&
+            ((info.stage & ~state.visibleStages) != 0 || (info.access & ~state.visibleAccess) != 0);
+        barrier.srcStageMask = state.writeStage;
+        barrier.srcAccessMask = state.writeAccess;
+    }
+
+    if (needed) {
+        barrier.dstStageMask = info.stage;
+        barrier.dstAccessMask = info.access;
+    }
+
+    if (info.write) {
+        state.writeStage = info.stage;
+        state.writeAccess = info.access & (VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        state.readStages = 0;
+        state.visibleStages = 0;
+        state.visibleAccess = 0;
+    } else {
+        state.readStages |= info.stage;
+        if (needed) {
+            state.visibleStages |= info.stage;
+            state.visibleAccess |= info.access;
+        }
+    }
+
+    return needed;
+}
+
+void TransientBufferAllocator::init(VkDevice device, VmaAllocator allocator, VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.pNext = nullptr;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    // host visible and persistently mapped, we write straight into it every frame
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    check_vk_result(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo, &buffer.buffer, &buffer.allocation, &buffer.info));
+
+    VkBufferDeviceAddressInfo deviceAdressInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = buffer.buffer
+    };
+    baseAddress = vkGetBufferDeviceAddress(device, &deviceAdressInfo);
+
+    capacity = size;
+    minAlignment = alignment > 0 ? alignment : 16;
+    head = 0;
+}
+
+void TransientBufferAllocator::destroy(VmaAllocator allocator)
+{
+    vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+}
+
+void TransientBufferAllocator::reset()
+{
+    head = 0;
+}
+
+TransientAllocation TransientBufferAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    // alignments are powers of two, so the larger one satisfies both
+    VkDeviceSize align = std::max(alignment, minAlignment);
+    VkDeviceSize offset = (head + align - 1) & ~(align - 1);
+
+    if (offset + size > capacity) {
+        std::cout << "Out of transient buffer space, " << offset + size << " of " << capacity << " bytes needed this frame" << std::endl;
+        return {};
+    }
+    head = offset + size;
+
+    TransientAllocation slice;
+    slice.buffer = buffer.buffer;
+    slice.offset = offset;
+    slice.size = size;
+    slice.mapped = (char*)buffer.info.pMappedData + offset;
+    slice.deviceAddress = baseAddress + offset;
+    return slice;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <cstring>
+
+namespace vkutil {
+// how a pass touches a buffer
+enum class BufferUsage {
+    ComputeRead,
+    ComputeWrite,
+    VertexRead,
+    FragmentRead,
+    IndexRead,
+    IndirectRead,
+    TransferSrc,
+    TransferDst,
+    HostRead,
+};
+
+struct BufferUsageInfo {
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    bool write;
+};
+
+// same tracking as vkutil::ImageState, without the layout
+struct BufferState {
+    VkPipelineStageFlags2 writeStage;
+    VkAccessFlags2 writeAccess;
+    VkPipelineStageFlags2 readStages;
+    VkPipelineStageFlags2 visibleStages;
+    VkAccessFlags2 visibleAccess;
+};
+
+BufferUsageInfo buffer_usage_info(BufferUsage usage);
+bool is_write_usage(BufferUsage usage);
+
+BufferState unknown_buffer_state();
+bool update_buffer_state(BufferState& state, BufferUsage usage, VkBufferMemoryBarrier2& barrier);
+}
+
+// A slice of a transient buffer. Valid until the owning frame is recycled.
+struct TransientAllocation {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;
+    VkDeviceAddress deviceAddress;
+};
+
+// Per-frame linear allocator over one persistently mapped, host visible buffer.
+// Slices can be bound with a dynamic offset or read through their device address.
+struct TransientBufferAllocator {
+
+    AllocatedBuffer buffer;
+    VkDeviceAddress baseAddress;
+    VkDeviceSize capacity;
+    VkDeviceSize head;
+    VkDeviceSize minAlignment;
+
+    void init(VkDevice device, VmaAllocator allocator, VkDeviceSize size, VkDeviceSize alignment);
+    void destroy(VmaAllocator allocator);
+
+    // only call once the fence of the frame that used these slices has signaled
+    void reset();
+
+    // empty, with a null buffer and mapping, when the frame's space has run out
+    TransientAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+
+    template<typename T>
+    TransientAllocation push(const T& data)
+    {
+        TransientAllocation slice = allocate(sizeof(T));
+        if (slice.mapped) {
+            memcpy(slice.mapped, &data, sizeof(T));
+        }
+        return slice;
+    }
+
+    template<typename T>
+    TransientAllocation push(std::span<const T> data)
+    {
+        TransientAllocation slice = allocate(data.size_bytes());
+        if (slice.mapped) {
+            memcpy(slice.mapped, data.data(), data.size_bytes());
+        }
+        return slice;
+    }
+};
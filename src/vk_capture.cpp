@@ -0,0 +1,315 @@
+#include "vk_capture.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+// matches tonemap.comp
+#define TONEMAP_REINHARD 1
+#define TONEMAP_ACES 2
+
+// Y4M frame rate when nothing better is known
+static constexpr uint32_t DEFAULT_MILLI_FPS = 60000;
+
+// the operator of tonemap.comp, to an 8 bit sRGB value
+static uint8_t tonemap(float value, float exposure, uint32_t tonemapper)
+{
+    value = std::max(value * exposure, 0.f);
+    if (tonemapper == TONEMAP_REINHARD) {
+        value = value / (1.f + value);
+    } else if (tonemapper == TONEMAP_ACES) {
+        value = (value * (2.51f * value + 0.03f)) / (value * (2.43f * value + 0.59f) + 0.14f);
+    }
+    value = std::clamp(value, 0.f, 1.f);
+    value = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+    return (uint8_t)(value * 255.f + 0.5f);
+}
+
+void FrameCapture::init(VmaAllocator allocator, VkDeviceSize slotSize, uint32_t slotCount, MemoryTracker* tracker)
+{
+    _allocator = allocator;
+    _slots = std::vector<Slot>(slotCount);
+
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = slotSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    // cached host memory when there is some, the writer reads every byte
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    for (Slot& slot : _slots) {
+        check_vk_result(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo, &slot.buffer.buffer, &slot.buffer.allocation, &slot.buffer.info));
+        if (tracker) {
+            tracker->track(slot.buffer.allocation, MemoryCategory::Readback);
+        }
+    }
+}
+
+void FrameCapture::destroy(VmaAllocator allocator, MemoryTracker* tracker)
+{
+    stop();
+    for (Slot& slot : _slots) {
+        if (tracker) {
+            tracker->untrack(slot.buffer.allocation);
+        }
+        vmaDestroyBuffer(allocator, slot.buffer.buffer, slot.buffer.allocation);
+    }
+    _slots.clear();
+}
+
+bool FrameCapture::start(const std::string& directory, CaptureFormat format, float fps)
+{
+    if (_active) {
+        return true;
+    }
+    // stopped by the writer, see write_frame
+    if (_writer.joinable()) {
+        stop();
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cout << "Error when creating the capture directory " << directory << std::endl;
+        return false;
+    }
+
+    _directory = directory;
+    _format = format;
+    _fps = fps;
+    _streamFrames = 0;
+    _streamBroken = false;
+    if (format == CaptureFormat::Raw || format == CaptureFormat::Y4M) {
+        std::string path = directory + (format == CaptureFormat::Raw ? "/capture.rgb" : "/capture.y4m");
+        _stream = fopen(path.c_str(), "wb");
+        if (!_stream) {
+            std::cout << "Error when opening " << path << std::endl;
+            return false;
+        }
+    }
+
+    _writtenFrames = 0;
+    _droppedFrames = 0;
+    _stopping = false;
+    _writer = std::thread(&FrameCapture::writer_loop, this);
+    _active = true;
+    return true;
+}
+
+void FrameCapture::stop()
+{
+    _active = false;
+    join_writer();
+    // copies that were recorded but never collected
+    for (Slot& slot : _slots) {
+        slot.state = SlotState::Free;
+    }
+}
+
+void FrameCapture::join_writer()
+{
+    if (_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            _stopping = true;
+        }
+        _queueChanged.notify_one();
+        _writer.join();
+    }
+
+    if (_stream) {
+        // without a pacing target the header has a guess, replaced by the rate the frames came at
+        if (_format == CaptureFormat::Y4M && _fps <= 0.f && _streamFrames > 1) {
+            double seconds = std::chrono::duration<double>(_lastFrameTime - _firstFrameTime).count();
+            if (seconds > 0.0) {
+                fseek(_stream, 0, SEEK_SET);
+                write_y4m_header(_streamExtent.width, _streamExtent.height, (uint32_t)std::lround((_streamFrames - 1) * 1000.0 / seconds));
+            }
+        }
+        fclose(_stream);
+        _stream = nullptr;
+    }
+}
+
+VkBuffer FrameCapture::acquire(uint64_t frameNumber, VkExtent2D extent, VkFormat format, float exposure, uint32_t tonemapper)
+{
+    if (!_active) {
+        return VK_NULL_HANDLE;
+    }
+    for (Slot& slot : _slots) {
+        if (slot.state == SlotState::Free) {
+            slot.frameNumber = frameNumber;
+            slot.time = std::chrono::steady_clock::now();
+            slot.extent = extent;
+            slot.format = format;
+            slot.exposure = exposure;
+            slot.tonemapper = tonemapper;
+            slot.state = SlotState::Recorded;
+            return slot.buffer.buffer;
+        }
+    }
+    _droppedFrames++;
+    return VK_NULL_HANDLE;
+}
+
+void FrameCapture::collect(uint64_t completedFrame)
+{
+    std::vector<uint32_t> ready;
+    for (uint32_t i = 0; i < _slots.size(); i++) {
+        if (_slots[i].state == SlotState::Recorded && _slots[i].frameNumber <= completedFrame) {
+            ready.push_back(i);
+        }
+    }
+    if (ready.empty()) {
+        return;
+    }
+    // streams have to be written in frame order
+    std::sort(ready.begin(), ready.end(), [&](uint32_t a, uint32_t b) { return _slots[a].frameNumber < _slots[b].frameNumber; });
+
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        for (uint32_t i : ready) {
+            // the memory may not be host coherent
+            vmaInvalidateAllocation(_allocator, _slots[i].buffer.allocation, 0, VK_WHOLE_SIZE);
+            _slots[i].state = SlotState::Writing;
+            _queue.push_back(i);
+        }
+    }
+    _queueChanged.notify_one();
+}
+
+void FrameCapture::writer_loop()
+{
+    while (true) {
+        uint32_t index;
+        {
+            std::unique_lock<std::mutex> lock(_queueMutex);
+            _queueChanged.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+            // drain everything that was collected before stopping
+            if (_queue.empty()) {
+                return;
+            }
+            index = _queue.front();
+            _queue.pop_front();
+        }
+
+        if (write_frame(_slots[index])) {
+            _writtenFrames++;
+        }
+        _slots[index].state = SlotState::Free;
+    }
+}
+
+void FrameCapture::write_y4m_header(uint32_t width, uint32_t height, uint32_t milliFps)
+{
+    fprintf(_stream, "YUV4MPEG2 W%u H%u F%010u:0000001000 Ip A1:1 C444\n", width, height, milliFps);
+}
+
+bool FrameCapture::write_frame(Slot& slot)
+{
+    uint32_t width = slot.extent.width;
+    uint32_t height = slot.extent.height;
+
+    // the streams have no per frame extent
+    if (_format != CaptureFormat::PPM) {
+        if (_streamBroken) {
+            return false;
+        }
+        if (_streamFrames == 0) {
+            _streamExtent = slot.extent;
+            _firstFrameTime = slot.time;
+        } else if (slot.extent.width != _streamExtent.width || slot.extent.height != _streamExtent.height) {
+            std::cout << "Capture stopped, the frame size changed from " << _streamExtent.width << "x" << _streamExtent.height
+                      << " to " << width << "x" << height << std::endl;
+            _streamBroken = true;
+            _active = false;
+            return false;
+        }
+    }
+
+    uint32_t pixelCount = width * height;
+    _rgb.resize(pixelCount * 3);
+
+    const void* pixels = slot.buffer.info.pMappedData;
+    switch (slot.format) {
+    case VK_FORMAT_R16G16B16A16_SFLOAT: {
+        const uint16_t* source = (const uint16_t*)pixels;
+        for (uint32_t i = 0; i < pixelCount; i++) {
+            for (uint32_t c = 0; c < 3; c++) {
+                _rgb[i * 3 + c] = tonemap(glm::unpackHalf1x16(source[i * 4 + c]), slot.exposure, slot.tonemapper);
+            }
+        }
+        break;
+    }
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB: {
+        const uint8_t* source = (const uint8_t*)pixels;
+        for (uint32_t i = 0; i < pixelCount; i++) {
+            _rgb[i * 3 + 0] = source[i * 4 + 2];
+            _rgb[i * 3 + 1] = source[i * 4 + 1];
+            _rgb[i * 3 + 2] = source[i * 4 + 0];
+        }
+        break;
+    }
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB: {
+        const uint8_t* source = (const uint8_t*)pixels;
+        for (uint32_t i = 0; i < pixelCount; i++) {
+            _rgb[i * 3 + 0] = source[i * 4 + 0];
+            _rgb[i * 3 + 1] = source[i * 4 + 1];
+            _rgb[i * 3 + 2] = source[i * 4 + 2];
+        }
+        break;
+    }
+    default:
+        std::cout << "Capture does not support " << string_VkFormat(slot.format) << std::endl;
+        return false;
+    }
+
+    switch (_format) {
+    case CaptureFormat::PPM: {
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%06llu.ppm", (unsigned long long)slot.frameNumber);
+        std::string path = _directory + name;
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cout << "Error when writing " << path << std::endl;
+            return false;
+        }
+        fprintf(file, "P6\n%u %u\n255\n", width, height);
+        fwrite(_rgb.data(), 1, _rgb.size(), file);
+        fclose(file);
+        break;
+    }
+    case CaptureFormat::Raw:
+        fwrite(_rgb.data(), 1, _rgb.size(), _stream);
+        break;
+    case CaptureFormat::Y4M: {
+        if (_streamFrames == 0) {
+            write_y4m_header(width, height, _fps > 0.f ? (uint32_t)std::lround(_fps * 1000.0) : DEFAULT_MILLI_FPS);
+        }
+        // full range BT.601, planar
+        std::vector<uint8_t> planes(pixelCount * 3);
+        for (uint32_t i = 0; i < pixelCount; i++) {
+            float r = _rgb[i * 3 + 0], g = _rgb[i * 3 + 1], b = _rgb[i * 3 + 2];
+            float y = 0.299f * r + 0.587f * g + 0.114f * b;
+            planes[i] = (uint8_t)std::clamp(y + 0.5f, 0.f, 255.f);
+            planes[pixelCount + i] = (uint8_t)std::clamp((b - y) * 0.564f + 128.5f, 0.f, 255.f);
+            planes[pixelCount * 2 + i] = (uint8_t)std::clamp((r - y) * 0.713f + 128.5f, 0.f, 255.f);
+        }
+        fprintf(_stream, "FRAME\n");
+        fwrite(planes.data(), 1, planes.size(), _stream);
+        break;
+    }
+    }
+
+    if (_format != CaptureFormat::PPM) {
+        _streamFrames++;
+        _lastFrameTime = slot.time;
+    }
+    return true;
+}
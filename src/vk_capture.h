@@ -0,0 +1,103 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_memory.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+enum class CaptureFormat {
+    // one binary PPM per frame
+    PPM,
+    // every frame appended as packed RGB8 to one file
+    Raw,
+    // YUV 4:4:4 stream, readable by ffmpeg and most players. The header has the pacing target
+    // as the frame rate, or without one the rate measured over the whole capture
+    Y4M,
+};
+
+// Streams rendered frames to disk without stalling the render loop.
+// Frames are copied into a ring of host visible buffers. Once the fence of a frame has signaled,
+// its buffer goes to a writer thread that converts and writes it. When the writer falls behind
+// and no buffer is free, frames are dropped instead of waiting.
+// HDR frames go through the same exposure and tonemap operator as tonemap.comp, without its dithering.
+// The raw and Y4M streams have one extent, a frame of another extent stops the capture.
+class FrameCapture {
+public:
+    // `slotSize` must hold one frame in the largest source format
+    void init(VmaAllocator allocator, VkDeviceSize slotSize, uint32_t slotCount, MemoryTracker* tracker = nullptr);
+    void destroy(VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+
+    // `fps` is the pacing target, 0 when the frame rate is not limited
+    bool start(const std::string& directory, CaptureFormat format, float fps = 0.f);
+    // only call once every frame handed out by acquire() has completed on the GPU
+    void stop();
+    bool active() const { return _active; }
+
+    // Reserves a buffer for this frame's copy. Returns VK_NULL_HANDLE when the frame is dropped.
+    // `exposure` and `tonemapper`, one of the TONEMAP_ constants of tonemap.comp, apply to HDR formats
+    VkBuffer acquire(uint64_t frameNumber, VkExtent2D extent, VkFormat format, float exposure = 1.f, uint32_t tonemapper = 0);
+    // hands every frame up to and including `completedFrame` to the writer
+    void collect(uint64_t completedFrame);
+
+    uint32_t written_frames() const { return _writtenFrames; }
+    uint32_t dropped_frames() const { return _droppedFrames; }
+
+private:
+    enum class SlotState : uint8_t {
+        Free,
+        // copy recorded, waiting for the frame's fence
+        Recorded,
+        Writing,
+    };
+
+    struct Slot {
+        AllocatedBuffer buffer;
+        std::atomic<SlotState> state{ SlotState::Free };
+        uint64_t frameNumber;
+        // when the frame was recorded, for the measured frame rate
+        std::chrono::steady_clock::time_point time;
+        VkExtent2D extent;
+        VkFormat format;
+        float exposure;
+        uint32_t tonemapper;
+    };
+
+    void writer_loop();
+    // false when the frame was not written
+    bool write_frame(Slot& slot);
+    // frame rate in thousandths, padded so the header can be rewritten in place
+    void write_y4m_header(uint32_t width, uint32_t height, uint32_t milliFps);
+    // finishes the writer and the stream, without touching the slots
+    void join_writer();
+
+    VmaAllocator _allocator;
+    std::vector<Slot> _slots;
+
+    std::atomic<bool> _active{ false };
+    std::string _directory;
+    CaptureFormat _format;
+    FILE* _stream{ nullptr };
+    float _fps{ 0.f };
+    // of the first frame of a stream, every other one has to match it
+    VkExtent2D _streamExtent;
+    uint32_t _streamFrames{ 0 };
+    std::chrono::steady_clock::time_point _firstFrameTime;
+    std::chrono::steady_clock::time_point _lastFrameTime;
+    // a frame had another extent, the rest are not written
+    bool _streamBroken{ false };
+
+    std::thread _writer;
+    std::mutex _queueMutex;
+    std::condition_variable _queueChanged;
+    std::deque<uint32_t> _queue;
+    bool _stopping{ false };
+
+    std::atomic<uint32_t> _writtenFrames{ 0 };
+    std::atomic<uint32_t> _droppedFrames{ 0 };
+    // converted pixels, only used by the writer thread
+    std::vector<uint8_t> _rgb;
+};
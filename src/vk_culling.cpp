@@ -0,0 +1,280 @@
+#include "vk_culling.h"
+#include "vk_initializers.h"
+#include "vk_pipelines.h"
+
+#include <algorithm>
+
+// matches MAX_LEVELS in depth_pyramid.comp
+constexpr uint32_t MAX_PYRAMID_LEVELS = 16;
+// cull.comp threads per workgroup
+constexpr uint32_t CULL_GROUP_SIZE = 64;
+
+struct PyramidPushConstants {
+    uint32_t width, height;
+    uint32_t levelCount;
+    uint32_t groupCount;
+};
+
+struct CullPushConstants {
+    glm::mat4 viewProj;
+    VkDeviceAddress objectBuffer;
+    VkDeviceAddress drawBuffer;
+    VkDeviceAddress countBuffer;
+    VkDeviceAddress visibilityBuffer;
+    float pyramidWidth, pyramidHeight;
+    uint32_t objectCount;
+    uint32_t latePhase;
+};
+
+static uint32_t previous_pow2(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result * 2 <= value) {
+        result *= 2;
+    }
+    return result;
+}
+
+AllocatedBuffer OcclusionCuller::create_buffer(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, MemoryTracker* tracker)
+{
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = size;
+    bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    AllocatedBuffer buffer;
+    check_vk_result(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo, &buffer.buffer, &buffer.allocation, &buffer.info));
+    if (tracker) {
+        tracker->track(buffer.allocation, MemoryCategory::Culling);
+    }
+    return buffer;
+}
+
+void OcclusionCuller::init(VkDevice device, VmaAllocator allocator, const AllocatedImage& depthImage, uint32_t maxObjects,
+    VkShaderModule pyramidShader, VkShaderModule cullShader, LayoutCache& layouts, SamplerCache& samplers, MemoryTracker* tracker)
+{
+    _maxObjects = maxObjects;
+    _depthExtent = { depthImage.imageExtent.width, depthImage.imageExtent.height };
+
+    // a power of two keeps every level an exact 2x2 reduction of the one above
+    _pyramidExtent = { previous_pow2(_depthExtent.width), previous_pow2(_depthExtent.height) };
+    _pyramidLevels = 1;
+    while ((std::max(_pyramidExtent.width, _pyramidExtent.height) >> _pyramidLevels) > 0 && _pyramidLevels < MAX_PYRAMID_LEVELS) {
+        _pyramidLevels++;
+    }
+
+    // pyramid, with a view per level for the storage writes and one over all levels for sampling
+    {
+        _pyramid.imageFormat = VK_FORMAT_R32_SFLOAT;
+        _pyramid.imageExtent = { _pyramidExtent.width, _pyramidExtent.height, 1 };
+
+        VkImageCreateInfo imgInfo = vkinit::image_create_info(_pyramid.imageFormat,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, _pyramid.imageExtent);
+        imgInfo.mipLevels = _pyramidLevels;
+
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        check_vk_result(vmaCreateImage(allocator, &imgInfo, &allocInfo, &_pyramid.image, &_pyramid.allocation, nullptr));
+        if (tracker) {
+            tracker->track(_pyramid.allocation, MemoryCategory::Culling);
+        }
+
+        VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(_pyramid.imageFormat, _pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        viewInfo.subresourceRange.levelCount = _pyramidLevels;
+        check_vk_result(vkCreateImageView(device, &viewInfo, nullptr, &_pyramid.imageView));
+
+        _levelViews.resize(_pyramidLevels);
+        for (uint32_t level = 0; level < _pyramidLevels; level++) {
+            viewInfo.subresourceRange.baseMipLevel = level;
+            viewInfo.subresourceRange.levelCount = 1;
+            check_vk_result(vkCreateImageView(device, &viewInfo, nullptr, &_levelViews[level]));
+        }
+    }
+
+    // min reduction, a bilinear fetch returns the farthest of the texels under it. Only
+    // texelFetch is used on the pyramid itself, which ignores the filter
+    {
+        SamplerDesc minDesc;
+        minDesc.filter = VK_FILTER_LINEAR;
+        minDesc.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        minDesc.addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        minDesc.reductionMode = VK_SAMPLER_REDUCTION_MODE_MIN;
+        _minSampler = samplers.get(minDesc);
+    }
+
+    _drawCommands[0] = create_buffer(allocator, maxObjects * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, tracker);
+    _drawCommands[1] = create_buffer(allocator, maxObjects * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, tracker);
+    _drawCounts = create_buffer(allocator, 2 * DRAW_COUNT_STRIDE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, tracker);
+    _visibility = create_buffer(allocator, maxObjects * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, tracker);
+    _pyramidCounter = create_buffer(allocator, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, tracker);
+
+    auto address_of = [&](const AllocatedBuffer& buffer) {
+        VkBufferDeviceAddressInfo addressInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer.buffer};
+        return vkGetBufferDeviceAddress(device, &addressInfo);
+    };
+    _drawCommandAddresses[0] = address_of(_drawCommands[0]);
+    _drawCommandAddresses[1] = address_of(_drawCommands[1]);
+    _drawCountAddress = address_of(_drawCounts);
+    _visibilityAddress = address_of(_visibility);
+
+    // descriptors
+    {
+        std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, (float)MAX_PYRAMID_LEVELS / 2 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        };
+        _descriptorAllocator.init_pool(device, 2, sizes);
+
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_PYRAMID_LEVELS);
+        builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        _pyramidSetLayout = builder.build(layouts, VK_SHADER_STAGE_COMPUTE_BIT);
+
+        builder.clear();
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        _cullSetLayout = builder.build(layouts, VK_SHADER_STAGE_COMPUTE_BIT);
+
+        _pyramidSet = _descriptorAllocator.allocate(device, _pyramidSetLayout);
+        _cullSet = _descriptorAllocator.allocate(device, _cullSetLayout);
+
+        VkDescriptorImageInfo depthInfo = { _minSampler, depthImage.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        // entries past the last level are never accessed but must be valid
+        std::array<VkDescriptorImageInfo, MAX_PYRAMID_LEVELS> levelInfos;
+        for (uint32_t level = 0; level < MAX_PYRAMID_LEVELS; level++) {
+            levelInfos[level] = { VK_NULL_HANDLE, _levelViews[std::min(level, _pyramidLevels - 1)], VK_IMAGE_LAYOUT_GENERAL };
+        }
+        VkDescriptorBufferInfo counterInfo = { _pyramidCounter.buffer, 0, VK_WHOLE_SIZE };
+        VkDescriptorImageInfo pyramidInfo = { _minSampler, _pyramid.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+        VkWriteDescriptorSet writes[4] = {};
+        for (VkWriteDescriptorSet& write : writes) {
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.descriptorCount = 1;
+        }
+        writes[0].dstSet = _pyramidSet;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[0].pImageInfo = &depthInfo;
+
+        writes[1].dstSet = _pyramidSet;
+        writes[1].dstBinding = 1;
+        writes[1].descriptorCount = MAX_PYRAMID_LEVELS;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[1].pImageInfo = levelInfos.data();
+
+        writes[2].dstSet = _pyramidSet;
+        writes[2].dstBinding = 2;
+        writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[2].pBufferInfo = &counterInfo;
+
+        writes[3].dstSet = _cullSet;
+        writes[3].dstBinding = 0;
+        writes[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[3].pImageInfo = &pyramidInfo;
+
+        vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+    }
+
+    // pipelines
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+
+        pushConstant.size = sizeof(PyramidPushConstants);
+        _pyramidLayout = layouts.get_pipeline_layout({ &_pyramidSetLayout, 1 }, { &pushConstant, 1 });
+
+        pushConstant.size = sizeof(CullPushConstants);
+        _cullLayout = layouts.get_pipeline_layout({ &_cullSetLayout, 1 }, { &pushConstant, 1 });
+
+        // the pyramid shader has a fixed 16x16 size, its tiling depends on it
+        _pyramidPipeline = vkutil::build_compute_pipeline(device, _pyramidLayout, pyramidShader, 16, 16);
+        _cullPipeline = vkutil::build_compute_pipeline(device, _cullLayout, cullShader, CULL_GROUP_SIZE, 1);
+    }
+}
+
+void OcclusionCuller::destroy(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker)
+{
+    vkDestroyPipeline(device, _pyramidPipeline, nullptr);
+    vkDestroyPipeline(device, _cullPipeline, nullptr);
+    _descriptorAllocator.destroy_pool(device);
+
+    for (AllocatedBuffer* buffer : { &_drawCommands[0], &_drawCommands[1], &_drawCounts, &_visibility, &_pyramidCounter }) {
+        if (tracker) {
+            tracker->untrack(buffer->allocation);
+        }
+        vmaDestroyBuffer(allocator, buffer->buffer, buffer->allocation);
+    }
+
+    for (VkImageView view : _levelViews) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    _levelViews.clear();
+    vkDestroyImageView(device, _pyramid.imageView, nullptr);
+    if (tracker) {
+        tracker->untrack(_pyramid.allocation);
+    }
+    vmaDestroyImage(allocator, _pyramid.image, _pyramid.allocation);
+}
+
+void OcclusionCuller::clear_state(VkCommandBuffer cmd)
+{
+    vkCmdFillBuffer(cmd, _visibility.buffer, 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(cmd, _pyramidCounter.buffer, 0, VK_WHOLE_SIZE, 0);
+}
+
+void OcclusionCuller::reset_counts(VkCommandBuffer cmd)
+{
+    vkCmdFillBuffer(cmd, _drawCounts.buffer, 0, VK_WHOLE_SIZE, 0);
+}
+
+void OcclusionCuller::cull(VkCommandBuffer cmd, CullPhase phase, VkDeviceAddress objects, uint32_t objectCount, const glm::mat4& viewProj)
+{
+    uint32_t phaseIndex = (uint32_t)phase;
+    objectCount = std::min(objectCount, _maxObjects);
+
+    CullPushConstants pushConstants = {};
+    pushConstants.viewProj = viewProj;
+    pushConstants.objectBuffer = objects;
+    pushConstants.drawBuffer = _drawCommandAddresses[phaseIndex];
+    pushConstants.countBuffer = _drawCountAddress + phaseIndex * DRAW_COUNT_STRIDE;
+    pushConstants.visibilityBuffer = _visibilityAddress;
+    pushConstants.pyramidWidth = (float)_pyramidExtent.width;
+    pushConstants.pyramidHeight = (float)_pyramidExtent.height;
+    pushConstants.objectCount = objectCount;
+    pushConstants.latePhase = phaseIndex;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullLayout, 0, 1, &_cullSet, 0, nullptr);
+    vkCmdPushConstants(cmd, _cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+    vkCmdDispatch(cmd, (objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+}
+
+void OcclusionCuller::build_pyramid(VkCommandBuffer cmd)
+{
+    uint32_t groupsX = (_pyramidExtent.width + 31) / 32;
+    uint32_t groupsY = (_pyramidExtent.height + 31) / 32;
+
+    PyramidPushConstants pushConstants = {};
+    pushConstants.width = _pyramidExtent.width;
+    pushConstants.height = _pyramidExtent.height;
+    pushConstants.levelCount = _pyramidLevels;
+    pushConstants.groupCount = groupsX * groupsY;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pyramidPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pyramidLayout, 0, 1, &_pyramidSet, 0, nullptr);
+    vkCmdPushConstants(cmd, _pyramidLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PyramidPushConstants), &pushConstants);
+    vkCmdDispatch(cmd, groupsX, groupsY, 1);
+}
+
+void OcclusionCuller::draw(VkCommandBuffer cmd, CullPhase phase)
+{
+    uint32_t phaseIndex = (uint32_t)phase;
+    vkCmdDrawIndexedIndirectCount(cmd, _drawCommands[phaseIndex].buffer, 0, _drawCounts.buffer, phaseIndex * DRAW_COUNT_STRIDE,
+        _maxObjects, sizeof(VkDrawIndexedIndirectCommand));
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+#include "vk_memory.h"
+#include "vk_textures.h"
+
+// Per object data read by cull.comp and the OBJECT_BUFFER vertex shader variant, matches the
+// std430 Object struct in both
+struct GPUObject {
+    glm::mat4 world;
+    // object space bounding sphere, center and radius
+    glm::vec4 bounds;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t materialIndex;
+    VkDeviceAddress vertexBuffer;
+    uint64_t pad2;
+};
+
+enum class CullPhase : uint32_t {
+    Early,
+    Late,
+};
+
+// GPU frustum and occlusion culling against a hierarchical depth pyramid, in two phases.
+// The early phase draws what was visible last frame, the pyramid is built from the depth that
+// leaves, and the late phase tests every object against it and draws the ones that became
+// visible. Nothing pops in a frame late, and the visibility buffer carries the result over
+// to the next frame.
+class OcclusionCuller {
+public:
+    // pyramidShader and cullShader stay owned by the caller, the layouts and the sampler by the caches
+    void init(VkDevice device, VmaAllocator allocator, const AllocatedImage& depthImage, uint32_t maxObjects,
+        VkShaderModule pyramidShader, VkShaderModule cullShader, LayoutCache& layouts, SamplerCache& samplers,
+        MemoryTracker* tracker = nullptr);
+    void destroy(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+
+    // zeroes the visibility and the pyramid counter, record once before the first frame
+    void clear_state(VkCommandBuffer cmd);
+    // zeroes the draw counts of both phases
+    void reset_counts(VkCommandBuffer cmd);
+    // pyramid in SHADER_READ_ONLY_OPTIMAL, only read by the late phase
+    void cull(VkCommandBuffer cmd, CullPhase phase, VkDeviceAddress objects, uint32_t objectCount, const glm::mat4& viewProj);
+    // depth image in SHADER_READ_ONLY_OPTIMAL, pyramid in GENERAL
+    void build_pyramid(VkCommandBuffer cmd);
+    // pipeline, push constants and the index buffer shared by all objects are bound by the caller
+    void draw(VkCommandBuffer cmd, CullPhase phase);
+
+    AllocatedImage _pyramid;
+    VkExtent2D _pyramidExtent;
+    uint32_t _pyramidLevels;
+
+    // VkDrawIndexedIndirectCommand per visible object, one buffer per phase
+    AllocatedBuffer _drawCommands[2];
+    // early count at 0, late count at DRAW_COUNT_STRIDE
+    AllocatedBuffer _drawCounts;
+    // one uint per object, 1 when it passed the last late phase
+    AllocatedBuffer _visibility;
+    // finished workgroups of the pyramid dispatch, reset by the last one
+    AllocatedBuffer _pyramidCounter;
+
+    static constexpr VkDeviceSize DRAW_COUNT_STRIDE = 16;
+
+private:
+    AllocatedBuffer create_buffer(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, MemoryTracker* tracker);
+
+    uint32_t _maxObjects;
+    VkExtent2D _depthExtent;
+
+    std::vector<VkImageView> _levelViews;
+    // owned by the SamplerCache
+    VkSampler _minSampler;
+
+    DescriptorAllocator _descriptorAllocator;
+    // layouts owned by the LayoutCache
+    VkDescriptorSetLayout _pyramidSetLayout;
+    VkDescriptorSetLayout _cullSetLayout;
+    VkDescriptorSet _pyramidSet;
+    VkDescriptorSet _cullSet;
+
+    VkPipelineLayout _pyramidLayout;
+    VkPipeline _pyramidPipeline;
+    VkPipelineLayout _cullLayout;
+    VkPipeline _cullPipeline;
+
+    VkDeviceAddress _drawCommandAddresses[2];
+    VkDeviceAddress _drawCountAddress;
+    VkDeviceAddress _visibilityAddress;
+};
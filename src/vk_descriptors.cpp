@@ -1,10 +1,12 @@
 #include "vk_descriptors.h"
 
-void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type)
+#include <algorithm>
+
+void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type, uint32_t count)
 {
     VkDescriptorSetLayoutBinding newbind {};
     newbind.binding = binding;
-    newbind.descriptorCount = 1;
+    newbind.descriptorCount = count;
     newbind.descriptorType = type;
 
     bindings.push_back(newbind);
@@ -33,6 +35,14 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderSt
     return set;
 }
 
+VkDescriptorSetLayout DescriptorLayoutBuilder::build(LayoutCache& cache, VkShaderStageFlags shaderStages, VkDescriptorSetLayoutCreateFlags flags)
+{
+    for (auto& b : bindings) {
+        b.stageFlags |= shaderStages;
+    }
+    return cache.get_set_layout(bindings, flags);
+}
+
 void DescriptorAllocator::init_pool(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios)
 {
     std::vector<VkDescriptorPoolSize> poolSizes;
@@ -75,3 +85,129 @@ VkDescriptorSet DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLa
 
     return ds;
 }
+
+static void hash_combine(size_t& seed, size_t value)
+{
+    seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+bool LayoutCache::SetLayoutKey::operator==(const SetLayoutKey& other) const
+{
+    if (flags != other.flags || bindings.size() != other.bindings.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < bindings.size(); i++) {
+        const VkDescriptorSetLayoutBinding& a = bindings[i];
+        const VkDescriptorSetLayoutBinding& b = other.bindings[i];
+        if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount
+            || a.stageFlags != b.stageFlags) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LayoutCache::PipelineLayoutKey::operator==(const PipelineLayoutKey& other) const
+{
+    if (setLayouts != other.setLayouts || pushConstants.size() != other.pushConstants.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < pushConstants.size(); i++) {
+        const VkPushConstantRange& a = pushConstants[i];
+        const VkPushConstantRange& b = other.pushConstants[i];
+        if (a.stageFlags != b.stageFlags || a.offset != b.offset || a.size != b.size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t LayoutCache::KeyHash::operator()(const SetLayoutKey& key) const
+{
+    size_t hash = std::hash<uint32_t>()(key.flags);
+    for (const VkDescriptorSetLayoutBinding& binding : key.bindings) {
+        hash_combine(hash, binding.binding);
+        hash_combine(hash, binding.descriptorType);
+        hash_combine(hash, binding.descriptorCount);
+        hash_combine(hash, binding.stageFlags);
+    }
+    return hash;
+}
+
+size_t LayoutCache::KeyHash::operator()(const PipelineLayoutKey& key) const
+{
+    size_t hash = 0;
+    for (VkDescriptorSetLayout setLayout : key.setLayouts) {
+        hash_combine(hash, std::hash<VkDescriptorSetLayout>()(setLayout));
+    }
+    for (const VkPushConstantRange& range : key.pushConstants) {
+        hash_combine(hash, range.stageFlags);
+        hash_combine(hash, range.offset);
+        hash_combine(hash, range.size);
+    }
+    return hash;
+}
+
+void LayoutCache::init(VkDevice device)
+{
+    _device = device;
+}
+
+void LayoutCache::destroy()
+{
+    for (auto& [key, layout] : _pipelineLayouts) {
+        vkDestroyPipelineLayout(_device, layout, nullptr);
+    }
+    _pipelineLayouts.clear();
+    for (auto& [key, layout] : _setLayouts) {
+        vkDestroyDescriptorSetLayout(_device, layout, nullptr);
+    }
+    _setLayouts.clear();
+}
+
+VkDescriptorSetLayout LayoutCache::get_set_layout(std::span<const VkDescriptorSetLayoutBinding> bindings, VkDescriptorSetLayoutCreateFlags flags)
+{
+    SetLayoutKey key = { std::vector<VkDescriptorSetLayoutBinding>(bindings.begin(), bindings.end()), flags };
+    // the order bindings are declared in does not change the layout
+    std::sort(key.bindings.begin(), key.bindings.end(),
+        [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+
+    auto it = _setLayouts.find(key);
+    if (it != _setLayouts.end()) {
+        return it->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo info = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    info.pBindings = key.bindings.data();
+    info.bindingCount = (uint32_t)key.bindings.size();
+    info.flags = flags;
+
+    VkDescriptorSetLayout layout;
+    check_vk_result(vkCreateDescriptorSetLayout(_device, &info, nullptr, &layout));
+    _setLayouts.emplace(std::move(key), layout);
+    return layout;
+}
+
+VkPipelineLayout LayoutCache::get_pipeline_layout(std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstants)
+{
+    PipelineLayoutKey key = {
+        std::vector<VkDescriptorSetLayout>(setLayouts.begin(), setLayouts.end()),
+        std::vector<VkPushConstantRange>(pushConstants.begin(), pushConstants.end()),
+    };
+
+    auto it = _pipelineLayouts.find(key);
+    if (it != _pipelineLayouts.end()) {
+        return it->second;
+    }
+
+    VkPipelineLayoutCreateInfo info = {.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    info.setLayoutCount = (uint32_t)key.setLayouts.size();
+    info.pSetLayouts = key.setLayouts.data();
+    info.pushConstantRangeCount = (uint32_t)key.pushConstants.size();
+    info.pPushConstantRanges = key.pushConstants.data();
+
+    VkPipelineLayout layout;
+    check_vk_result(vkCreatePipelineLayout(_device, &info, nullptr, &layout));
+    _pipelineLayouts.emplace(std::move(key), layout);
+    return layout;
+}
@@ -2,13 +2,19 @@
 
 #include "vk_types.h"
 
+#include <unordered_map>
+
+class LayoutCache;
+
 struct DescriptorLayoutBuilder {
 
     std::vector<VkDescriptorSetLayoutBinding> bindings;
 
-    void add_binding(uint32_t binding, VkDescriptorType type);
+    void add_binding(uint32_t binding, VkDescriptorType type, uint32_t count = 1);
     void clear();
     VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStages, void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0);
+    // shared layout owned by the cache
+    VkDescriptorSetLayout build(LayoutCache& cache, VkShaderStageFlags shaderStages, VkDescriptorSetLayoutCreateFlags flags = 0);
 };
 
 struct DescriptorAllocator {
@@ -25,4 +31,46 @@ struct DescriptorAllocator {
     void destroy_pool(VkDevice device);
 
     VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout);
-};
\ No newline at end of file
+};
+
+// Descriptor set layouts and pipeline layouts, keyed by their contents so that everything asking
+// for the same layout gets the same handle. Pipelines created with a shared layout are layout
+// compatible, binding one after the other keeps the bound sets and push constants. The handles
+// stay valid until destroy(), callers never destroy them.
+class LayoutCache {
+public:
+    void init(VkDevice device);
+    void destroy();
+
+    // bindings without immutable samplers
+    VkDescriptorSetLayout get_set_layout(std::span<const VkDescriptorSetLayoutBinding> bindings, VkDescriptorSetLayoutCreateFlags flags = 0);
+    VkPipelineLayout get_pipeline_layout(std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstants = {});
+
+    size_t set_layout_count() const { return _setLayouts.size(); }
+    size_t pipeline_layout_count() const { return _pipelineLayouts.size(); }
+
+private:
+    struct SetLayoutKey {
+        // sorted by binding number
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        VkDescriptorSetLayoutCreateFlags flags;
+
+        bool operator==(const SetLayoutKey& other) const;
+    };
+
+    struct PipelineLayoutKey {
+        std::vector<VkDescriptorSetLayout> setLayouts;
+        std::vector<VkPushConstantRange> pushConstants;
+
+        bool operator==(const PipelineLayoutKey& other) const;
+    };
+
+    struct KeyHash {
+        size_t operator()(const SetLayoutKey& key) const;
+        size_t operator()(const PipelineLayoutKey& key) const;
+    };
+
+    VkDevice _device;
+    std::unordered_map<SetLayoutKey, VkDescriptorSetLayout, KeyHash> _setLayouts;
+    std::unordered_map<PipelineLayoutKey, VkPipelineLayout, KeyHash> _pipelineLayouts;
+};
@@ -17,11 +17,21 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_vulkan.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <thread>
 
 constexpr bool bUseValidationLayers = true;
 
+constexpr const char* WORKGROUP_SIZES_FILE = "workgroup_sizes.txt";
+constexpr const char* SHADER_CACHE_DIR = "shader_cache";
+constexpr const char* CAPTURE_DIR = "capture";
+// frames the writer thread may fall behind before captured frames get dropped
+constexpr uint32_t CAPTURE_SLOT_COUNT = 4;
+
 VkEngine* loadedEngine = nullptr;
 
 VkEngine& VkEngine::Get() { return *loadedEngine; }
@@ -49,16 +59,24 @@ VkEngine::VkEngine()
         abort();
     }
 
+    init_window_callbacks();
     init_vulkan();
 	init_swapchain();
 	init_commands();
 	init_sync_structures();
+	init_transient_buffers();
+	init_capture();
     init_descriptors();
+    init_materials();
     init_pipelines();
     init_imgui();
+    init_render_graph();
+    init_shader_reload();
     
     init_default_data();
+    init_scene();
 
+    _startTime = std::chrono::steady_clock::now();
     _isInitialized = true;
 }
 
@@ -73,6 +91,8 @@ VkEngine::~VkEngine()
 		for (int i = 0; i < FRAME_OVERLAP; i++) {
             _frames[i]._frameDeletionQueue.flush();
 			vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
+			vkDestroyCommandPool(_device, _frames[i]._computeCommandPool, nullptr);
+			vkDestroyQueryPool(_device, _frames[i]._timestampPool, nullptr);
             vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
             vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
             vkDestroySemaphore(_device ,_frames[i]._swapchainSemaphore, nullptr);
@@ -99,47 +119,169 @@ void VkEngine::draw()
     {
         check_vk_result(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000));
         get_current_frame()._frameDeletionQueue.flush();
+        get_current_frame()._transientBuffer.reset();
+        // every frame up to the one that used this FrameData has completed
+        if (_frameNumber >= FRAME_OVERLAP) {
+            _capture.collect(_frameNumber - FRAME_OVERLAP);
+        }
+        // pipelines rebuilt since the last frame
+        _shaderWatcher.apply();
+        _memoryTracker.update(_frameNumber);
+        read_gpu_timestamps();
+        _framePacer.collect(_swapchain);
         check_vk_result(vkResetFences(_device, 1, &get_current_frame()._renderFence));
     }
     // Acquire the next image
     uint32_t swapchainImageIndex;
     {
     	check_vk_result(vkAcquireNextImageKHR(_device, _swapchain, 1000000000, get_current_frame()._swapchainSemaphore, nullptr, &swapchainImageIndex));
+    	_swapchainImageIndex = swapchainImageIndex;
+    }
+    _drawExtent.width = _drawImage.imageExtent.width;
+    _drawExtent.height = _drawImage.imageExtent.height;
+    // Pick how the background gets into the draw image. Static effects are copied from the cache,
+    // animated ones are rendered on the compute queue, overlapping the graphics work of the previous frame
+    ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
+    bool cachedBackground = !effect.animated;
+    bool asyncBackground = !cachedBackground && _asyncComputeSupported && _useAsyncCompute;
+    {
+        if (effect.animated) {
+            effect.data.data4.w = std::chrono::duration<float>(std::chrono::steady_clock::now() - _startTime).count();
+        }
+        if (_backgroundCacheExtent.width != _drawExtent.width || _backgroundCacheExtent.height != _drawExtent.height) {
+            _backgroundCacheExtent = _drawExtent;
+            _backgroundCacheDirty = true;
+        }
+        bool refreshCache = cachedBackground && _backgroundCacheDirty;
+        if (refreshCache) {
+            _backgroundCacheDirty = false;
+        }
+
+        if (asyncBackground) {
+            submit_background_compute();
+        }
+        _renderGraph.set_pass_enabled("background", !cachedBackground && !asyncBackground);
+        _renderGraph.set_pass_enabled("background copy", asyncBackground);
+        _renderGraph.set_pass_enabled("background cache", refreshCache);
+        _renderGraph.set_pass_enabled("background cache copy", cachedBackground);
+        _renderGraph.set_image(_rgBackgroundImage, get_current_frame()._backgroundImage.image, get_current_frame()._backgroundImage.imageView);
+    }
+    // copy this frame out for the capture writer, dropped when every readback buffer is still in use
+    {
+        VkBuffer captureBuffer = VK_NULL_HANDLE;
+        if (_capture.active()) {
+            captureBuffer = _captureSwapchain
+                ? _capture.acquire(_frameNumber, _swapchainExtent, _swapchainImageFormat)
+                : _capture.acquire(_frameNumber, _drawExtent, _drawImage.imageFormat, _exposure, (uint32_t)_tonemapper);
+        }
+        _renderGraph.set_pass_enabled("capture draw image", captureBuffer && !_captureSwapchain);
+        _renderGraph.set_pass_enabled("capture swapchain", captureBuffer && _captureSwapchain);
+        if (captureBuffer) {
+            _renderGraph.set_buffer(_rgCaptureBuffer, captureBuffer);
+        }
+    }
+    // the simulated bodies at the time of this frame, between the last two ticks
+    if (_simulation.running()) {
+        _simulation.interpolate(std::chrono::steady_clock::now(), _bodyStates);
+        for (size_t i = 0; i < _bodyStates.size(); i++) {
+            _transforms.set_position(_simulatedTransforms[i], _bodyStates[i].position);
+            _transforms.set_rotation(_simulatedTransforms[i], _bodyStates[i].rotation);
+        }
+    }
+    // world matrices of everything that moved since the last frame
+    _transforms.update(&_workerPool);
+    // the culler reads the objects from the GPU, so they go into this frame's transient buffer.
+    // Only the opaque ones, transparent objects are drawn by their own pass
+    _transparentPass = false;
+    {
+        std::vector<GPUObject> objects;
+        objects.reserve(_sceneObjects.size());
+        _culledMesh = nullptr;
+        for (const SceneObject& object : _sceneObjects) {
+            if (_materials.material_template(object.material) != MaterialTemplate::Opaque) {
+                _transparentPass = true;
+                continue;
+            }
+            // the direct draws bind each object's own buffers
+            if (_occlusionCulling && _culledMesh && object.mesh != _culledMesh) {
+                std::cout << "Opaque scene objects have to share one mesh, the culled draws bind a single index buffer" << std::endl;
+                abort();
+            }
+            _culledMesh = object.mesh;
+            GPUObject gpuObject = {};
+            gpuObject.world = _transforms.world(object.transform);
+            gpuObject.bounds = object.bounds;
+            gpuObject.indexCount = object.indexCount;
+            gpuObject.firstIndex = object.firstIndex;
+            gpuObject.vertexOffset = object.vertexOffset;
+            gpuObject.materialIndex = object.material;
+            gpuObject.vertexBuffer = object.mesh->vertexBufferAddress;
+            objects.push_back(gpuObject);
+        }
+        TransientAllocation gpuObjects = get_current_frame()._transientBuffer.push(std::span<const GPUObject>(objects));
+        _gpuObjects = gpuObjects.deviceAddress;
+        // nothing is culled or drawn from the object buffer when it did not fit
+        _gpuObjectCount = gpuObjects.mapped ? (uint32_t)objects.size() : 0;
+    }
+    // only the materials changed since the last frame are copied
+    _renderGraph.set_pass_enabled("material upload", _materials.upload_size() > 0);
+    _renderGraph.set_pass_enabled("transparent geometry", _transparentPass);
+    if (_particlesEnabled && !_particles.allocated()) {
+        allocate_particles();
+    }
+    // how many particles to spawn is all the CPU decides, everything per particle happens on the GPU
+    if (_particlesEnabled) {
+        auto now = std::chrono::steady_clock::now();
+        _particleDeltaTime = std::min(std::chrono::duration<float>(now - _lastParticleTime).count(), MAX_PARTICLE_STEP);
+        _lastParticleTime = now;
+        float emitted = _particleEmitRate * _particleDeltaTime + _particleEmitRemainder;
+        _particleEmitCount = (uint32_t)emitted;
+        _particleEmitRemainder = emitted - (float)_particleEmitCount;
+    }
+    _renderGraph.set_pass_enabled("particle reset", _particlesEnabled && _particleReset);
+    for (const char* pass : { "particle begin", "particle emit", "particle simulate", "particles" }) {
+        _renderGraph.set_pass_enabled(pass, _particlesEnabled);
+    }
+    for (const char* pass : { "cull reset", "cull early", "culled geometry early", "depth pyramid", "cull late", "culled geometry late" }) {
+        _renderGraph.set_pass_enabled(pass, _occlusionCulling);
     }
+    _renderGraph.set_pass_enabled("depth prepass", depth_prepass_enabled());
+    _renderGraph.set_pass_enabled("multiview geometry", _multiviewEnabled);
+    _renderGraph.set_pass_enabled("multiview thumbnails", _multiviewEnabled);
     // Start command buffer recording
 	VkCommandBuffer cmd = get_current_frame()._mainCommandBuffer;
     {
         check_vk_result(vkResetCommandBuffer(cmd, 0));
         VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-        _drawExtent.width = _drawImage.imageExtent.width;
-	    _drawExtent.height = _drawImage.imageExtent.height;
         check_vk_result(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+        if (_gpuTimestamps) {
+            vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, get_current_frame()._timestampPool, 2);
+        }
     }
-    // Clear Screen
+    // Record the frame graph
     {
-        // draw to the image
-        vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-        draw_background(cmd);
-        vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        draw_geometry(cmd);
-        vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-        // move image to swapchain
-        vkutil::copy_image_to_image(cmd, _drawImage.image, _swapchainImages[swapchainImageIndex], _drawExtent, _swapchainExtent);
-        vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        draw_imgui(cmd, _swapchainImageViews[swapchainImageIndex]);
-    	vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        // the graph inserts every layout transition, including the final one to PRESENT_SRC
+        _renderGraph.set_image(_rgSwapchainImage, _swapchainImages[swapchainImageIndex], _swapchainImageViews[swapchainImageIndex]);
+        _renderGraph.execute(cmd);
 
+        if (_gpuTimestamps) {
+            vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, get_current_frame()._timestampPool, 3);
+        }
         // register to command buffer
         check_vk_result(vkEndCommandBuffer(cmd));
     }
     // Submit command buffer
     {
         VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);	
-        VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore);
+        VkSemaphoreSubmitInfo waitInfos[2] = {
+            vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore),
+            // the background copy waits for the compute queue
+            vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, _computeTimeline),
+        };
+        waitInfos[1].value = get_current_frame()._backgroundTimelineValue;
         VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame()._renderSemaphore);	
-        VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo,&signalInfo,&waitInfo);	
+        VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo,&signalInfo,waitInfos);	
+        submit.waitSemaphoreInfoCount = asyncBackground ? 2 : 1;
         check_vk_result(vkQueueSubmit2(_graphicsQueue, 1, &submit, get_current_frame()._renderFence));
     }
     // Present frame
@@ -152,13 +294,124 @@ void VkEngine::draw()
         presentInfo.pWaitSemaphores = &get_current_frame()._renderSemaphore;
         presentInfo.waitSemaphoreCount = 1;
         presentInfo.pImageIndices = &swapchainImageIndex;
+
+        // lets the frame pacer wait until this frame is on screen
+        uint64_t presentIdValue = _framePacer.next_present_id();
+        VkPresentIdKHR presentId = {.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR};
+        presentId.swapchainCount = 1;
+        presentId.pPresentIds = &presentIdValue;
+        if (_framePacer.present_wait()) {
+            presentInfo.pNext = &presentId;
+        }
         check_vk_result(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
 
         _frameNumber++;
     }
 }
 
-void VkEngine::draw_background(VkCommandBuffer cmd)
+void VkEngine::submit_background_compute()
+{
+    FrameData& frame = get_current_frame();
+    VkCommandBuffer cmd = frame._computeCommandBuffer;
+
+    check_vk_result(vkResetCommandBuffer(cmd, 0));
+    VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    check_vk_result(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+    if (_gpuTimestamps) {
+        vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame._timestampPool, 0);
+    }
+
+    // the contents are overwritten, and the fence of this frame already covered the last copy out of it
+    vkutil::ImageState backgroundState = {};
+    vkutil::transition_image(cmd, frame._backgroundImage.image, backgroundState, vkutil::ImageUsage::ComputeWrite);
+    draw_background(cmd, frame._backgroundDescriptors);
+
+    if (_gpuTimestamps) {
+        vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame._timestampPool, 1);
+    }
+    check_vk_result(vkEndCommandBuffer(cmd));
+
+    frame._backgroundTimelineValue = ++_computeTimelineValue;
+
+    VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);
+    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, _computeTimeline);
+    signalInfo.value = frame._backgroundTimelineValue;
+    VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, &signalInfo, nullptr);
+    check_vk_result(vkQueueSubmit2(_computeQueue, 1, &submit, VK_NULL_HANDLE));
+}
+
+void VkEngine::read_gpu_timestamps()
+{
+    if (!_gpuTimestamps) {
+        return;
+    }
+    FrameData& frame = get_current_frame();
+
+    // value + availability pairs. The compute queries stay unavailable when the background ran on the graphics queue
+    uint64_t results[4][2] = {};
+    vkGetQueryPoolResults(_device, frame._timestampPool, 0, 4, sizeof(results), results, sizeof(results[0]),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    vkResetQueryPool(_device, frame._timestampPool, 0, 4);
+
+    if (!results[2][1] || !results[3][1]) {
+        return;
+    }
+
+    GpuTimings timings = {};
+    timings.hasCompute = results[0][1] && results[1][1];
+    timings.computeBegin = results[0][0];
+    timings.computeEnd = results[1][0];
+    timings.graphicsBegin = results[2][0];
+    timings.graphicsEnd = results[3][0];
+
+    // frames are read back in order, so the last timings are the graphics work this compute could overlap with
+    _computeGraphicsOverlap = 0;
+    if (timings.hasCompute && _lastGpuTimings.graphicsEnd != 0) {
+        uint64_t begin = std::max(timings.computeBegin, _lastGpuTimings.graphicsBegin);
+        uint64_t end = std::min(timings.computeEnd, _lastGpuTimings.graphicsEnd);
+        if (end > begin) {
+            _computeGraphicsOverlap = (end - begin) * _gpuProperties.limits.timestampPeriod / 1000000.0;
+        }
+    }
+
+    _lastGpuTimings = timings;
+}
+
+void VkEngine::draw_profiler_panel()
+{
+	if (ImGui::Begin("profiler")) {
+		if (!_gpuTimestamps) {
+			ImGui::Text("Timestamps are not supported on this device");
+		} else {
+			const GpuTimings& timings = _lastGpuTimings;
+			double toMs = _gpuProperties.limits.timestampPeriod / 1000000.0;
+			ImGui::Text("graphics: %.3f ms", (timings.graphicsEnd - timings.graphicsBegin) * toMs);
+			if (timings.hasCompute) {
+				ImGui::Text("compute:  %.3f ms", (timings.computeEnd - timings.computeBegin) * toMs);
+				ImGui::Text("overlap with the previous frame's graphics: %.3f ms", _computeGraphicsOverlap);
+			}
+		}
+
+		if (_framePacer.present_wait()) {
+			// without low latency the present is only seen done when the next frame polls for it
+			ImGui::Text("input to present%s: %.2f ms, average %.2f ms", _framePacer._latencyUpperBound ? " (upper bound)" : "",
+				_framePacer._latencyMs, _framePacer._averageLatencyMs);
+		} else {
+			ImGui::Text("No VK_KHR_present_wait, input to present latency is not measured");
+		}
+		ImGui::Checkbox("low latency", &_lowLatency);
+		ImGui::SliderFloat("frame limit (fps)", &_targetFps, 0.f, 240.f, _targetFps > 0.f ? "%.0f" : "unlimited");
+
+		if (_asyncComputeSupported) {
+			ImGui::Checkbox("async compute background", &_useAsyncCompute);
+		} else {
+			ImGui::Text("No separate compute queue family, the background runs on the graphics queue");
+		}
+	}
+	ImGui::End();
+}
+
+void VkEngine::draw_background(VkCommandBuffer cmd, VkDescriptorSet targetImage)
 {
     ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
 
@@ -166,13 +419,14 @@ void VkEngine::draw_background(VkCommandBuffer cmd)
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
 
 	// bind the descriptor set containing the draw image for the compute pipeline
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, 1, &_drawImageDescriptors, 0, nullptr);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, 1, &targetImage, 0, nullptr);
 
 
     vkCmdPushConstants(cmd, _gradientPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.data);
 
-	// execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it
-	vkCmdDispatch(cmd, std::ceil(_drawExtent.width / 16.0), std::ceil(_drawExtent.height / 16.0), 1);
+	// execute the compute pipeline dispatch, one workgroup per tile of the tuned size
+	vkCmdDispatch(cmd, (_drawExtent.width + effect.workgroupSize.x - 1) / effect.workgroupSize.x,
+		(_drawExtent.height + effect.workgroupSize.y - 1) / effect.workgroupSize.y, 1);
 }
 
 void VkEngine::draw_geometry(VkCommandBuffer cmd)
@@ -180,10 +434,29 @@ void VkEngine::draw_geometry(VkCommandBuffer cmd)
     //begin a render pass  connected to our draw image
 	VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-	VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, nullptr);
+	// reversed-Z, the far plane is 0. Loaded when the prepass already filled it, and only needed
+	// after this pass by the culled, the transparent and the particle draws
+	VkClearValue depthClear = {};
+	VkRenderingAttachmentInfo depthAttachment = vkinit::attachment_info(_depthImage.imageView, depth_prepass_enabled() ? nullptr : &depthClear,
+		VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	depthAttachment.storeOp = _occlusionCulling || blended_passes_enabled()
+		? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
 	vkCmdBeginRendering(cmd, &renderInfo);
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
+	bool shaderObjects = _useShaderObjects && _shaderObjectsSupported;
+	if (shaderObjects) {
+		// what _trianglePipeline and _meshPipeline bake in
+		GraphicsState state;
+		state.depthTest = true;
+		state.depthWrite = true;
+		state.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+		_shaderObjects.set_state(cmd, state, _drawExtent);
+		_shaderObjects.bind(cmd, _triangleVertexObject, _triangleFragmentObject);
+	} else {
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
+	}
 
 	//set dynamic viewport and scissor
 	VkViewport viewport = {};
@@ -207,16 +480,240 @@ void VkEngine::draw_geometry(VkCommandBuffer cmd)
 	//launch a draw command to draw 3 vertices
 	vkCmdDraw(cmd, 3, 1, 0, 0);
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
+	// otherwise the culled geometry passes draw the objects
+	if (!_occlusionCulling) {
+		if (shaderObjects) {
+			_shaderObjects.bind(cmd, _meshVertexObject, _meshFragmentObject);
+			// _meshEqualPipeline is two state changes away
+			if (depth_prepass_enabled()) {
+				vkCmdSetDepthWriteEnable(cmd, VK_FALSE);
+				vkCmdSetDepthCompareOp(cmd, VK_COMPARE_OP_EQUAL);
+			}
+		} else {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass_enabled() ? _meshEqualPipeline : _meshPipeline);
+		}
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipelineLayout, 0, 1, &_meshDescriptors, 0, nullptr);
+		draw_scene_objects(cmd, {}, MaterialTemplate::Opaque);
+	}
+
+	vkCmdEndRendering(cmd);
+}
+
+void VkEngine::draw_scene_objects(VkCommandBuffer cmd, GPUDrawPushConstants pushConstants, MaterialTemplate materialTemplate)
+{
+	for (const SceneObject& object : _sceneObjects) {
+		if (_materials.material_template(object.material) != materialTemplate) {
+			continue;
+		}
+		pushConstants.worldMatrix = _transforms.world(object.transform);
+		pushConstants.vertexBuffer = object.mesh->vertexBufferAddress;
+		pushConstants.materialIndex = object.material;
+
+		vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+		vkCmdBindIndexBuffer(cmd, object.mesh->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+		vkCmdDrawIndexed(cmd, object.indexCount, 1, object.firstIndex, object.vertexOffset, 0);
+	}
+}
+
+void VkEngine::draw_culled_geometry(VkCommandBuffer cmd, CullPhase phase)
+{
+	// adds to what the earlier passes drew
+	VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	VkRenderingAttachmentInfo depthAttachment = vkinit::attachment_info(_depthImage.imageView, nullptr, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	// the pyramid is built from the depth the early draws leave, the blended draws test against the late ones
+	depthAttachment.storeOp = phase == CullPhase::Early || blended_passes_enabled() ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+	vkCmdBeginRendering(cmd, &renderInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _culledPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipelineLayout, 0, 1, &_meshDescriptors, 0, nullptr);
+
+	VkViewport viewport = { 0.f, 0.f, (float)_drawExtent.width, (float)_drawExtent.height, 0.f, 1.f };
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, _drawExtent };
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-	GPUDrawPushConstants push_constants;
-	push_constants.worldMatrix = glm::mat4{ 1.f };
-	push_constants.vertexBuffer = rectangle.vertexBufferAddress;
+	// the scene has no camera, the view-projection is the identity like in the other passes
+	GPUDrawPushConstants push_constants = {};
+	push_constants.worldMatrix = glm::mat4(1.f);
+	push_constants.objectBuffer = _gpuObjects;
 
 	vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
-	vkCmdBindIndexBuffer(cmd, rectangle.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+	// null when there is no opaque object, there is nothing to draw
+	if (_culledMesh) {
+		vkCmdBindIndexBuffer(cmd, _culledMesh->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		_culler.draw(cmd, phase);
+	}
+
+	vkCmdEndRendering(cmd);
+}
+
+void VkEngine::draw_transparent_geometry(VkCommandBuffer cmd)
+{
+	// over everything the opaque passes drew, tested against their depth
+	VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	VkRenderingAttachmentInfo depthAttachment = vkinit::attachment_info(_depthImage.imageView, nullptr, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	// nothing here writes depth, the particles after it test against the same
+	depthAttachment.storeOp = _particlesEnabled ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+	vkCmdBeginRendering(cmd, &renderInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _transparentPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipelineLayout, 0, 1, &_meshDescriptors, 0, nullptr);
+
+	VkViewport viewport = { 0.f, 0.f, (float)_drawExtent.width, (float)_drawExtent.height, 0.f, 1.f };
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, _drawExtent };
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	// the view-projection is the identity, so the world z is the reversed-Z depth and the
+	// farthest object has the smallest
+	std::vector<const SceneObject*> objects;
+	for (const SceneObject& object : _sceneObjects) {
+		if (_materials.material_template(object.material) == MaterialTemplate::Transparent) {
+			objects.push_back(&object);
+		}
+	}
+	std::sort(objects.begin(), objects.end(), [this](const SceneObject* a, const SceneObject* b) {
+		return _transforms.world(a->transform)[3].z < _transforms.world(b->transform)[3].z;
+	});
+
+	GPUDrawPushConstants push_constants = {};
+	for (const SceneObject* object : objects) {
+		push_constants.worldMatrix = _transforms.world(object->transform);
+		push_constants.vertexBuffer = object->mesh->vertexBufferAddress;
+		push_constants.materialIndex = object->material;
+
+		vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+		vkCmdBindIndexBuffer(cmd, object->mesh->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+		vkCmdDrawIndexed(cmd, object->indexCount, 1, object->firstIndex, object->vertexOffset, 0);
+	}
+
+	vkCmdEndRendering(cmd);
+}
+
+void VkEngine::draw_particles(VkCommandBuffer cmd)
+{
+	// over everything else in the scene, tested against its depth
+	VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	VkRenderingAttachmentInfo depthAttachment = vkinit::attachment_info(_depthImage.imageView, nullptr, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+	vkCmdBeginRendering(cmd, &renderInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _particlePipeline);
+
+	VkViewport viewport = { 0.f, 0.f, (float)_drawExtent.width, (float)_drawExtent.height, 0.f, 1.f };
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, _drawExtent };
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	// square on screen
+	float aspect = (float)_drawExtent.width / (float)_drawExtent.height;
+	_particles.draw(cmd, glm::vec2(_particleEmitter.size / aspect, _particleEmitter.size));
+
+	vkCmdEndRendering(cmd);
+}
+
+void VkEngine::draw_depth_prepass(VkCommandBuffer cmd)
+{
+	VkClearValue depthClear = {};
+	VkRenderingAttachmentInfo depthAttachment = vkinit::attachment_info(_depthImage.imageView, &depthClear, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, nullptr, &depthAttachment);
+	renderInfo.colorAttachmentCount = 0;
+	vkCmdBeginRendering(cmd, &renderInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _depthPrepassPipeline);
+
+	VkViewport viewport = { 0.f, 0.f, (float)_drawExtent.width, (float)_drawExtent.height, 0.f, 1.f };
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, _drawExtent };
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	// same matrices as the main pass, so the depth matches exactly
+	draw_scene_objects(cmd, {}, MaterialTemplate::Opaque);
 
-	vkCmdDrawIndexed(cmd, 6, 1, 0, 0, 0);
+	vkCmdEndRendering(cmd);
+}
+
+void VkEngine::update_multiview_cameras()
+{
+    // cameras on an arc around the scene, looking at its origin
+    VkExtent3D extent = _renderGraph.get_image(_rgMultiviewImage).imageExtent;
+    float aspect = (float)extent.width / (float)extent.height;
+    // the thumbnails have no depth attachment, but use the same depth convention as the rest of the engine
+    glm::mat4 projection = perspective_reversed_z(glm::radians(60.f), aspect, 0.1f);
+
+    for (uint32_t i = 0; i < MULTIVIEW_VIEW_COUNT; i++) {
+        float angle = glm::radians(-45.f + 90.f * i / (MULTIVIEW_VIEW_COUNT - 1));
+        glm::vec3 eye = glm::vec3(glm::sin(angle), 0.f, glm::cos(angle)) * 2.5f;
+        _multiviewMatrices[i] = projection * glm::lookAt(eye, glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+    }
+}
+
+void VkEngine::draw_tonemap(VkCommandBuffer cmd, VkDescriptorSet descriptors, VkExtent2D extent)
+{
+	TonemapPushConstants push_constants = {};
+	push_constants.uvScale = glm::vec2((float)_drawExtent.width / _drawImage.imageExtent.width,
+		(float)_drawExtent.height / _drawImage.imageExtent.height);
+	push_constants.exposure = _exposure;
+	push_constants.tonemapper = _tonemapper;
+	push_constants.frame = (uint32_t)_frameNumber;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _tonemapPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _tonemapPipelineLayout, 0, 1, &descriptors, 0, nullptr);
+	vkCmdPushConstants(cmd, _tonemapPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TonemapPushConstants), &push_constants);
+	vkCmdDispatch(cmd, (extent.width + 15) / 16, (extent.height + 15) / 16, 1);
+}
+
+void VkEngine::draw_multiview_geometry(VkCommandBuffer cmd)
+{
+	const AllocatedImage& target = _renderGraph.get_image(_rgMultiviewImage);
+	VkExtent2D extent = { target.imageExtent.width, target.imageExtent.height };
+
+	VkClearValue clear = {};
+	VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(target.imageView, &clear, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+	// one pass writes every layer, the view index picks the layer and the matrix
+	VkRenderingInfo renderInfo = vkinit::rendering_info(extent, &colorAttachment, nullptr);
+	renderInfo.viewMask = (1u << MULTIVIEW_VIEW_COUNT) - 1;
+	vkCmdBeginRendering(cmd, &renderInfo);
+
+	if (_multiviewPipeline == VK_NULL_HANDLE) {
+		_multiviewPipeline = colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL | SHADER_FEATURE_MULTIVIEW,
+			DepthMode::None, renderInfo.viewMask, true);
+	}
+	// the thumbnails stay cleared while the pipeline is being created
+	if (_multiviewPipeline == VK_NULL_HANDLE) {
+		vkCmdEndRendering(cmd);
+		return;
+	}
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _multiviewPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipelineLayout, 0, 1, &_meshDescriptors, 0, nullptr);
+
+	VkViewport viewport = { 0.f, 0.f, (float)extent.width, (float)extent.height, 0.f, 1.f };
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	VkRect2D scissor = { { 0, 0 }, extent };
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	TransientAllocation views = get_current_frame()._transientBuffer.push(_multiviewMatrices);
+	if (!views.mapped) {
+		vkCmdEndRendering(cmd);
+		return;
+	}
+
+	GPUDrawPushConstants push_constants = {};
+	push_constants.viewBuffer = views.deviceAddress;
+	// there is no depth in the thumbnails, transparent objects are drawn last but not blended
+	draw_scene_objects(cmd, push_constants, MaterialTemplate::Opaque);
+	draw_scene_objects(cmd, push_constants, MaterialTemplate::Transparent);
 
 	vkCmdEndRendering(cmd);
 }
@@ -225,12 +722,92 @@ void VkEngine::run()
 {
     while (!glfwWindowShouldClose(_window))
     {
-        glfwPollEvents();       
         if (stop_rendering) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            // minimized, only a window event brings it back
+            glfwWaitEvents();
             continue;
         }
-        
+
+        if (_idleRendering && !needs_redraw()) {
+            // the event callbacks request a redraw, the timeout catches background work finishing
+            glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+            if (stop_rendering || !needs_redraw()) {
+                continue;
+            }
+        }
+
+        // every wait comes before the input is read, so the frame is built from the latest
+        if (_lowLatency) {
+            wait_for_previous_frame();
+        }
+        _framePacer.limit(_targetFps);
+        glfwPollEvents();
+        if (stop_rendering) {
+            continue;
+        }
+        _framePacer.input_sampled();
+
+        frame();
+        if (_redrawFrames > 0) {
+            _redrawFrames--;
+        }
+    }
+}
+
+void VkEngine::init_window_callbacks()
+{
+    const char* idleRendering = std::getenv("CGCV_IDLE_RENDERING");
+    _idleRendering = idleRendering && std::string(idleRendering) == "1";
+
+    glfwSetCursorPosCallback(_window, [](GLFWwindow*, double, double) { VkEngine::Get().request_redraw(); });
+    glfwSetCursorEnterCallback(_window, [](GLFWwindow*, int) { VkEngine::Get().request_redraw(); });
+    glfwSetMouseButtonCallback(_window, [](GLFWwindow*, int, int, int) { VkEngine::Get().request_redraw(); });
+    glfwSetScrollCallback(_window, [](GLFWwindow*, double, double) { VkEngine::Get().request_redraw(); });
+    glfwSetKeyCallback(_window, [](GLFWwindow*, int, int, int, int) { VkEngine::Get().request_redraw(); });
+    glfwSetCharCallback(_window, [](GLFWwindow*, unsigned int) { VkEngine::Get().request_redraw(); });
+    glfwSetWindowFocusCallback(_window, [](GLFWwindow*, int) { VkEngine::Get().request_redraw(); });
+    // the window contents were damaged, e.g. uncovered by another window
+    glfwSetWindowRefreshCallback(_window, [](GLFWwindow*) { VkEngine::Get().request_redraw(); });
+
+    // some platforms never report minimizing, only a framebuffer without area
+    glfwSetWindowIconifyCallback(_window, [](GLFWwindow*, int iconified) {
+        VkEngine::Get().stop_rendering = iconified == GLFW_TRUE;
+        VkEngine::Get().request_redraw();
+    });
+    glfwSetFramebufferSizeCallback(_window, [](GLFWwindow* window, int width, int height) {
+        VkEngine::Get().stop_rendering = width == 0 || height == 0 || glfwGetWindowAttrib(window, GLFW_ICONIFIED);
+        VkEngine::Get().request_redraw();
+    });
+}
+
+void VkEngine::wait_for_previous_frame()
+{
+    if (_framePacer.present_wait()) {
+        _framePacer.wait_for_last_present(_swapchain, 1000000000);
+    } else if (_frameNumber > 0) {
+        // the GPU is done with it, but it can still be queued for display
+        FrameData& previous = _frames[(_frameNumber - 1) % FRAME_OVERLAP];
+        check_vk_result(vkWaitForFences(_device, 1, &previous._renderFence, true, 1000000000));
+    }
+}
+
+bool VkEngine::needs_redraw()
+{
+    const ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
+    return _redrawFrames > 0
+        || effect.animated
+        || _backgroundCacheDirty
+        || _capture.active()
+        || _simulation.running()
+        || _particlesEnabled
+        || _materials.upload_size() > 0
+        // the thumbnails are cleared until the compile thread has built their pipeline
+        || (_multiviewEnabled && _multiviewPipeline == VK_NULL_HANDLE)
+        || _shaderWatcher.has_pending();
+}
+
+void VkEngine::frame()
+{
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -241,19 +818,35 @@ void VkEngine::run()
 		
 			ImGui::Text("Selected effect: %s", selected.name);
 		
-			ImGui::SliderInt("Effect Index", &currentBackgroundEffect,0, backgroundEffects.size() - 1);
+			// any edit invalidates the cached background
+			_backgroundCacheDirty |= ImGui::SliderInt("Effect Index", &currentBackgroundEffect,0, backgroundEffects.size() - 1);
 		
-			ImGui::InputFloat4("data1",(float*)& selected.data.data1);
-			ImGui::InputFloat4("data2",(float*)& selected.data.data2);
-			ImGui::InputFloat4("data3",(float*)& selected.data.data3);
-			ImGui::InputFloat4("data4",(float*)& selected.data.data4);
+			_backgroundCacheDirty |= ImGui::InputFloat4("data1",(float*)& selected.data.data1);
+			_backgroundCacheDirty |= ImGui::InputFloat4("data2",(float*)& selected.data.data2);
+			_backgroundCacheDirty |= ImGui::InputFloat4("data3",(float*)& selected.data.data3);
+			_backgroundCacheDirty |= ImGui::InputFloat4("data4",(float*)& selected.data.data4);
+			_backgroundCacheDirty |= ImGui::Checkbox("animated", &selected.animated);
+
+			ImGui::Text("Workgroup size: %ux%u", selected.workgroupSize.x, selected.workgroupSize.y);
+			if (ImGui::Button("Tune workgroup sizes")) {
+				_tuneWorkgroupSizes = true;
+			}
 		}
 		ImGui::End();
 
+		draw_memory_panel();
+		draw_profiler_panel();
+		draw_scene_panel();
+		draw_capture_panel();
+
         ImGui::Render();
 
+        if (_tuneWorkgroupSizes) {
+            tune_background_effects();
+            _tuneWorkgroupSizes = false;
+        }
+
         draw();
-    }
 }
 
 void VkEngine::init_vulkan()
@@ -290,21 +883,91 @@ void VkEngine::init_vulkan()
         features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
         features12.bufferDeviceAddress = true;
         features12.descriptorIndexing = true;
+        features12.timelineSemaphore = true;
+        features12.hostQueryReset = true;
+        // occlusion culling: indirect draws with a GPU written count, and the min reduction sampler of the depth pyramid
+        features12.drawIndirectCount = true;
+        features12.samplerFilterMinmax = true;
+
+        VkPhysicalDeviceVulkan11Features features11{};
+        features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+        features11.multiview = true;
+
+        VkPhysicalDeviceFeatures features10{};
+        // the culled draws select their object through the instance index
+        features10.drawIndirectFirstInstance = true;
+        features10.shaderStorageImageArrayDynamicIndexing = true;
+        // the tonemap pass writes BGRA swapchain images, which have no GLSL format qualifier
+        features10.shaderStorageImageWriteWithoutFormat = true;
+        features10.samplerAnisotropy = true;
 
         vkb::PhysicalDeviceSelector selector{ vkb_inst };
+        // e.g. CGCV_DEVICE_TYPE=cpu to pick a software implementation like lavapipe
+        if (const char* deviceType = std::getenv("CGCV_DEVICE_TYPE")) {
+            std::string type = deviceType;
+            if (type == "cpu") {
+                selector.prefer_gpu_device_type(vkb::PreferredDeviceType::cpu);
+            } else if (type == "integrated") {
+                selector.prefer_gpu_device_type(vkb::PreferredDeviceType::integrated);
+            } else if (type == "discrete") {
+                selector.prefer_gpu_device_type(vkb::PreferredDeviceType::discrete);
+            } else {
+                std::cout << "Unknown CGCV_DEVICE_TYPE " << type << ", expected cpu, integrated or discrete" << std::endl;
+            }
+        }
         vkb::PhysicalDevice physicalDevice = selector
             .set_minimum_version(1, 3)
             .set_required_features_13(features)
             .set_required_features_12(features12)
+            .set_required_features_11(features11)
+            .set_required_features(features10)
             .set_surface(_surface)
             .select()
             .value();
 
+        // optional, lets VMA report real per-heap budgets instead of estimates
+        _memoryBudgetSupported = physicalDevice.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+        // optional, pipeline-less drawing for the geometry pass
+        VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures{};
+        shaderObjectFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+        shaderObjectFeatures.shaderObject = true;
+        _shaderObjectsSupported = physicalDevice.enable_extension_if_present(VK_EXT_SHADER_OBJECT_EXTENSION_NAME)
+            && physicalDevice.enable_extension_features_if_present(shaderObjectFeatures);
+
+        // optional, frame pacing and latency measurement on present completion
+        VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+        presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        presentIdFeatures.presentId = true;
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+        presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        presentWaitFeatures.presentWait = true;
+        _presentWaitSupported = physicalDevice.enable_extensions_if_present({ VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME })
+            && physicalDevice.enable_extension_features_if_present(presentIdFeatures)
+            && physicalDevice.enable_extension_features_if_present(presentWaitFeatures);
+
+        // optional, KTX2 textures in BC, ETC2 or ASTC formats. Whatever the device has is enabled,
+        // upload_texture rejects formats it then can not sample
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+        VkPhysicalDeviceFeatures compressionFeatures{};
+        compressionFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        compressionFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+        compressionFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+        physicalDevice.enable_features_if_present(compressionFeatures);
+
         vkb::DeviceBuilder deviceBuilder{ physicalDevice };
         vkbDevice = deviceBuilder.build().value();
 
         _chosenGPU = physicalDevice.physical_device;
         _device = vkbDevice.device;
+
+        vkGetPhysicalDeviceProperties(_chosenGPU, &_gpuProperties);
+        _gpuTimestamps = _gpuProperties.limits.timestampComputeAndGraphics;
+
+        _framePacer.init(_device, _presentWaitSupported);
+        const char* lowLatency = std::getenv("CGCV_LOW_LATENCY");
+        _lowLatency = lowLatency && std::string(lowLatency) == "1";
     }
     // Get the graphics queue
     {
@@ -315,15 +978,35 @@ void VkEngine::init_vulkan()
             .get_queue_index(vkb::QueueType::graphics)
             .value();
     }
+    // Get a compute queue from a family without graphics, if there is one
+    {
+        auto computeQueue = vkbDevice.get_queue(vkb::QueueType::compute);
+        auto computeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute);
+        if (computeQueue && computeQueueFamily && computeQueueFamily.value() != _graphicsQueueFamily) {
+            _computeQueue = computeQueue.value();
+            _computeQueueFamily = computeQueueFamily.value();
+            _asyncComputeSupported = true;
+        } else {
+            _computeQueue = _graphicsQueue;
+            _computeQueueFamily = _graphicsQueueFamily;
+            _asyncComputeSupported = false;
+        }
+    }
     // initialize the memory allocator
     {
         VmaAllocatorCreateInfo allocatorInfo = {};
         allocatorInfo.physicalDevice = _chosenGPU;
         allocatorInfo.device = _device;
         allocatorInfo.instance = _instance;
+        allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_3;
         allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+        if (_memoryBudgetSupported) {
+            allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+        }
         vmaCreateAllocator(&allocatorInfo, &_allocator);
 
+        _memoryTracker.init(_allocator, _memoryBudgetSupported);
+
         _mainDeletionQueue.push_function([this]() {
             vmaDestroyAllocator(_allocator);
         });
@@ -350,6 +1033,7 @@ void VkEngine::init_swapchain()
 	drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	drawImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
 	drawImageUsages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	drawImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	VkImageCreateInfo rimg_info = vkinit::image_create_info(_drawImage.imageFormat, drawImageUsages, drawImageExtent);
 
@@ -360,18 +1044,96 @@ void VkEngine::init_swapchain()
 
 	//allocate and create the image
 	vmaCreateImage(_allocator, &rimg_info, &rimg_allocinfo, &_drawImage.image, &_drawImage.allocation, nullptr);
+	_memoryTracker.track(_drawImage.allocation, MemoryCategory::Image);
 
 	//build a image-view for the draw image to use for rendering
 	VkImageViewCreateInfo rview_info = vkinit::imageview_create_info(_drawImage.imageFormat, _drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
 
 	check_vk_result(vkCreateImageView(_device, &rview_info, nullptr, &_drawImage.imageView));
 
+	// float depth for reversed-Z, the precision of the float exponent lands where perspective needs it
+	_depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
+	_depthImage.imageExtent = drawImageExtent;
+
+	// sampled by the depth pyramid build
+	VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthImage.imageFormat,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, drawImageExtent);
+
+	vmaCreateImage(_allocator, &dimg_info, &rimg_allocinfo, &_depthImage.image, &_depthImage.allocation, nullptr);
+	_memoryTracker.track(_depthImage.allocation, MemoryCategory::Image);
+
+	VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(_depthImage.imageFormat, _depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+	check_vk_result(vkCreateImageView(_device, &dview_info, nullptr, &_depthImage.imageView));
+
 	//add to deletion queues
 	_mainDeletionQueue.push_function([this]() {
 		vkDestroyImageView(_device, _drawImage.imageView, nullptr);
+		_memoryTracker.untrack(_drawImage.allocation);
 		vmaDestroyImage(_allocator, _drawImage.image, _drawImage.allocation);
+
+		vkDestroyImageView(_device, _depthImage.imageView, nullptr);
+		_memoryTracker.untrack(_depthImage.allocation);
+		vmaDestroyImage(_allocator, _depthImage.image, _depthImage.allocation);
 	});
 
+	init_background_images();
+}
+
+void VkEngine::init_background_images()
+{
+	// written on the compute queue and copied on the graphics queue. Concurrent sharing
+	// saves the queue family ownership transfers
+	uint32_t queueFamilies[] = { _graphicsQueueFamily, _computeQueueFamily };
+
+	VkImageCreateInfo img_info = vkinit::image_create_info(_drawImage.imageFormat,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, _drawImage.imageExtent);
+	if (_asyncComputeSupported) {
+		img_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		img_info.queueFamilyIndexCount = 2;
+		img_info.pQueueFamilyIndices = queueFamilies;
+	}
+
+	VmaAllocationCreateInfo img_allocinfo = {};
+	img_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	img_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	for (int i = 0; i < FRAME_OVERLAP; i++) {
+		AllocatedImage& image = _frames[i]._backgroundImage;
+		image.imageFormat = _drawImage.imageFormat;
+		image.imageExtent = _drawImage.imageExtent;
+
+		check_vk_result(vmaCreateImage(_allocator, &img_info, &img_allocinfo, &image.image, &image.allocation, nullptr));
+		_memoryTracker.track(image.allocation, MemoryCategory::Image);
+
+		VkImageViewCreateInfo view_info = vkinit::imageview_create_info(image.imageFormat, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		check_vk_result(vkCreateImageView(_device, &view_info, nullptr, &image.imageView));
+	}
+
+	// only used on the graphics queue
+	VkImageCreateInfo cache_info = vkinit::image_create_info(_drawImage.imageFormat,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, _drawImage.imageExtent);
+
+	_backgroundCache.imageFormat = _drawImage.imageFormat;
+	_backgroundCache.imageExtent = _drawImage.imageExtent;
+	check_vk_result(vmaCreateImage(_allocator, &cache_info, &img_allocinfo, &_backgroundCache.image, &_backgroundCache.allocation, nullptr));
+	_memoryTracker.track(_backgroundCache.allocation, MemoryCategory::Image);
+
+	VkImageViewCreateInfo cache_view_info = vkinit::imageview_create_info(_backgroundCache.imageFormat, _backgroundCache.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	check_vk_result(vkCreateImageView(_device, &cache_view_info, nullptr, &_backgroundCache.imageView));
+
+	_mainDeletionQueue.push_function([this]() {
+		vkDestroyImageView(_device, _backgroundCache.imageView, nullptr);
+		_memoryTracker.untrack(_backgroundCache.allocation);
+		vmaDestroyImage(_allocator, _backgroundCache.image, _backgroundCache.allocation);
+
+		for (int i = 0; i < FRAME_OVERLAP; i++) {
+			AllocatedImage& image = _frames[i]._backgroundImage;
+			vkDestroyImageView(_device, image.imageView, nullptr);
+			_memoryTracker.untrack(image.allocation);
+			vmaDestroyImage(_allocator, image.image, image.allocation);
+		}
+	});
 }
 
 void VkEngine::create_swapchain(uint32_t width, uint32_t height)
@@ -380,18 +1142,53 @@ void VkEngine::create_swapchain(uint32_t width, uint32_t height)
 
 	_swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
 
-	vkb::Swapchain vkbSwapchain = swapchainBuilder
+	// storage use of swapchain images depends on the surface and the format
+	VkSurfaceCapabilitiesKHR surfaceCapabilities;
+	check_vk_result(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_chosenGPU, _surface, &surfaceCapabilities));
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(_chosenGPU, _swapchainImageFormat, &formatProperties);
+	_swapchainStorage = (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT)
+		&& (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+
+	// without vsync frames are not held back to the refresh rate, e.g. to measure them
+	const char* vsync = std::getenv("CGCV_VSYNC");
+	if (vsync && std::string(vsync) == "0") {
+		swapchainBuilder
+			.set_desired_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR)
+			.add_fallback_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
+			.add_fallback_present_mode(VK_PRESENT_MODE_FIFO_KHR);
+	} else {
+		swapchainBuilder.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR);
+	}
+
+	swapchainBuilder
 		.set_desired_format(VkSurfaceFormatKHR {
             .format = _swapchainImageFormat, 
             .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR 
         })
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-		.set_desired_extent(width, height)
-		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
-		.build()
-		.value();
+		.set_desired_extent(width, height);
+	auto build = [&](bool storage) {
+		return swapchainBuilder
+			.set_image_usage_flags(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+				| (storage ? VK_IMAGE_USAGE_STORAGE_BIT : 0))
+			.build()
+			.value();
+	};
+	vkb::Swapchain vkbSwapchain = build(_swapchainStorage);
+
+	// the surface may not offer the desired format, and the one it falls back to may not support storage
+	if (_swapchainStorage && vkbSwapchain.image_format != _swapchainImageFormat) {
+		vkGetPhysicalDeviceFormatProperties(_chosenGPU, vkbSwapchain.image_format, &formatProperties);
+		if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+			vkb::destroy_swapchain(vkbSwapchain);
+			_swapchainStorage = false;
+			vkbSwapchain = build(false);
+		}
+	}
 
+	_swapchainImageFormat = vkbSwapchain.image_format;
 	_swapchainExtent = vkbSwapchain.extent;
+	_swapchainPresentMode = vkbSwapchain.present_mode;
 	_swapchain = vkbSwapchain.swapchain;
 	_swapchainImages = vkbSwapchain.get_images().value();
 	_swapchainImageViews = vkbSwapchain.get_image_views().value();
@@ -414,6 +1211,13 @@ void VkEngine::init_commands()
         check_vk_result(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._mainCommandBuffer));
 	}
 
+	VkCommandPoolCreateInfo computePoolInfo = vkinit::command_pool_create_info(_computeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	for (int i = 0; i < FRAME_OVERLAP; i++) {
+		check_vk_result(vkCreateCommandPool(_device, &computePoolInfo, nullptr, &_frames[i]._computeCommandPool));
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._computeCommandPool, 1);
+		check_vk_result(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._computeCommandBuffer));
+	}
+
     // immediate command buffer
     check_vk_result(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_immCommandPool));
 	VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_immCommandPool, 1);
@@ -437,19 +1241,135 @@ void VkEngine::init_sync_structures()
 
     check_vk_result(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_immFence));
 	_mainDeletionQueue.push_function([this]() { vkDestroyFence(_device, _immFence, nullptr); });
+
+	VkSemaphoreTypeCreateInfo timelineInfo = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+	VkSemaphoreCreateInfo timelineCreateInfo = vkinit::semaphore_create_info();
+	timelineCreateInfo.pNext = &timelineInfo;
+	check_vk_result(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr, &_computeTimeline));
+	_mainDeletionQueue.push_function([this]() { vkDestroySemaphore(_device, _computeTimeline, nullptr); });
+
+	VkQueryPoolCreateInfo queryPoolInfo = {.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 4;
+	for (int i = 0; i < FRAME_OVERLAP; i++) {
+		_frames[i]._backgroundTimelineValue = 0;
+		check_vk_result(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_frames[i]._timestampPool));
+		vkResetQueryPool(_device, _frames[i]._timestampPool, 0, 4);
+	}
+}
+
+void VkEngine::init_transient_buffers()
+{
+    // slices may be bound as uniform or storage buffers with a dynamic offset
+    VkDeviceSize alignment = std::max(
+        _gpuProperties.limits.minUniformBufferOffsetAlignment,
+        _gpuProperties.limits.minStorageBufferOffsetAlignment);
+
+    for (int i = 0; i < FRAME_OVERLAP; i++) {
+        _frames[i]._transientBuffer.init(_device, _allocator, TRANSIENT_BUFFER_SIZE, alignment);
+        _memoryTracker.track(_frames[i]._transientBuffer.buffer.allocation, MemoryCategory::Transient);
+    }
+
+    _mainDeletionQueue.push_function([this]() {
+        for (int i = 0; i < FRAME_OVERLAP; i++) {
+            _memoryTracker.untrack(_frames[i]._transientBuffer.buffer.allocation);
+            _frames[i]._transientBuffer.destroy(_allocator);
+        }
+    });
+}
+
+void VkEngine::init_capture()
+{
+    // large enough for a frame of either source
+    VkDeviceSize drawImageSize = (VkDeviceSize)_drawImage.imageExtent.width * _drawImage.imageExtent.height * 8;
+    VkDeviceSize swapchainSize = (VkDeviceSize)_swapchainExtent.width * _swapchainExtent.height * 4;
+    _capture.init(_allocator, std::max(drawImageSize, swapchainSize), CAPTURE_SLOT_COUNT, &_memoryTracker);
+
+    // capture from the first frame, e.g. for regression runs
+    if (const char* directory = std::getenv("CGCV_CAPTURE_DIR")) {
+        std::string format = std::getenv("CGCV_CAPTURE_FORMAT") ? std::getenv("CGCV_CAPTURE_FORMAT") : "ppm";
+        if (format == "raw") {
+            _captureFormat = CaptureFormat::Raw;
+        } else if (format == "y4m") {
+            _captureFormat = CaptureFormat::Y4M;
+        }
+        _capture.start(directory, _captureFormat, _targetFps);
+    }
+
+    _mainDeletionQueue.push_function([this]() {
+        // the device is idle, write out what is still pending
+        _capture.collect(UINT64_MAX);
+        _capture.destroy(_allocator, &_memoryTracker);
+    });
+}
+
+void VkEngine::record_capture_copy(VkCommandBuffer cmd, VkImage image, VkExtent2D extent)
+{
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { extent.width, extent.height, 1 };
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _renderGraph.get_buffer(_rgCaptureBuffer), 1, &region);
+
+    // the graph does not track host access, the writer thread reads the buffer after the fence
+    VkMemoryBarrier2 barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+    VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    depInfo.memoryBarrierCount = 1;
+    depInfo.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+void VkEngine::stop_capture()
+{
+    vkDeviceWaitIdle(_device);
+    _capture.collect(UINT64_MAX);
+    _capture.stop();
+}
+
+void VkEngine::draw_capture_panel()
+{
+	if (ImGui::Begin("capture")) {
+		if (!_capture.active()) {
+			ImGui::Combo("format", (int*)&_captureFormat, "ppm\0raw rgb\0y4m\0");
+			ImGui::Checkbox("capture swapchain (with UI)", &_captureSwapchain);
+			if (ImGui::Button("Start capture")) {
+				// the writer stops the capture when the frame size changes, finish that one first
+				stop_capture();
+				_capture.start(CAPTURE_DIR, _captureFormat, _targetFps);
+			}
+		} else {
+			ImGui::Text("written: %u", _capture.written_frames());
+			ImGui::Text("dropped: %u", _capture.dropped_frames());
+			if (ImGui::Button("Stop capture")) {
+				stop_capture();
+			}
+		}
+	}
+	ImGui::End();
 }
 
 void VkEngine::init_descriptors()
 {
 	std::vector<DescriptorAllocator::PoolSizeRatio> sizes = 
-        {{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }};
-	globalDescriptorAllocator.init_pool(_device, 10, sizes);
+        {{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }, { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }};
+	// the tonemap pass takes a set per swapchain image
+	globalDescriptorAllocator.init_pool(_device, 20, sizes);
+
+	_samplerCache.init(_device, _gpuProperties.limits.maxSamplerAnisotropy);
+	_layoutCache.init(_device);
 
 	//make the descriptor set layout for our compute draw
 	{
 		DescriptorLayoutBuilder builder;
 		builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-		_drawImageDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+		_drawImageDescriptorLayout = builder.build(_layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
 	}
 
     //allocate a descriptor set for our draw image
@@ -470,182 +1390,668 @@ void VkEngine::init_descriptors()
 
 	vkUpdateDescriptorSets(_device, 1, &drawImageWrite, 0, nullptr);
 
+	for (int i = 0; i < FRAME_OVERLAP; i++) {
+		_frames[i]._backgroundDescriptors = globalDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
+
+		VkDescriptorImageInfo backgroundInfo{};
+		backgroundInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		backgroundInfo.imageView = _frames[i]._backgroundImage.imageView;
+
+		VkWriteDescriptorSet backgroundWrite = drawImageWrite;
+		backgroundWrite.dstSet = _frames[i]._backgroundDescriptors;
+		backgroundWrite.pImageInfo = &backgroundInfo;
+
+		vkUpdateDescriptorSets(_device, 1, &backgroundWrite, 0, nullptr);
+	}
+
+	_backgroundCacheDescriptors = globalDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
+	{
+		VkDescriptorImageInfo cacheInfo{};
+		cacheInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		cacheInfo.imageView = _backgroundCache.imageView;
+
+		VkWriteDescriptorSet cacheWrite = drawImageWrite;
+		cacheWrite.dstSet = _backgroundCacheDescriptors;
+		cacheWrite.pImageInfo = &cacheInfo;
+
+		vkUpdateDescriptorSets(_device, 1, &cacheWrite, 0, nullptr);
+	}
+
     _mainDeletionQueue.push_function([this]() {
 		globalDescriptorAllocator.destroy_pool(_device);
-		vkDestroyDescriptorSetLayout(_device, _drawImageDescriptorLayout, nullptr);
+		_samplerCache.destroy();
+		// every pipeline is gone by now, they are created after the descriptors
+		_layoutCache.destroy();
+	});
+}
+
+void VkEngine::init_materials()
+{
+	_materials.init(_device, _allocator, MAX_MATERIALS, &_memoryTracker);
+
+	// what objects without a material of their own use, and what create() falls back to
+	GPUMaterial defaultMaterial = {};
+	defaultMaterial.baseColor = glm::vec4(1.f);
+	defaultMaterial.textureStrength = 1.f;
+	_materials.create(MaterialTemplate::Opaque, defaultMaterial);
+
+	_mainDeletionQueue.push_function([this]() {
+		_materials.destroy(_allocator, &_memoryTracker);
 	});
 }
 
 void VkEngine::init_pipelines()
 {
+#ifdef CGCV_SHADER_SOURCE_DIR
+	_shaderVariants.init(_device, CGCV_SHADER_SOURCE_DIR, SHADER_CACHE_DIR);
+#else
+	_shaderVariants.init(_device, {}, SHADER_CACHE_DIR);
+#endif
+	_mainDeletionQueue.push_function([this]() { _shaderVariants.destroy(); });
+	_pipelineCache.init(_device);
+	_mainDeletionQueue.push_function([this]() { _pipelineCache.destroy(); });
+
 	init_background_pipelines();
 
-    init_triangle_pipeline();
     init_mesh_pipeline();
+    init_shader_objects();
+    init_culling();
+    init_particles();
+    init_tonemap_pipeline();
 }
 
 void VkEngine::init_background_pipelines()
 {
     // Create pipeline layout
     {
-        VkPipelineLayoutCreateInfo computeLayout{};
-        computeLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        computeLayout.pNext = nullptr;
-        computeLayout.pSetLayouts = &_drawImageDescriptorLayout;
-        computeLayout.setLayoutCount = 1;
-
         VkPushConstantRange pushConstant{};
         pushConstant.offset = 0;
         pushConstant.size = sizeof(ComputePushConstants) ;
         pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
-        computeLayout.pPushConstantRanges = &pushConstant;
-        computeLayout.pushConstantRangeCount = 1;
-
-        check_vk_result(vkCreatePipelineLayout(_device, &computeLayout, nullptr, &_gradientPipelineLayout));
+        _gradientPipelineLayout = _layoutCache.get_pipeline_layout({ &_drawImageDescriptorLayout, 1 }, { &pushConstant, 1 });
     }
-    // Create compute pipeline
+    // Create compute pipelines, specialized to the workgroup size tuned for this device
     {
-        VkShaderModule gradientShader;
-        if (!vkutil::load_shader_module("./gradient_color.comp.spv", _device, &gradientShader)) {
-            std::cout << "Error when building the compute shader" << std::endl;
-        }
-
-        VkShaderModule skyShader;
-        if (!vkutil::load_shader_module("./sky.comp.spv", _device, &skyShader)) {
-            std::cout << "Error when building the compute shader" << std::endl;
-        }
-
-        VkPipelineShaderStageCreateInfo stageinfo{};
-        stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        stageinfo.pNext = nullptr;
-        stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-        stageinfo.module = gradientShader;
-        stageinfo.pName = "main";
-
-        VkComputePipelineCreateInfo computePipelineCreateInfo{};
-        computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        computePipelineCreateInfo.pNext = nullptr;
-        computePipelineCreateInfo.layout = _gradientPipelineLayout;
-        computePipelineCreateInfo.stage = stageinfo;
+        _workgroupTuner.init(_device, _chosenGPU);
+        _workgroupTuner.load(WORKGROUP_SIZES_FILE);
 
         ComputeEffect gradient;
         gradient.layout = _gradientPipelineLayout;
         gradient.name = "gradient";
+        gradient.shaderFile = "gradient_color.comp";
         gradient.data = {};
         gradient.data.data1 = glm::vec4(1, 0, 0, 1);
         gradient.data.data2 = glm::vec4(0, 0, 1, 1);
-        
-        check_vk_result(vkCreateComputePipelines(_device,VK_NULL_HANDLE,1,&computePipelineCreateInfo, nullptr, &gradient.pipeline));
-
-        computePipelineCreateInfo.stage.module = skyShader;
 
         ComputeEffect sky;
         sky.layout = _gradientPipelineLayout;
         sky.name = "sky";
+        sky.shaderFile = "sky.comp";
         sky.data = {};
         sky.data.data1 = glm::vec4(0.1, 0.2, 0.4 ,0.97);
-
-        check_vk_result(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
+        // data4.w drives the star crawl when animated
+        sky.animated = false;
 
         backgroundEffects.push_back(gradient);
         backgroundEffects.push_back(sky);
 
-       	vkDestroyShaderModule(_device, gradientShader, nullptr);
-        vkDestroyShaderModule(_device, skyShader, nullptr);
-    	_mainDeletionQueue.push_function([=, this]() {
-		    vkDestroyPipelineLayout(_device, _gradientPipelineLayout, nullptr);
-		    vkDestroyPipeline(_device, sky.pipeline, nullptr);
-		    vkDestroyPipeline(_device, gradient.pipeline, nullptr);
+        for (ComputeEffect& effect : backgroundEffects) {
+            std::string path = std::string("./") + effect.shaderFile + ".spv";
+            if (!vkutil::load_shader_module(path.c_str(), _device, &effect.shader)) {
+                std::cout << "Error when building the compute shader" << std::endl;
+            }
+            effect.workgroupSize = _workgroupTuner.get(effect.name);
+            effect.pipeline = vkutil::build_compute_pipeline(_device, effect.layout, effect.shader,
+                effect.workgroupSize.x, effect.workgroupSize.y);
+        }
+
+    	_mainDeletionQueue.push_function([this]() {
+		    for (ComputeEffect& effect : backgroundEffects) {
+		        vkDestroyPipeline(_device, effect.pipeline, nullptr);
+		        vkDestroyShaderModule(_device, effect.shader, nullptr);
+		    }
+		    _workgroupTuner.destroy();
 		});
     }
 }
 
-void VkEngine::init_triangle_pipeline()
+void VkEngine::tune_background_effects()
+{
+	if (!_workgroupTuner.supported()) {
+		std::cout << "Workgroup tuning needs timestamp queries" << std::endl;
+		return;
+	}
+
+	// the benchmark renders into the background cache, which no frame in flight may be using
+	vkDeviceWaitIdle(_device);
+
+	VkExtent3D extent = _backgroundCache.imageExtent;
+	for (ComputeEffect& effect : backgroundEffects) {
+		auto build = [&](WorkgroupSize size) {
+			return vkutil::build_compute_pipeline(_device, effect.layout, effect.shader, size.x, size.y);
+		};
+		auto record = [&](VkCommandBuffer cmd, VkPipeline pipeline, WorkgroupSize size) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.layout, 0, 1, &_backgroundCacheDescriptors, 0, nullptr);
+			vkCmdPushConstants(cmd, effect.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.data);
+			vkCmdDispatch(cmd, (extent.width + size.x - 1) / size.x, (extent.height + size.y - 1) / size.y, 1);
+		};
+		auto submit = [&](std::function<void(VkCommandBuffer cmd)>&& function) { immediate_submit(std::move(function)); };
+
+		WorkgroupSize best = _workgroupTuner.tune(effect.name, build, record, submit);
+		std::cout << "Workgroup size for " << effect.name << ": " << best.x << "x" << best.y << std::endl;
+
+		VkPipeline pipeline = build(best);
+		if (pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(_device, effect.pipeline, nullptr);
+			effect.pipeline = pipeline;
+			std::lock_guard<std::mutex> lock(_workgroupSizeMutex);
+			effect.workgroupSize = best;
+		}
+	}
+
+	if (!_workgroupTuner.save(WORKGROUP_SIZES_FILE)) {
+		std::cout << "Error when writing " << WORKGROUP_SIZES_FILE << std::endl;
+	}
+	_backgroundCacheDirty = true;
+}
+
+void VkEngine::init_shader_reload()
+{
+#ifdef CGCV_SHADER_SOURCE_DIR
+	// retired pipelines go to the deletion queue of the frame that swaps them in. That queue is
+	// flushed after the frame's fence, and every older frame has finished by then as well
+	auto retire_pipeline = [this](VkPipeline pipeline) {
+		get_current_frame()._frameDeletionQueue.push_function([this, pipeline]() {
+			vkDestroyPipeline(_device, pipeline, nullptr);
+		});
+	};
+
+	for (size_t i = 0; i < backgroundEffects.size(); i++) {
+		_shaderWatcher.add(backgroundEffects[i].shaderFile, [this, i, retire_pipeline](const std::string& spirvPath) -> std::function<void()> {
+			VkShaderModule shader;
+			if (!vkutil::load_shader_module(spirvPath.c_str(), _device, &shader)) {
+				return {};
+			}
+			// the render thread may be tuning the size at the same time
+			WorkgroupSize size;
+			{
+				std::lock_guard<std::mutex> lock(_workgroupSizeMutex);
+				size = backgroundEffects[i].workgroupSize;
+			}
+			// never changes after init_background_pipelines
+			VkPipelineLayout layout = backgroundEffects[i].layout;
+			VkPipeline pipeline = vkutil::build_compute_pipeline(_device, layout, shader, size.x, size.y);
+			if (pipeline == VK_NULL_HANDLE) {
+				vkDestroyShaderModule(_device, shader, nullptr);
+				return {};
+			}
+
+			return [this, i, shader, pipeline, size, retire_pipeline]() {
+				ComputeEffect& effect = backgroundEffects[i];
+				VkShaderModule oldShader = effect.shader;
+				retire_pipeline(effect.pipeline);
+				get_current_frame()._frameDeletionQueue.push_function([this, oldShader]() {
+					vkDestroyShaderModule(_device, oldShader, nullptr);
+				});
+
+				effect.shader = shader;
+				effect.pipeline = pipeline;
+				// tuned while this was being rebuilt
+				if (effect.workgroupSize.x != size.x || effect.workgroupSize.y != size.y) {
+					VkPipeline tuned = vkutil::build_compute_pipeline(_device, effect.layout, shader, effect.workgroupSize.x, effect.workgroupSize.y);
+					if (tuned != VK_NULL_HANDLE) {
+						retire_pipeline(effect.pipeline);
+						effect.pipeline = tuned;
+					} else {
+						// keeps the pipeline built above, dispatched with the size it was built with
+						std::lock_guard<std::mutex> lock(_workgroupSizeMutex);
+						effect.workgroupSize = size;
+					}
+				}
+				_backgroundCacheDirty = true;
+			};
+		});
+	}
+
+	// swaps the rebuilt pipeline into `target`
+	auto rebuild_with = [this, retire_pipeline](VkPipeline* target, std::function<VkPipeline()> build) {
+		return [target, build, retire_pipeline](const std::string&) -> std::function<void()> {
+			VkPipeline pipeline = build();
+			if (pipeline == VK_NULL_HANDLE) {
+				return {};
+			}
+			return [target, pipeline, retire_pipeline]() {
+				retire_pipeline(*target);
+				*target = pipeline;
+			};
+		};
+	};
+	// cached pipelines stay owned by the pipeline cache, only the handle is swapped. The new
+	// shader modules make a new key, the old pipeline stays cached until shutdown
+	auto rebuild_cached = [](VkPipeline* target, std::function<VkPipeline()> build) {
+		return [target, build](const std::string&) -> std::function<void()> {
+			VkPipeline pipeline = build();
+			if (pipeline == VK_NULL_HANDLE) {
+				return {};
+			}
+			return [target, pipeline]() { *target = pipeline; };
+		};
+	};
+	// the variant cache notices the newer source and recompiles the variants these use
+	std::vector<ShaderWatcher::RebuildFunction> coloredRebuilds = {
+		rebuild_cached(&_trianglePipeline, [this]() { return colored_pipeline(_trianglePipelineLayout, 0, DepthMode::Write); }),
+		rebuild_cached(&_meshPipeline, [this]() {
+			return colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL, DepthMode::Write);
+		}),
+		rebuild_cached(&_meshEqualPipeline, [this]() {
+			return colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL, DepthMode::Equal);
+		}),
+		rebuild_cached(&_multiviewPipeline, [this]() {
+			return colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL | SHADER_FEATURE_MULTIVIEW, DepthMode::None,
+				(1u << MULTIVIEW_VIEW_COUNT) - 1);
+		}),
+		rebuild_cached(&_culledPipeline, [this]() {
+			return colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL | SHADER_FEATURE_OBJECT_BUFFER, DepthMode::Write);
+		}),
+		rebuild_cached(&_transparentPipeline, [this]() { return transparent_pipeline(); }),
+	};
+	for (const ShaderWatcher::RebuildFunction& rebuild : coloredRebuilds) {
+		_shaderWatcher.add("colored_triangle.vert", ShaderWatcher::RebuildFunction(rebuild));
+		_shaderWatcher.add("colored_triangle.frag", ShaderWatcher::RebuildFunction(rebuild));
+	}
+	// the shader objects are created from the same variants
+	if (_shaderObjectsSupported) {
+		auto rebuild_shader_objects = [this](const std::string&) -> std::function<void()> {
+			std::vector<VkShaderEXT> shaders = create_shader_objects();
+			if (shaders.empty()) {
+				return {};
+			}
+			return [this, shaders]() {
+				std::vector<VkShaderEXT> old = { _triangleVertexObject, _meshVertexObject, _triangleFragmentObject, _meshFragmentObject };
+				get_current_frame()._frameDeletionQueue.push_function([this, old]() { _shaderObjects.destroy(old); });
+				_triangleVertexObject = shaders[0];
+				_meshVertexObject = shaders[1];
+				_triangleFragmentObject = shaders[2];
+				_meshFragmentObject = shaders[3];
+			};
+		};
+		_shaderWatcher.add("colored_triangle.vert", ShaderWatcher::RebuildFunction(rebuild_shader_objects));
+		_shaderWatcher.add("colored_triangle.frag", ShaderWatcher::RebuildFunction(rebuild_shader_objects));
+	}
+	_shaderWatcher.add("depth_prepass.vert", rebuild_cached(&_depthPrepassPipeline, [this]() { return depth_prepass_pipeline(); }));
+	_shaderWatcher.add("particle.vert", rebuild_cached(&_particlePipeline, [this]() { return particle_pipeline(); }));
+	_shaderWatcher.add("particle.frag", rebuild_cached(&_particlePipeline, [this]() { return particle_pipeline(); }));
+	_shaderWatcher.add("tonemap.comp", rebuild_with(&_tonemapPipeline, [this]() { return build_tonemap_pipeline(); }));
+
+	// compiled next to the executable, where the build puts the .spv files
+	_shaderWatcher.start(CGCV_SHADER_SOURCE_DIR, std::filesystem::current_path());
+
+	_mainDeletionQueue.push_function([this]() {
+		_shaderWatcher.stop();
+		// hands rebuilt pipelines that were never swapped in to the frame deletion queues
+		_shaderWatcher.apply();
+	});
+#endif
+}
+
+void VkEngine::init_mesh_pipeline()
+{
+    VkPushConstantRange bufferRange{};
+	bufferRange.offset = 0;
+	bufferRange.size = sizeof(GPUDrawPushConstants);
+	bufferRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	{
+		DescriptorLayoutBuilder builder;
+		builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		_meshDescriptorLayout = builder.build(_layoutCache, VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+
+	_meshPipelineLayout = _layoutCache.get_pipeline_layout({ &_meshDescriptorLayout, 1 }, { &bufferRange, 1 });
+
+	// the triangle uses none of the mesh layout, sharing it keeps the texture set and push
+	// constants bound when the geometry pass switches between the two
+	_trianglePipelineLayout = _meshPipelineLayout;
+
+	// all owned by the pipeline cache
+	_trianglePipeline = colored_pipeline(_trianglePipelineLayout, 0, DepthMode::Write);
+	_meshPipeline = colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL, DepthMode::Write);
+	_meshEqualPipeline = colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL, DepthMode::Equal);
+	_depthPrepassPipeline = depth_prepass_pipeline();
+	_transparentPipeline = transparent_pipeline();
+	// created in the background the first time the thumbnails are shown
+	_multiviewPipeline = VK_NULL_HANDLE;
+}
+
+void VkEngine::init_shader_objects()
+{
+	if (!_shaderObjectsSupported || !_shaderObjects.init(_device)) {
+		_shaderObjectsSupported = false;
+		return;
+	}
+
+	std::vector<VkShaderEXT> shaders = create_shader_objects();
+	if (shaders.empty()) {
+		std::cout << "Error when creating the shader objects, drawing with pipelines" << std::endl;
+		_shaderObjectsSupported = false;
+		return;
+	}
+	_triangleVertexObject = shaders[0];
+	_meshVertexObject = shaders[1];
+	_triangleFragmentObject = shaders[2];
+	_meshFragmentObject = shaders[3];
+
+	const char* useShaderObjects = std::getenv("CGCV_SHADER_OBJECTS");
+	_useShaderObjects = useShaderObjects && std::string(useShaderObjects) == "1";
+
+	// the ones in use at shutdown, hot reload may have replaced these
+	_mainDeletionQueue.push_function([this]() {
+		_shaderObjects.destroy(std::vector<VkShaderEXT>{ _triangleVertexObject, _meshVertexObject, _triangleFragmentObject, _meshFragmentObject });
+	});
+}
+
+std::vector<VkShaderEXT> VkEngine::create_shader_objects()
+{
+	// the same interface as the mesh pipelines, so the sets and push constants carry over
+	VkPushConstantRange bufferRange{};
+	bufferRange.size = sizeof(GPUDrawPushConstants);
+	bufferRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	std::vector<uint32_t> triangleVertexCode = _shaderVariants.get_code("colored_triangle.vert");
+	std::vector<uint32_t> meshVertexCode = _shaderVariants.get_code("colored_triangle.vert", SHADER_FEATURE_VERTEX_BUFFER);
+	std::vector<uint32_t> triangleFragmentCode = _shaderVariants.get_code("colored_triangle.frag");
+	std::vector<uint32_t> meshFragmentCode = _shaderVariants.get_code("colored_triangle.frag", SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL);
+	ShaderObjectStage stages[4] = {
+		{ VK_SHADER_STAGE_VERTEX_BIT, triangleVertexCode },
+		{ VK_SHADER_STAGE_VERTEX_BIT, meshVertexCode },
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, triangleFragmentCode },
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, meshFragmentCode },
+	};
+	for (const ShaderObjectStage& stage : stages) {
+		if (stage.code.empty()) {
+			std::cout << "Error when loading the shader object code" << std::endl;
+			return {};
+		}
+	}
+
+	// unlinked, so either vertex shader pairs with either fragment shader
+	return _shaderObjects.create(stages, false, { &_meshDescriptorLayout, 1 }, { &bufferRange, 1 });
+}
+
+void VkEngine::init_culling()
+{
+	_culledPipeline = colored_pipeline(_meshPipelineLayout, SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL | SHADER_FEATURE_OBJECT_BUFFER, DepthMode::Write);
+
+	// owned by the variant cache
+	VkShaderModule pyramidShader = _shaderVariants.get("depth_pyramid.comp");
+	VkShaderModule cullShader = _shaderVariants.get("cull.comp");
+	if (pyramidShader == VK_NULL_HANDLE || cullShader == VK_NULL_HANDLE) {
+		std::cout << "Error when building the culling shader modules" << std::endl;
+		abort();
+	}
+	_culler.init(_device, _allocator, _depthImage, MAX_SCENE_OBJECTS, pyramidShader, cullShader, _layoutCache, _samplerCache, &_memoryTracker);
+
+	// nothing counts as visible before the first late phase, and the pyramid is read in the layout it is imported with
+	immediate_submit([&](VkCommandBuffer cmd) {
+		_culler.clear_state(cmd);
+		ImageStateTracker images;
+		images.track(_culler._pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		images.use(_culler._pyramid.image, vkutil::ImageUsage::ComputeSampled);
+		images.flush(cmd);
+	});
+
+	_mainDeletionQueue.push_function([this]() {
+		_culler.destroy(_device, _allocator, &_memoryTracker);
+	});
+}
+
+void VkEngine::init_particles()
+{
+	// owned by the variant cache
+	VkShaderModule resetShader = _shaderVariants.get("particle_reset.comp");
+	VkShaderModule beginShader = _shaderVariants.get("particle_begin.comp");
+	VkShaderModule emitShader = _shaderVariants.get("particle_emit.comp");
+	VkShaderModule simulateShader = _shaderVariants.get("particle_simulate.comp");
+	if (resetShader == VK_NULL_HANDLE || beginShader == VK_NULL_HANDLE || emitShader == VK_NULL_HANDLE || simulateShader == VK_NULL_HANDLE) {
+		std::cout << "Error when building the particle shader modules" << std::endl;
+		abort();
+	}
+	_particles.init(_device, resetShader, beginShader, emitShader, simulateShader, _layoutCache);
+	_particlePipeline = particle_pipeline();
+
+	// disabled particles are recreated by the next enable, so their buffers are the first memory to give back
+	_memoryTracker.pressureCallbacks.push_back([this](bool pressure) {
+		if (!pressure || _particlesEnabled || !_particles.allocated()) {
+			return;
+		}
+		// the frames in flight may still have used them
+		vkDeviceWaitIdle(_device);
+		_particles.release(_allocator, &_memoryTracker);
+		for (RGResource buffer : { _rgParticles, _rgParticleAliveLists, _rgParticleDeadList, _rgParticleCounters, _rgParticleDispatchArgs, _rgParticleDrawArgs }) {
+			_renderGraph.set_buffer(buffer, VK_NULL_HANDLE);
+		}
+		std::cout << "Released the particle buffers, device memory is under pressure" << std::endl;
+	});
+
+	_mainDeletionQueue.push_function([this]() {
+		_particles.destroy(_device, _allocator, &_memoryTracker);
+	});
+}
+
+void VkEngine::allocate_particles()
+{
+	// tens of MB, most runs never enable particles
+	_particles.allocate(_device, _allocator, MAX_PARTICLES, &_memoryTracker);
+
+	_renderGraph.set_buffer(_rgParticles, _particles._particles.buffer);
+	_renderGraph.set_buffer(_rgParticleAliveLists, _particles._aliveLists.buffer);
+	_renderGraph.set_buffer(_rgParticleDeadList, _particles._deadList.buffer);
+	_renderGraph.set_buffer(_rgParticleCounters, _particles._counters.buffer);
+	_renderGraph.set_buffer(_rgParticleDispatchArgs, _particles._dispatchArgs.buffer);
+	_renderGraph.set_buffer(_rgParticleDrawArgs, _particles._drawArgs.buffer);
+
+	// every particle starts on the dead list
+	_particleReset = true;
+}
+
+void VkEngine::init_tonemap_pipeline()
+{
+	DescriptorLayoutBuilder builder;
+	builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+	_tonemapDescriptorLayout = builder.build(_layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	VkPushConstantRange pushConstant = {};
+	pushConstant.size = sizeof(TonemapPushConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	_tonemapPipelineLayout = _layoutCache.get_pipeline_layout({ &_tonemapDescriptorLayout, 1 }, { &pushConstant, 1 });
+
+	_tonemapPipeline = build_tonemap_pipeline();
+	if (_tonemapPipeline == VK_NULL_HANDLE) {
+		abort();
+	}
+
+	_mainDeletionQueue.push_function([this]() {
+		vkDestroyPipeline(_device, _tonemapPipeline, nullptr);
+	});
+}
+
+VkPipeline VkEngine::build_tonemap_pipeline()
+{
+	// owned by the variant cache
+	VkShaderModule tonemapShader = _shaderVariants.get("tonemap.comp");
+	if (tonemapShader == VK_NULL_HANDLE) {
+		std::cout << "Error when building the tonemap shader module" << std::endl;
+		return VK_NULL_HANDLE;
+	}
+	return vkutil::build_compute_pipeline(_device, _tonemapPipelineLayout, tonemapShader, 16, 16);
+}
+
+void VkEngine::init_tonemap_descriptors()
 {
-    VkShaderModule triangleFragShader;
-	if (!vkutil::load_shader_module("./colored_triangle.frag.spv", _device, &triangleFragShader)) {
+	std::vector<VkImageView> targets = _swapchainStorage
+		? _swapchainImageViews
+		: std::vector<VkImageView>{ _renderGraph.get_image(_rgTonemapImage).imageView };
+
+	VkSampler sampler = _samplerCache.get({ VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE });
+	for (VkImageView target : targets) {
+		VkDescriptorSet set = globalDescriptorAllocator.allocate(_device, _tonemapDescriptorLayout);
+
+		VkDescriptorImageInfo hdrInfo = { sampler, _drawImage.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		VkDescriptorImageInfo outputInfo = { VK_NULL_HANDLE, target, VK_IMAGE_LAYOUT_GENERAL };
+
+		VkWriteDescriptorSet writes[2] = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = set;
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &hdrInfo;
+
+		writes[1] = writes[0];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].pImageInfo = &outputInfo;
+
+		vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
+		_tonemapDescriptors.push_back(set);
+	}
+}
+
+bool VkEngine::colored_pipeline_builder(PipelineBuilder& pipelineBuilder, VkPipelineLayout layout, uint32_t features,
+	DepthMode depthMode, uint32_t viewMask)
+{
+	// each stage only gets the bits it uses, so no identical variants are compiled
+	uint32_t fragmentFeatures = features & (SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL);
+	uint32_t vertexFeatures = features & ~(SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL);
+
+	// owned by the variant cache
+	VkShaderModule triangleFragShader = _shaderVariants.get("colored_triangle.frag", fragmentFeatures);
+	if (triangleFragShader == VK_NULL_HANDLE) {
 		std::cout << "Error when building the triangle fragment shader module"  << std::endl;
+		return false;
 	}
 
-	VkShaderModule triangleVertexShader;
-	if (!vkutil::load_shader_module("./colored_triangle.vert.spv", _device, &triangleVertexShader)) {
+	VkShaderModule triangleVertexShader = _shaderVariants.get("colored_triangle.vert", vertexFeatures);
+	if (triangleVertexShader == VK_NULL_HANDLE) {
 		std::cout << "Error when building the triangle vertex shader module" << std::endl;
+		return false;
 	}
-	
-	VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info();
-	check_vk_result(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr, &_trianglePipelineLayout));
 
-    PipelineBuilder pipelineBuilder;
-
-	pipelineBuilder._pipelineLayout = _trianglePipelineLayout;
+	pipelineBuilder.clear();
+	pipelineBuilder._pipelineLayout = layout;
 	pipelineBuilder.set_shaders(triangleVertexShader, triangleFragShader);
 	pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 	pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
 	pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
 	pipelineBuilder.set_multisampling_none();
 	pipelineBuilder.disable_blending();
-	pipelineBuilder.disable_depthtest();
 	pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
-	pipelineBuilder.set_depth_format(VK_FORMAT_UNDEFINED);
-
-	_trianglePipeline = pipelineBuilder.build_pipeline(_device);
+	switch (depthMode) {
+	case DepthMode::None:
+		pipelineBuilder.disable_depthtest();
+		pipelineBuilder.set_depth_format(VK_FORMAT_UNDEFINED);
+		break;
+	case DepthMode::Write:
+		// reversed-Z, nearer is greater
+		pipelineBuilder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+		pipelineBuilder.set_depth_format(_depthImage.imageFormat);
+		break;
+	case DepthMode::Equal:
+		pipelineBuilder.enable_depthtest(false, VK_COMPARE_OP_EQUAL);
+		pipelineBuilder.set_depth_format(_depthImage.imageFormat);
+		break;
+	case DepthMode::Read:
+		pipelineBuilder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+		pipelineBuilder.set_depth_format(_depthImage.imageFormat);
+		break;
+	}
+	pipelineBuilder.set_view_mask(viewMask);
+	return true;
+}
 
-	vkDestroyShaderModule(_device, triangleFragShader, nullptr);
-	vkDestroyShaderModule(_device, triangleVertexShader, nullptr);
+VkPipeline VkEngine::colored_pipeline(VkPipelineLayout layout, uint32_t features, DepthMode depthMode, uint32_t viewMask, bool background)
+{
+	PipelineBuilder pipelineBuilder;
+	if (!colored_pipeline_builder(pipelineBuilder, layout, features, depthMode, viewMask)) {
+		return VK_NULL_HANDLE;
+	}
+	return background ? _pipelineCache.get_async(pipelineBuilder) : _pipelineCache.get(pipelineBuilder);
+}
 
-	_mainDeletionQueue.push_function([&]() {
-		vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
-		vkDestroyPipeline(_device, _trianglePipeline, nullptr);
-	});
+VkPipeline VkEngine::build_colored_pipeline(VkPipelineLayout layout, uint32_t features, DepthMode depthMode, uint32_t viewMask)
+{
+	PipelineBuilder pipelineBuilder;
+	if (!colored_pipeline_builder(pipelineBuilder, layout, features, depthMode, viewMask)) {
+		return VK_NULL_HANDLE;
+	}
+	return pipelineBuilder.build_pipeline(_device);
 }
 
-void VkEngine::init_mesh_pipeline()
+VkPipeline VkEngine::transparent_pipeline()
 {
-    VkShaderModule triangleFragShader;
-	if (!vkutil::load_shader_module("./colored_triangle.frag.spv", _device, &triangleFragShader)) {
-		std::cout << "Error when building the triangle fragment shader module"  << std::endl;
+	PipelineBuilder pipelineBuilder;
+	if (!colored_pipeline_builder(pipelineBuilder, _meshPipelineLayout,
+			SHADER_FEATURE_VERTEX_BUFFER | SHADER_FEATURE_TEXTURE | SHADER_FEATURE_MATERIAL, DepthMode::Read)) {
+		return VK_NULL_HANDLE;
 	}
+	pipelineBuilder.enable_blending_alphablend();
+	return _pipelineCache.get(pipelineBuilder);
+}
 
-	VkShaderModule triangleVertexShader;
-	if (!vkutil::load_shader_module("./colored_triangle_mesh.vert.spv", _device, &triangleVertexShader)) {
-		std::cout << "Error when building the triangle vertex shader module" << std::endl;
+VkPipeline VkEngine::particle_pipeline()
+{
+	VkShaderModule vertexShader = _shaderVariants.get("particle.vert");
+	VkShaderModule fragmentShader = _shaderVariants.get("particle.frag");
+	if (vertexShader == VK_NULL_HANDLE || fragmentShader == VK_NULL_HANDLE) {
+		std::cout << "Error when building the particle shader modules" << std::endl;
+		return VK_NULL_HANDLE;
 	}
-	
-    VkPushConstantRange bufferRange{};
-	bufferRange.offset = 0;
-	bufferRange.size = sizeof(GPUDrawPushConstants);
-	bufferRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-	VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info();
-	pipeline_layout_info.pPushConstantRanges = &bufferRange;
-	pipeline_layout_info.pushConstantRangeCount = 1;
+	PipelineBuilder pipelineBuilder;
 
-	check_vk_result(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr, &_meshPipelineLayout));
+	pipelineBuilder._pipelineLayout = _particles._drawLayout;
+	pipelineBuilder.set_shaders(vertexShader, fragmentShader);
+	pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.set_multisampling_none();
+	// overlapping particles add up, so they need no sorting
+	pipelineBuilder.enable_blending_additive();
+	pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
+	// reversed-Z, hidden behind the scene but not hiding each other
+	pipelineBuilder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	pipelineBuilder.set_depth_format(_depthImage.imageFormat);
 
-    PipelineBuilder pipelineBuilder;
+	return _pipelineCache.get(pipelineBuilder);
+}
+
+VkPipeline VkEngine::depth_prepass_pipeline()
+{
+	VkShaderModule prepassShader = _shaderVariants.get("depth_prepass.vert");
+	if (prepassShader == VK_NULL_HANDLE) {
+		std::cout << "Error when building the depth prepass vertex shader module" << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	PipelineBuilder pipelineBuilder;
 
 	pipelineBuilder._pipelineLayout = _meshPipelineLayout;
-	pipelineBuilder.set_shaders(triangleVertexShader, triangleFragShader);
+	pipelineBuilder.set_vertex_shader(prepassShader);
 	pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 	pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
 	pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
 	pipelineBuilder.set_multisampling_none();
 	pipelineBuilder.disable_blending();
-    pipelineBuilder.disable_depthtest();
-	// pipelineBuilder.enable_depthtest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
-	pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
-	pipelineBuilder.set_depth_format(VK_FORMAT_UNDEFINED);
- 
-	_meshPipeline = pipelineBuilder.build_pipeline(_device);
-
-	vkDestroyShaderModule(_device, triangleFragShader, nullptr);
-	vkDestroyShaderModule(_device, triangleVertexShader, nullptr);
+	pipelineBuilder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	// depth only, no color attachment
+	pipelineBuilder.set_depth_format(_depthImage.imageFormat);
 
-	_mainDeletionQueue.push_function([&]() {
-		vkDestroyPipelineLayout(_device, _meshPipelineLayout, nullptr);
-		vkDestroyPipeline(_device, _meshPipeline, nullptr);
-	});
+	return _pipelineCache.get(pipelineBuilder);
 }
 
 void VkEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function)
@@ -673,6 +2079,253 @@ void VkEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& funct
 	check_vk_result(vkWaitForFences(_device, 1, &_immFence, true, 9999999999));
 }
 
+void VkEngine::init_render_graph()
+{
+	_rgDrawImage = _renderGraph.import_image("draw image", _drawImage, VK_IMAGE_LAYOUT_UNDEFINED);
+
+	AllocatedImage swapchainImage = {};
+	swapchainImage.imageFormat = _swapchainImageFormat;
+	swapchainImage.imageExtent = { _swapchainExtent.width, _swapchainExtent.height, 1 };
+	// the acquire semaphore is waited on at COLOR_ATTACHMENT_OUTPUT, so the first barrier on the image chains from there
+	_rgSwapchainImage = _renderGraph.import_image("swapchain", swapchainImage, VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+	_renderGraph.set_output(_rgSwapchainImage);
+
+	// re-pointed to the current frame's image every frame. It is handed over by the timeline
+	// semaphore wait, which also makes the compute queue's writes available
+	_rgBackgroundImage = _renderGraph.import_image("background image", _frames[0]._backgroundImage, VK_IMAGE_LAYOUT_GENERAL,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT);
+
+	// only one way of filling the draw image with the background is enabled per frame, see draw()
+	_renderGraph.add_pass("background", [this](VkCommandBuffer cmd) { draw_background(cmd, _drawImageDescriptors); })
+		.write(_rgDrawImage, vkutil::ImageUsage::ComputeWrite);
+
+	_renderGraph.add_pass("background copy", [this](VkCommandBuffer cmd) {
+			vkutil::copy_image(cmd, _renderGraph.get_image(_rgBackgroundImage).image, _drawImage.image, _drawExtent);
+		})
+		.read(_rgBackgroundImage, vkutil::ImageUsage::TransferSrc)
+		.write(_rgDrawImage, vkutil::ImageUsage::TransferDst);
+
+	// the cache keeps its contents across frames, so it is handed back in the layout it is imported with
+	immediate_submit([&](VkCommandBuffer cmd) {
+		ImageStateTracker images;
+		images.track(_backgroundCache.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		images.use(_backgroundCache.image, vkutil::ImageUsage::ComputeWrite);
+		images.flush(cmd);
+	});
+	_rgBackgroundCache = _renderGraph.import_image("background cache", _backgroundCache, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+
+	_renderGraph.add_pass("background cache", [this](VkCommandBuffer cmd) { draw_background(cmd, _backgroundCacheDescriptors); })
+		.write(_rgBackgroundCache, vkutil::ImageUsage::ComputeWrite);
+
+	_renderGraph.add_pass("background cache copy", [this](VkCommandBuffer cmd) {
+			vkutil::copy_image(cmd, _backgroundCache.image, _drawImage.image, _drawExtent);
+		})
+		.read(_rgBackgroundCache, vkutil::ImageUsage::TransferSrc)
+		.write(_rgDrawImage, vkutil::ImageUsage::TransferDst);
+
+	// changed materials are copied from this frame's transient buffer, see MaterialSystem
+	_rgMaterials = _renderGraph.import_buffer("materials", _materials._buffer.buffer, _materials._bufferSize);
+
+	_renderGraph.add_pass("material upload", [this](VkCommandBuffer cmd) {
+			_materials.record_upload(cmd, get_current_frame()._transientBuffer.allocate(_materials.upload_size()));
+		})
+		.write(_rgMaterials, vkutil::BufferUsage::TransferDst);
+
+	// the depth contents are thrown away at the end of every frame
+	_rgDepthImage = _renderGraph.import_image("depth image", _depthImage, VK_IMAGE_LAYOUT_UNDEFINED);
+
+	_renderGraph.add_pass("depth prepass", [this](VkCommandBuffer cmd) { draw_depth_prepass(cmd); })
+		.write(_rgDepthImage, vkutil::ImageUsage::DepthAttachment);
+
+	// occlusion culling, see OcclusionCuller. The pyramid is rebuilt every frame but handed back in the
+	// layout the culling descriptor expects, and the culling buffers carry their state across frames
+	_rgDepthPyramid = _renderGraph.import_image("depth pyramid", _culler._pyramid, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	_rgDrawCommands[0] = _renderGraph.import_buffer("early draw commands", _culler._drawCommands[0].buffer, VK_WHOLE_SIZE);
+	_rgDrawCommands[1] = _renderGraph.import_buffer("late draw commands", _culler._drawCommands[1].buffer, VK_WHOLE_SIZE);
+	_rgDrawCounts = _renderGraph.import_buffer("draw counts", _culler._drawCounts.buffer, VK_WHOLE_SIZE);
+	_rgVisibility = _renderGraph.import_buffer("visibility", _culler._visibility.buffer, VK_WHOLE_SIZE);
+	_rgPyramidCounter = _renderGraph.import_buffer("pyramid counter", _culler._pyramidCounter.buffer, VK_WHOLE_SIZE);
+
+	_renderGraph.add_pass("cull reset", [this](VkCommandBuffer cmd) { _culler.reset_counts(cmd); })
+		.write(_rgDrawCounts, vkutil::BufferUsage::TransferDst);
+
+	_renderGraph.add_pass("cull early", [this](VkCommandBuffer cmd) {
+			_culler.cull(cmd, CullPhase::Early, _gpuObjects, _gpuObjectCount, glm::mat4(1.f));
+		})
+		// bound with the late phase's descriptor, not sampled
+		.read(_rgDepthPyramid, vkutil::ImageUsage::ComputeSampled)
+		.read(_rgVisibility, vkutil::BufferUsage::ComputeRead)
+		.read_write(_rgDrawCounts, vkutil::BufferUsage::ComputeWrite)
+		.write(_rgDrawCommands[0], vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("geometry", [this](VkCommandBuffer cmd) { draw_geometry(cmd); })
+		.read(_rgMaterials, vkutil::BufferUsage::FragmentRead)
+		.read_write(_rgDrawImage, vkutil::ImageUsage::ColorAttachment)
+		.read_write(_rgDepthImage, vkutil::ImageUsage::DepthAttachment);
+
+	_renderGraph.add_pass("culled geometry early", [this](VkCommandBuffer cmd) { draw_culled_geometry(cmd, CullPhase::Early); })
+		.read(_rgMaterials, vkutil::BufferUsage::FragmentRead)
+		.read(_rgDrawCommands[0], vkutil::BufferUsage::IndirectRead)
+		.read(_rgDrawCounts, vkutil::BufferUsage::IndirectRead)
+		.read_write(_rgDrawImage, vkutil::ImageUsage::ColorAttachment)
+		.read_write(_rgDepthImage, vkutil::ImageUsage::DepthAttachment);
+
+	_renderGraph.add_pass("depth pyramid", [this](VkCommandBuffer cmd) { _culler.build_pyramid(cmd); })
+		.read(_rgDepthImage, vkutil::ImageUsage::ComputeSampled)
+		.write(_rgDepthPyramid, vkutil::ImageUsage::ComputeWrite)
+		.read_write(_rgPyramidCounter, vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("cull late", [this](VkCommandBuffer cmd) {
+			_culler.cull(cmd, CullPhase::Late, _gpuObjects, _gpuObjectCount, glm::mat4(1.f));
+		})
+		.read(_rgDepthPyramid, vkutil::ImageUsage::ComputeSampled)
+		.read_write(_rgVisibility, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgDrawCounts, vkutil::BufferUsage::ComputeWrite)
+		.write(_rgDrawCommands[1], vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("culled geometry late", [this](VkCommandBuffer cmd) { draw_culled_geometry(cmd, CullPhase::Late); })
+		.read(_rgMaterials, vkutil::BufferUsage::FragmentRead)
+		.read(_rgDrawCommands[1], vkutil::BufferUsage::IndirectRead)
+		.read(_rgDrawCounts, vkutil::BufferUsage::IndirectRead)
+		.read_write(_rgDrawImage, vkutil::ImageUsage::ColorAttachment)
+		.read_write(_rgDepthImage, vkutil::ImageUsage::DepthAttachment);
+
+	_renderGraph.add_pass("transparent geometry", [this](VkCommandBuffer cmd) { draw_transparent_geometry(cmd); })
+		.read(_rgMaterials, vkutil::BufferUsage::FragmentRead)
+		.read_write(_rgDrawImage, vkutil::ImageUsage::ColorAttachment)
+		.read_write(_rgDepthImage, vkutil::ImageUsage::DepthAttachment);
+
+	// GPU particles, see ParticleSystem. The buffers keep the particles and the lists across frames. They are set by
+	// allocate_particles, until then the passes are disabled
+	_rgParticles = _renderGraph.import_buffer("particles", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+	_rgParticleAliveLists = _renderGraph.import_buffer("particle alive lists", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+	_rgParticleDeadList = _renderGraph.import_buffer("particle dead list", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+	_rgParticleCounters = _renderGraph.import_buffer("particle counters", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+	_rgParticleDispatchArgs = _renderGraph.import_buffer("particle dispatch args", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+	_rgParticleDrawArgs = _renderGraph.import_buffer("particle draw args", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+
+	_renderGraph.add_pass("particle reset", [this](VkCommandBuffer cmd) {
+			_particles.reset(cmd);
+			_particleReset = false;
+		})
+		.write(_rgParticleDeadList, vkutil::BufferUsage::ComputeWrite)
+		.write(_rgParticleCounters, vkutil::BufferUsage::ComputeWrite)
+		.write(_rgParticleDrawArgs, vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("particle begin", [this](VkCommandBuffer cmd) { _particles.begin(cmd, _particleEmitCount); })
+		.read_write(_rgParticleCounters, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgParticleDrawArgs, vkutil::BufferUsage::ComputeWrite)
+		.write(_rgParticleDispatchArgs, vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("particle emit", [this](VkCommandBuffer cmd) {
+			_particles.emit(cmd, _particleEmitter, (uint32_t)_frameNumber);
+		})
+		.read(_rgParticleDispatchArgs, vkutil::BufferUsage::IndirectRead)
+		.read(_rgParticleCounters, vkutil::BufferUsage::ComputeRead)
+		.read(_rgParticleDeadList, vkutil::BufferUsage::ComputeRead)
+		.read_write(_rgParticles, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgParticleAliveLists, vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("particle simulate", [this](VkCommandBuffer cmd) {
+			_particles.simulate(cmd, _particleEmitter, _particleDeltaTime);
+		})
+		.read(_rgParticleDispatchArgs, vkutil::BufferUsage::IndirectRead)
+		.read_write(_rgParticleCounters, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgParticles, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgParticleAliveLists, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgParticleDeadList, vkutil::BufferUsage::ComputeWrite)
+		.read_write(_rgParticleDrawArgs, vkutil::BufferUsage::ComputeWrite);
+
+	_renderGraph.add_pass("particles", [this](VkCommandBuffer cmd) { draw_particles(cmd); })
+		.read(_rgParticleDrawArgs, vkutil::BufferUsage::IndirectRead)
+		.read(_rgParticles, vkutil::BufferUsage::VertexRead)
+		.read(_rgParticleAliveLists, vkutil::BufferUsage::VertexRead)
+		.read_write(_rgDrawImage, vkutil::ImageUsage::ColorAttachment)
+		.read_write(_rgDepthImage, vkutil::ImageUsage::DepthAttachment);
+
+	// every camera in one layer, shown as a row of thumbnails along the bottom of the draw image
+	RGImageDesc multiviewDesc = {};
+	multiviewDesc.format = _drawImage.imageFormat;
+	multiviewDesc.extent = { _drawImage.imageExtent.width / MULTIVIEW_VIEW_COUNT, _drawImage.imageExtent.height / MULTIVIEW_VIEW_COUNT, 1 };
+	multiviewDesc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	multiviewDesc.arrayLayers = MULTIVIEW_VIEW_COUNT;
+	_rgMultiviewImage = _renderGraph.create_image("multiview views", multiviewDesc);
+
+	_renderGraph.add_pass("multiview geometry", [this](VkCommandBuffer cmd) { draw_multiview_geometry(cmd); })
+		.read(_rgMaterials, vkutil::BufferUsage::FragmentRead)
+		.write(_rgMultiviewImage, vkutil::ImageUsage::ColorAttachment);
+
+	_renderGraph.add_pass("multiview thumbnails", [this](VkCommandBuffer cmd) {
+			const AllocatedImage& views = _renderGraph.get_image(_rgMultiviewImage);
+			VkExtent2D size = { views.imageExtent.width, views.imageExtent.height };
+			for (uint32_t i = 0; i < MULTIVIEW_VIEW_COUNT; i++) {
+				VkRect2D region = { { (int32_t)(i * size.width), (int32_t)(_drawExtent.height - size.height) }, size };
+				vkutil::blit_image_layer(cmd, views.image, i, size, _drawImage.image, region);
+			}
+		})
+		.read(_rgMultiviewImage, vkutil::ImageUsage::TransferSrc)
+		// only covers part of the image, the geometry stays
+		.read_write(_rgDrawImage, vkutil::ImageUsage::TransferDst);
+
+	// re-pointed to a readback buffer of the capture ring in the frames that get captured
+	_rgCaptureBuffer = _renderGraph.import_buffer("capture buffer", VK_NULL_HANDLE, VK_WHOLE_SIZE);
+
+	_renderGraph.add_pass("capture draw image", [this](VkCommandBuffer cmd) { record_capture_copy(cmd, _drawImage.image, _drawExtent); })
+		.read(_rgDrawImage, vkutil::ImageUsage::TransferSrc)
+		.write(_rgCaptureBuffer, vkutil::BufferUsage::TransferDst)
+		.sideEffects = true;
+
+	// the draw image is HDR, the swapchain 8 bit sRGB. One compute pass converts and scales it, and
+	// writes the swapchain image directly when it supports storage. Otherwise it writes an
+	// intermediate image of the swapchain's size that is copied over
+	if (_swapchainStorage) {
+		_renderGraph.add_pass("tonemap", [this](VkCommandBuffer cmd) {
+				draw_tonemap(cmd, _tonemapDescriptors[_swapchainImageIndex], _swapchainExtent);
+			})
+			.read(_rgDrawImage, vkutil::ImageUsage::ComputeSampled)
+			.write(_rgSwapchainImage, vkutil::ImageUsage::ComputeWrite);
+	} else {
+		RGImageDesc tonemapDesc = {};
+		tonemapDesc.format = VK_FORMAT_R8G8B8A8_UNORM;
+		tonemapDesc.extent = { _swapchainExtent.width, _swapchainExtent.height, 1 };
+		tonemapDesc.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		_rgTonemapImage = _renderGraph.create_image("tonemapped image", tonemapDesc);
+
+		_renderGraph.add_pass("tonemap", [this](VkCommandBuffer cmd) { draw_tonemap(cmd, _tonemapDescriptors[0], _swapchainExtent); })
+			.read(_rgDrawImage, vkutil::ImageUsage::ComputeSampled)
+			.write(_rgTonemapImage, vkutil::ImageUsage::ComputeWrite);
+
+		_renderGraph.add_pass("present blit", [this](VkCommandBuffer cmd) {
+				const AllocatedImage& swapchainImage = _renderGraph.get_image(_rgSwapchainImage);
+				vkutil::copy_image_to_image(cmd, _renderGraph.get_image(_rgTonemapImage).image, swapchainImage.image, _swapchainExtent, _swapchainExtent);
+			})
+			.read(_rgTonemapImage, vkutil::ImageUsage::TransferSrc)
+			.write(_rgSwapchainImage, vkutil::ImageUsage::TransferDst);
+	}
+
+	_renderGraph.add_pass("imgui", [this](VkCommandBuffer cmd) {
+			draw_imgui(cmd, _renderGraph.get_image(_rgSwapchainImage).imageView);
+		})
+		.read_write(_rgSwapchainImage, vkutil::ImageUsage::ColorAttachment);
+
+	_renderGraph.add_pass("capture swapchain", [this](VkCommandBuffer cmd) {
+			record_capture_copy(cmd, _renderGraph.get_image(_rgSwapchainImage).image, _swapchainExtent);
+		})
+		.read(_rgSwapchainImage, vkutil::ImageUsage::TransferSrc)
+		.write(_rgCaptureBuffer, vkutil::BufferUsage::TransferDst)
+		.sideEffects = true;
+
+	_renderGraph.compile(_device, _allocator, &_memoryTracker);
+	update_multiview_cameras();
+	init_tonemap_descriptors();
+
+	_mainDeletionQueue.push_function([this]() {
+		_renderGraph.destroy(_device, _allocator, &_memoryTracker);
+	});
+}
+
 void VkEngine::init_imgui()
 {
     // 1: create descriptor pool for IMGUI
@@ -750,7 +2403,81 @@ void VkEngine::draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView)
 	vkCmdEndRendering(cmd);
 }
 
-AllocatedBuffer VkEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+void VkEngine::draw_memory_panel()
+{
+	if (ImGui::Begin("memory")) {
+		_memoryTracker.update_detailed();
+
+		ImGui::Text("VK_EXT_memory_budget: %s", _memoryTracker.budgetExtension ? "enabled" : "unavailable");
+		if (_memoryTracker.is_under_pressure()) {
+			ImGui::TextColored(ImVec4(1, 0.3f, 0.3f, 1), "Device memory usage is close to the budget");
+		}
+
+		if (ImGui::BeginTable("heaps", 5, ImGuiTableFlags_Borders)) {
+			ImGui::TableSetupColumn("heap");
+			ImGui::TableSetupColumn("usage / budget (MiB)");
+			ImGui::TableSetupColumn("blocks");
+			ImGui::TableSetupColumn("allocations");
+			ImGui::TableSetupColumn("fragmentation");
+			ImGui::TableHeadersRow();
+			for (size_t i = 0; i < _memoryTracker.heaps.size(); i++) {
+				const MemoryTracker::HeapStats& heap = _memoryTracker.heaps[i];
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::Text("%zu%s", i, heap.deviceLocal ? " (device)" : "");
+				ImGui::TableNextColumn();
+				char overlay[64];
+				snprintf(overlay, sizeof(overlay), "%.1f / %.1f", heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0));
+				ImGui::ProgressBar(heap.budget > 0 ? float(heap.usage) / float(heap.budget) : 0.f, ImVec2(-1, 0), overlay);
+				ImGui::TableNextColumn();
+				ImGui::Text("%u", heap.blockCount);
+				ImGui::TableNextColumn();
+				ImGui::Text("%u", heap.allocationCount);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.1f%%", heap.fragmentation * 100.f);
+			}
+			ImGui::EndTable();
+		}
+
+		for (size_t i = 0; i < _memoryTracker.categories.size(); i++) {
+			const MemoryTracker::CategoryStats& category = _memoryTracker.categories[i];
+			ImGui::Text("%-10s %4u allocations  %8.2f MiB", memory_category_name((MemoryCategory)i),
+				category.allocationCount, category.bytes / (1024.0 * 1024.0));
+		}
+
+		if (!_textures.empty() && ImGui::BeginTable("textures", 4, ImGuiTableFlags_Borders)) {
+			ImGui::TableSetupColumn("texture");
+			ImGui::TableSetupColumn("format");
+			ImGui::TableSetupColumn("size");
+			ImGui::TableSetupColumn("memory (KiB)");
+			ImGui::TableHeadersRow();
+			for (const Texture& texture : _textures) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::Text("%s", texture.name.c_str());
+				ImGui::TableNextColumn();
+				ImGui::Text("%s", string_VkFormat(texture.image.imageFormat));
+				ImGui::TableNextColumn();
+				ImGui::Text("%ux%u, %u mips", texture.image.imageExtent.width, texture.image.imageExtent.height, texture.mipLevels);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.1f", texture.memorySize / 1024.0);
+			}
+			ImGui::EndTable();
+		}
+		ImGui::Text("%zu samplers", _samplerCache.size());
+		ImGui::Text("%zu pipelines", _pipelineCache.size());
+		ImGui::Text("%zu descriptor set layouts, %zu pipeline layouts", _layoutCache.set_layout_count(), _layoutCache.pipeline_layout_count());
+
+		if (ImGui::Button("Export JSON")) {
+			if (!_memoryTracker.write_json("memory_stats.json")) {
+				std::cout << "Error when writing memory_stats.json" << std::endl;
+			}
+		}
+	}
+	ImGui::End();
+}
+
+AllocatedBuffer VkEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, MemoryCategory category)
 {
 	VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
 	bufferInfo.pNext = nullptr;
@@ -765,12 +2492,14 @@ AllocatedBuffer VkEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usa
 
 	check_vk_result(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation,
 		&newBuffer.info));
+	_memoryTracker.track(newBuffer.allocation, category);
 
 	return newBuffer;
 }
 
 void VkEngine::destroy_buffer(const AllocatedBuffer &buffer)
 {
+    _memoryTracker.untrack(buffer.allocation);
     vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
 }
 
@@ -786,7 +2515,8 @@ GPUMeshBuffers VkEngine::uploadMesh(std::span<uint32_t> indices, std::span<Verte
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | 
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | 
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
+		VMA_MEMORY_USAGE_GPU_ONLY,
+		MemoryCategory::Mesh);
 
 	VkBufferDeviceAddressInfo deviceAdressInfo{ 
         .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
@@ -799,12 +2529,14 @@ GPUMeshBuffers VkEngine::uploadMesh(std::span<uint32_t> indices, std::span<Verte
         indexBufferSize, 
         VK_BUFFER_USAGE_INDEX_BUFFER_BIT | 
         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
+		VMA_MEMORY_USAGE_GPU_ONLY,
+		MemoryCategory::Mesh);
 
     AllocatedBuffer staging = create_buffer(
         vertexBufferSize + indexBufferSize, 
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-        VMA_MEMORY_USAGE_CPU_ONLY);
+        VMA_MEMORY_USAGE_CPU_ONLY,
+        MemoryCategory::Staging);
 
 	void* data = staging.allocation->GetMappedData();
 
@@ -832,6 +2564,108 @@ GPUMeshBuffers VkEngine::uploadMesh(std::span<uint32_t> indices, std::span<Verte
 	return newSurface;
 }
 
+std::optional<Texture> VkEngine::upload_texture(const char* name, VkFormat format, VkExtent2D extent, std::span<const uint8_t> data,
+	std::span<const TextureLevel> levels, const SamplerDesc& sampler)
+{
+	// block compressed formats are only sampled with their texture compression feature, which is
+	// enabled when present, and then report SAMPLED_IMAGE
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(_chosenGPU, format, &formatProperties);
+	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+		std::cout << "Can not load " << name << ", " << string_VkFormat(format) << " can not be sampled on this device" << std::endl;
+		return {};
+	}
+
+	Texture texture = {};
+	texture.name = name;
+	texture.mipLevels = (uint32_t)levels.size();
+
+	// the chain is blitted down from level 0, which needs linear filtered blits of the format
+	bool generateMips = false;
+	if (levels.size() == 1 && !vkutil::is_block_compressed(format)) {
+		VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		if ((formatProperties.optimalTilingFeatures & needed) == needed) {
+			generateMips = true;
+			texture.mipLevels = (uint32_t)std::floor(std::log2(std::max(extent.width, extent.height))) + 1;
+		} else {
+			std::cout << "No mipmaps for " << name << ", " << string_VkFormat(format) << " can not be blitted" << std::endl;
+		}
+	}
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if (generateMips) {
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
+	texture.image.imageFormat = format;
+	texture.image.imageExtent = { extent.width, extent.height, 1 };
+	VkImageCreateInfo imgInfo = vkinit::image_create_info(format, usage, texture.image.imageExtent);
+	imgInfo.mipLevels = texture.mipLevels;
+
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	check_vk_result(vmaCreateImage(_allocator, &imgInfo, &allocInfo, &texture.image.image, &texture.image.allocation, nullptr));
+	_memoryTracker.track(texture.image.allocation, MemoryCategory::Texture);
+
+	VmaAllocationInfo allocationInfo;
+	vmaGetAllocationInfo(_allocator, texture.image.allocation, &allocationInfo);
+	texture.memorySize = allocationInfo.size;
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(format, texture.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = texture.mipLevels;
+	check_vk_result(vkCreateImageView(_device, &viewInfo, nullptr, &texture.image.imageView));
+
+	texture.sampler = _samplerCache.get(sampler);
+
+	AllocatedBuffer staging = create_buffer(data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, MemoryCategory::Staging);
+	memcpy(staging.info.pMappedData, data.data(), data.size());
+
+	immediate_submit([&](VkCommandBuffer cmd) {
+		ImageStateTracker images;
+		images.track(texture.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		images.use(texture.image.image, vkutil::ImageUsage::TransferDst);
+		images.flush(cmd);
+
+		std::vector<VkBufferImageCopy> copies(levels.size());
+		for (uint32_t level = 0; level < levels.size(); level++) {
+			VkBufferImageCopy& copy = copies[level];
+			copy = {};
+			copy.bufferOffset = levels[level].offset;
+			copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+			copy.imageExtent = { std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u), 1 };
+		}
+		vkCmdCopyBufferToImage(cmd, staging.buffer, texture.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copies.size(), copies.data());
+
+		if (generateMips) {
+			// transitions every level itself
+			vkutil::generate_mipmaps(cmd, texture.image.image, extent, texture.mipLevels);
+		} else {
+			images.use(texture.image.image, vkutil::ImageUsage::FragmentSampled);
+			images.flush(cmd);
+		}
+	});
+
+	destroy_buffer(staging);
+
+	return texture;
+}
+
+std::optional<Texture> VkEngine::load_texture(const char* path, const SamplerDesc& sampler)
+{
+	Ktx2Image image;
+	if (!vkutil::load_ktx2(path, image, _gpuProperties.limits.maxImageDimension2D)) {
+		return {};
+	}
+	return upload_texture(path, image.format, image.extent, image.data, image.levels, sampler);
+}
+
+void VkEngine::destroy_texture(const Texture& texture)
+{
+	vkDestroyImageView(_device, texture.image.imageView, nullptr);
+	_memoryTracker.untrack(texture.image.allocation);
+	vmaDestroyImage(_allocator, texture.image.image, texture.image.allocation);
+}
+
 void VkEngine::init_default_data()
 {
     std::array<Vertex,4> rect_vertices;
@@ -841,6 +2675,11 @@ void VkEngine::init_default_data()
 	rect_vertices[2].position = {-0.5,-0.5, 0};
 	rect_vertices[3].position = {-0.5,0.5, 0};
 
+	for (Vertex& vertex : rect_vertices) {
+		vertex.uv_x = vertex.position.x + 0.5f;
+		vertex.uv_y = vertex.position.y + 0.5f;
+	}
+
 	rect_vertices[0].color = {0,0, 0,1};
 	rect_vertices[1].color = { 0.5,0.5,0.5 ,1};
 	rect_vertices[2].color = { 1,0, 0,1 };
@@ -863,4 +2702,176 @@ void VkEngine::init_default_data()
 		destroy_buffer(rectangle.indexBuffer);
 		destroy_buffer(rectangle.vertexBuffer);
 	});
+
+	// a KTX2 file given with CGCV_TEXTURE, otherwise a checkerboard with generated mips
+	SamplerDesc meshSampler = {};
+	meshSampler.maxAnisotropy = 16.f;
+	std::optional<Texture> meshTexture;
+	if (const char* path = std::getenv("CGCV_TEXTURE")) {
+		meshTexture = load_texture(path, meshSampler);
+	}
+	if (!meshTexture) {
+		constexpr uint32_t CHECKER_SIZE = 256;
+		std::vector<uint32_t> pixels(CHECKER_SIZE * CHECKER_SIZE);
+		for (uint32_t y = 0; y < CHECKER_SIZE; y++) {
+			for (uint32_t x = 0; x < CHECKER_SIZE; x++) {
+				pixels[y * CHECKER_SIZE + x] = ((x / 32) + (y / 32)) % 2 ? 0xFFFFFFFF : 0xFF808080;
+			}
+		}
+		std::span<const uint8_t> bytes((const uint8_t*)pixels.data(), pixels.size() * sizeof(uint32_t));
+		TextureLevel level = { 0, bytes.size() };
+		meshTexture = upload_texture("checkerboard", VK_FORMAT_R8G8B8A8_SRGB, { CHECKER_SIZE, CHECKER_SIZE }, bytes,
+			std::span<const TextureLevel>(&level, 1), meshSampler);
+	}
+	_textures.push_back(*meshTexture);
+
+	_meshDescriptors = globalDescriptorAllocator.allocate(_device, _meshDescriptorLayout);
+	VkDescriptorImageInfo textureInfo = { meshTexture->sampler, meshTexture->image.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkWriteDescriptorSet textureWrite = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+	textureWrite.dstSet = _meshDescriptors;
+	textureWrite.dstBinding = 0;
+	textureWrite.descriptorCount = 1;
+	textureWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	textureWrite.pImageInfo = &textureInfo;
+
+	VkDescriptorBufferInfo materialInfo = { _materials._buffer.buffer, 0, _materials._bufferSize };
+	VkWriteDescriptorSet materialWrite = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+	materialWrite.dstSet = _meshDescriptors;
+	materialWrite.dstBinding = 1;
+	materialWrite.descriptorCount = 1;
+	materialWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	materialWrite.pBufferInfo = &materialInfo;
+
+	VkWriteDescriptorSet writes[] = { textureWrite, materialWrite };
+	vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
+
+	_mainDeletionQueue.push_function([this]() {
+		for (const Texture& texture : _textures) {
+			destroy_texture(texture);
+		}
+		_textures.clear();
+	});
+}
+
+void VkEngine::init_scene()
+{
+	// the render thread takes part in every parallel loop as well, the simulation thread keeps a core of its own
+	uint32_t workers = std::max(std::thread::hardware_concurrency(), 3u) - 2;
+	_workerPool.init(workers);
+	_mainDeletionQueue.push_function([this]() { _workerPool.shutdown(); });
+
+	_sceneRoot = _transforms.create();
+	// the rectangle is in front of a grid of small ones, and hides most of them from the culler
+	_rectangleTransform = _transforms.create(_sceneRoot);
+	_transforms.set_position(_rectangleTransform, glm::vec3(0.f, 0.f, 0.5f));
+	_sceneObjects.push_back({ _rectangleTransform, &rectangle, 6, 0, 0, glm::vec4(0.f, 0.f, 0.f, 0.7072f), 0 });
+
+	// a material per grid cell with its own hue, the ones on the diagonal are see-through and in front of the rectangle
+	constexpr int GRID_SIZE = 16;
+	for (int y = 0; y < GRID_SIZE; y++) {
+		for (int x = 0; x < GRID_SIZE; x++) {
+			bool transparent = x == y;
+			GPUMaterial material = {};
+			float hue = (float)(y * GRID_SIZE + x) / (GRID_SIZE * GRID_SIZE);
+			glm::vec3 rgb = glm::clamp(glm::abs(glm::mod(hue * 6.f + glm::vec3(0.f, 4.f, 2.f), 6.f) - 3.f) - 1.f, 0.f, 1.f);
+			material.baseColor = glm::vec4(glm::mix(glm::vec3(1.f), rgb, 0.6f), transparent ? 0.4f : 1.f);
+			material.textureStrength = transparent ? 0.f : 1.f;
+			MaterialId id = _materials.create(transparent ? MaterialTemplate::Transparent : MaterialTemplate::Opaque, material);
+
+			TransformHandle transform = _transforms.create(_sceneRoot);
+			_transforms.set_position(transform, glm::vec3((x + 0.5f) / GRID_SIZE * 2.f - 1.f, (y + 0.5f) / GRID_SIZE * 2.f - 1.f,
+				transparent ? 0.75f : 0.25f));
+			_transforms.set_scale(transform, glm::vec3(transparent ? 0.1f : 0.05f));
+			_sceneObjects.push_back({ transform, &rectangle, 6, 0, 0, glm::vec4(0.f, 0.f, 0.f, 0.7072f), id });
+
+			// the opaque cells spin in place, the transparent ones slide along their row
+			glm::vec3 velocity = transparent ? glm::vec3(y % 2 ? 0.2f : -0.2f, 0.f, 0.f) : glm::vec3(0.f);
+			glm::vec3 angularVelocity = glm::vec3(0.f, 0.f, transparent ? 0.f : 0.5f + (x + y) % 5 * 0.3f);
+			_simulation.add_body(_transforms.position(transform), _transforms.rotation(transform), velocity, angularVelocity);
+			_simulatedTransforms.push_back(transform);
+		}
+	}
+	_transforms.update();
+
+	// CGCV_SIMULATION=1 or 0, otherwise the scene moves unless idle rendering is on, which would
+	// never get to idle with it running
+	const char* simulation = std::getenv("CGCV_SIMULATION");
+	bool simulate = simulation ? std::string(simulation) == "1" : !_idleRendering;
+	if (simulate) {
+		_simulation.start(SIMULATION_TICK_RATE);
+	}
+	_mainDeletionQueue.push_function([this]() { _simulation.stop(); });
+}
+
+void VkEngine::draw_scene_panel()
+{
+	if (ImGui::Begin("scene")) {
+		ImGui::Text("%u transforms, %u levels, %u threads", _transforms.size(), _transforms.depth_count(), _workerPool.thread_count());
+
+		glm::vec3 position = _transforms.position(_rectangleTransform);
+		if (ImGui::DragFloat3("rectangle position", &position.x, 0.01f)) {
+			_transforms.set_position(_rectangleTransform, position);
+		}
+		glm::vec3 scale = _transforms.scale(_rectangleTransform);
+		if (ImGui::DragFloat3("rectangle scale", &scale.x, 0.01f)) {
+			_transforms.set_scale(_rectangleTransform, scale);
+		}
+		float angle = glm::degrees(glm::angle(_transforms.rotation(_sceneRoot)));
+		if (ImGui::SliderFloat("scene rotation", &angle, 0.f, 360.f)) {
+			_transforms.set_rotation(_sceneRoot, glm::angleAxis(glm::radians(angle), glm::vec3(0.f, 0.f, 1.f)));
+		}
+		ImGui::Checkbox("multiview thumbnails", &_multiviewEnabled);
+		ImGui::Checkbox("depth prepass", &_depthPrepass);
+		ImGui::Checkbox("occlusion culling", &_occlusionCulling);
+		if (_shaderObjectsSupported) {
+			ImGui::Checkbox("shader objects", &_useShaderObjects);
+		}
+		ImGui::Checkbox("idle rendering", &_idleRendering);
+
+		bool simulate = _simulation.running();
+		if (ImGui::Checkbox("simulation", &simulate)) {
+			if (simulate) {
+				_simulation.start(SIMULATION_TICK_RATE);
+			} else {
+				_simulation.stop();
+			}
+		}
+		ImGui::Text("%llu ticks at %.0f Hz, %.3f ms per tick", (unsigned long long)_simulation._tick.load(), SIMULATION_TICK_RATE,
+			_simulation._stepMs.load());
+
+		ImGui::Checkbox("particles", &_particlesEnabled);
+		ImGui::SameLine();
+		if (ImGui::Button("reset particles")) {
+			_particleReset = true;
+		}
+		ImGui::SliderFloat("emit rate", &_particleEmitRate, 0.f, 2000000.f, "%.0f/s", ImGuiSliderFlags_Logarithmic);
+		ImGui::Text("up to %u particles, the GPU keeps the count", MAX_PARTICLES);
+		ImGui::DragFloat3("emitter position", &_particleEmitter.position.x, 0.01f);
+		ImGui::DragFloat3("emitter velocity", &_particleEmitter.velocity.x, 0.01f);
+		ImGui::SliderFloat("emitter spread", &_particleEmitter.spread, 0.f, 2.f);
+		ImGui::SliderFloat("particle lifetime", &_particleEmitter.lifetime, 0.1f, 10.f);
+		ImGui::DragFloat3("gravity", &_particleEmitter.gravity.x, 0.01f);
+		ImGui::SliderFloat("particle size", &_particleEmitter.size, 0.001f, 0.05f, "%.3f", ImGuiSliderFlags_Logarithmic);
+		ImGui::ColorEdit4("particle color", &_particleEmitter.color.x, ImGuiColorEditFlags_HDR | ImGuiColorEditFlags_Float);
+
+		ImGui::Text("%u materials, %zu opaque, %zu transparent", _materials.count(),
+			_materials.materials(MaterialTemplate::Opaque).size(), _materials.materials(MaterialTemplate::Transparent).size());
+		// an edit uploads this one material
+		ImGui::SliderInt("material", &_editedMaterial, 0, (int)_materials.count() - 1);
+		GPUMaterial material = _materials.parameters(_editedMaterial);
+		bool changed = ImGui::ColorEdit4("base color", &material.baseColor.x);
+		changed |= ImGui::ColorEdit3("emissive", &material.emissive.x, ImGuiColorEditFlags_HDR | ImGuiColorEditFlags_Float);
+		changed |= ImGui::SliderFloat("texture strength", &material.textureStrength, 0.f, 1.f);
+		if (changed) {
+			_materials.update(_editedMaterial, material);
+		}
+
+		ImGui::DragFloat("exposure", &_exposure, 0.01f, 0.f, 16.f);
+		int tonemapper = (int)_tonemapper;
+		if (ImGui::Combo("tonemapper", &tonemapper, "clamp\0reinhard\0aces\0")) {
+			_tonemapper = (Tonemapper)tonemapper;
+		}
+		ImGui::Text(_swapchainStorage ? "Tonemapping writes the swapchain" : "Swapchain has no storage support, tonemapping goes through a blit");
+	}
+	ImGui::End();
 }
@@ -2,6 +2,25 @@
 
 #include "vk_types.h"
 #include "vk_descriptors.h"
+#include "vk_pipelines.h"
+#include "vk_shader_objects.h"
+#include "vk_buffers.h"
+#include "vk_memory.h"
+#include "vk_render_graph.h"
+#include "vk_tuning.h"
+#include "vk_shader_reload.h"
+#include "vk_shader_variants.h"
+#include "vk_scene.h"
+#include "vk_jobs.h"
+#include "vk_capture.h"
+#include "vk_culling.h"
+#include "vk_textures.h"
+#include "vk_materials.h"
+#include "vk_frame_pacing.h"
+#include "vk_simulation.h"
+#include "vk_particles.h"
+
+#include <chrono>
 
 struct DeletionQueue
 {
@@ -20,6 +39,23 @@ struct DeletionQueue
 };
 
 constexpr unsigned int FRAME_OVERLAP = 2;
+constexpr VkDeviceSize TRANSIENT_BUFFER_SIZE = 4 * 1024 * 1024;
+// cameras rendered by the multiview pass, each into a layer of one array image
+constexpr uint32_t MULTIVIEW_VIEW_COUNT = 4;
+// size of the culling buffers
+constexpr uint32_t MAX_SCENE_OBJECTS = 1024;
+// size of the material buffer
+constexpr uint32_t MAX_MATERIALS = 4096;
+// with idle rendering, how long the main loop sleeps before it looks for finished background work
+constexpr double IDLE_WAIT_TIMEOUT = 0.25;
+// drawn after each redraw request, ImGui reacts to input one frame late
+constexpr int IDLE_REDRAW_FRAMES = 3;
+// fixed timestep of the simulation thread, in ticks per second
+constexpr double SIMULATION_TICK_RATE = 60.0;
+// size of the particle buffers
+constexpr uint32_t MAX_PARTICLES = 1 << 20;
+// longest particle time step, after a pause the particles continue instead of jumping ahead
+constexpr float MAX_PARTICLE_STEP = 0.1f;
 struct FrameData {
 	VkCommandPool _commandPool;
 	VkCommandBuffer _mainCommandBuffer;
@@ -28,6 +64,24 @@ struct FrameData {
 	VkFence _renderFence;
     
     DeletionQueue _frameDeletionQueue;
+	TransientBufferAllocator _transientBuffer;
+
+	// background effect rendered on the compute queue, consumed by this frame's graphics work
+	VkCommandPool _computeCommandPool;
+	VkCommandBuffer _computeCommandBuffer;
+	AllocatedImage _backgroundImage;
+	VkDescriptorSet _backgroundDescriptors;
+	uint64_t _backgroundTimelineValue;
+
+	// begin/end of the compute and graphics submissions
+	VkQueryPool _timestampPool;
+};
+
+// raw timestamps of one frame, compute is only valid when the background ran on the compute queue
+struct GpuTimings {
+	bool hasCompute;
+	uint64_t computeBegin, computeEnd;
+	uint64_t graphicsBegin, graphicsEnd;
 };
 
 struct ComputePushConstants {
@@ -37,20 +91,82 @@ struct ComputePushConstants {
 	glm::vec4 data4;
 };
 
+enum class Tonemapper : uint32_t {
+	Clamp,
+	Reinhard,
+	ACES,
+};
+
+// matches tonemap.comp
+struct TonemapPushConstants {
+	glm::vec2 uvScale;
+	float exposure;
+	Tonemapper tonemapper;
+	uint32_t frame;
+};
+
 struct ComputeEffect {
 	const char* name;
 
 	VkPipeline pipeline;
 	VkPipelineLayout layout;
+	// GLSL source in shaders/, loaded from <shaderFile>.spv
+	const char* shaderFile;
+	// kept around to re-specialize the pipeline to another workgroup size
+	VkShaderModule shader;
+	WorkgroupSize workgroupSize;
 
 	ComputePushConstants data;
+
+	// time varying effects are dispatched every frame, static ones are rendered once into
+	// the background cache and copied until their inputs change
+	bool animated{ false };
+};
+
+// how a colored pipeline uses the reversed-Z depth buffer, cleared to 0 with near at 1
+enum class DepthMode {
+	// no depth attachment
+	None,
+	// GREATER_OR_EQUAL test, writes depth
+	Write,
+	// EQUAL test against the depth prepass, no writes
+	Equal,
+	// GREATER_OR_EQUAL test, no writes, for blended geometry over the opaque depth
+	Read,
+};
+
+// a mesh placed in the scene, drawn directly or through the occlusion culler
+struct SceneObject {
+	TransformHandle transform;
+	const GPUMeshBuffers* mesh;
+	// the object's range of the mesh, several objects can share one mesh
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	// object space bounding sphere, center and radius
+	glm::vec4 bounds;
+	// its template picks the pass the object is drawn in
+	MaterialId material;
 };
 
 class VkEngine {
 public:
     bool _isInitialized{ false };
 	int _frameNumber {0};
+	// set while the window is minimized, nothing is drawn until it is restored
 	bool stop_rendering{ false };
+	// Only draws when something changed: input, parameter edits, animated effects, captures and
+	// background work. The main loop waits for events otherwise. Defaults to CGCV_IDLE_RENDERING=1
+	bool _idleRendering{ false };
+	// frames left to draw for the last redraw request
+	int _redrawFrames{ IDLE_REDRAW_FRAMES };
+
+	FramePacer _framePacer;
+	// Reads the input only once the previous frame is on screen, or rendered without present wait,
+	// so no queued frame sits between input and display. Defaults to CGCV_LOW_LATENCY=1
+	bool _lowLatency{ false };
+	// frame limiter, 0 is unlimited
+	float _targetFps{ 0.f };
 	VkExtent2D _windowExtent{ 1700 , 900 };
 
 	struct GLFWwindow* _window{ nullptr };
@@ -59,6 +175,11 @@ public:
 	VkDebugUtilsMessengerEXT _debug_messenger;
 	VkPhysicalDevice _chosenGPU;
 	VkDevice _device;
+	bool _memoryBudgetSupported{ false };
+	// VK_EXT_shader_object, the geometry pass can draw without pipelines
+	bool _shaderObjectsSupported{ false };
+	// VK_KHR_present_id and VK_KHR_present_wait, the frame pacer can wait for frames to be on screen
+	bool _presentWaitSupported{ false };
 	VkSurfaceKHR _surface;
 
     VkSwapchainKHR _swapchain;
@@ -66,6 +187,11 @@ public:
 	std::vector<VkImage> _swapchainImages;
 	std::vector<VkImageView> _swapchainImageViews;
 	VkExtent2D _swapchainExtent;
+	// the tonemap pass writes the swapchain images directly, instead of an image that is blitted to them
+	bool _swapchainStorage{ false };
+	// FIFO unless CGCV_VSYNC=0
+	VkPresentModeKHR _swapchainPresentMode;
+	uint32_t _swapchainImageIndex;
 
     FrameData _frames[FRAME_OVERLAP];
 	FrameData& get_current_frame() { return _frames[_frameNumber % FRAME_OVERLAP]; };
@@ -73,11 +199,26 @@ public:
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
 
+	// falls back to the graphics queue when the device has no separate compute family
+	VkQueue _computeQueue;
+	uint32_t _computeQueueFamily;
+	bool _asyncComputeSupported{ false };
+	bool _useAsyncCompute{ true };
+	VkSemaphore _computeTimeline;
+	uint64_t _computeTimelineValue{ 0 };
+
+	VkPhysicalDeviceProperties _gpuProperties;
+	bool _gpuTimestamps{ false };
+	GpuTimings _lastGpuTimings{};
+	double _computeGraphicsOverlap{ 0 };
+
     DeletionQueue _mainDeletionQueue;
 
     VmaAllocator _allocator;
+	MemoryTracker _memoryTracker;
 
     AllocatedImage _drawImage;
+	AllocatedImage _depthImage;
 	VkExtent2D _drawExtent;
 
     DescriptorAllocator globalDescriptorAllocator;
@@ -97,10 +238,136 @@ public:
 	std::vector<ComputeEffect> backgroundEffects;
 	int currentBackgroundEffect{0};
 
+	AllocatedImage _backgroundCache;
+	VkDescriptorSet _backgroundCacheDescriptors;
+	// set by the background ImGui inputs, and when the draw extent changes
+	bool _backgroundCacheDirty{ true };
+	VkExtent2D _backgroundCacheExtent{};
+	std::chrono::steady_clock::time_point _startTime;
+
+	WorkgroupTuner _workgroupTuner;
+	// guards the workgroupSize of the background effects, written on the render thread and read by
+	// the shader reload thread
+	std::mutex _workgroupSizeMutex;
+	bool _tuneWorkgroupSizes{ false };
+
+	ShaderWatcher _shaderWatcher;
+	ShaderVariantCache _shaderVariants;
+	// every graphics pipeline, keyed on the builder state
+	PipelineCache _pipelineCache;
+	// draws the geometry pass with shader objects and dynamic state instead of pipelines.
+	// Defaults to CGCV_SHADER_OBJECTS=1, falls back to pipelines when unsupported
+	ShaderObjects _shaderObjects;
+	bool _useShaderObjects{ false };
+	// unlinked colored_triangle shaders: the vertex shader without and with VERTEX_BUFFER, the
+	// fragment shader without and with TEXTURE | MATERIAL. Recreated together when either source changes
+	VkShaderEXT _triangleVertexObject;
+	VkShaderEXT _meshVertexObject;
+	VkShaderEXT _triangleFragmentObject;
+	VkShaderEXT _meshFragmentObject;
+
+	SamplerCache _samplerCache;
+	// every descriptor set layout and pipeline layout, shared where their contents match
+	LayoutCache _layoutCache;
+	// textures kept until shutdown, listed in the memory panel
+	std::vector<Texture> _textures;
+
+	// set 0 of the mesh pipelines, the texture the TEXTURE fragment variant samples
+	VkDescriptorSetLayout _meshDescriptorLayout;
+	VkDescriptorSet _meshDescriptors;
 	VkPipelineLayout _meshPipelineLayout;
 	VkPipeline _meshPipeline;
+	// depth only pass over the meshes, after which _meshEqualPipeline shades each pixel once
+	VkPipeline _depthPrepassPipeline;
+	VkPipeline _meshEqualPipeline;
+	bool _depthPrepass{ false };
+	// mesh pipeline with a view mask over all MULTIVIEW_VIEW_COUNT views
+	VkPipeline _multiviewPipeline;
+	bool _multiviewEnabled{ false };
+	std::array<glm::mat4, MULTIVIEW_VIEW_COUNT> _multiviewMatrices;
+
+	// draws the scene objects from the culler's indirect commands
+	VkPipeline _culledPipeline;
+	OcclusionCuller _culler;
+	bool _occlusionCulling{ false };
+	// this frame's GPUObject array, the opaque scene objects
+	VkDeviceAddress _gpuObjects;
+	uint32_t _gpuObjectCount{ 0 };
+	// the indirect draws have one index buffer, every culled object is a range of this mesh
+	const GPUMeshBuffers* _culledMesh{ nullptr };
+
+	// bound through set 0 of the mesh pipelines, read by the MATERIAL fragment variant
+	MaterialSystem _materials;
+	// the material edited in the scene panel
+	int _editedMaterial{ 0 };
+	// the Transparent material template, blended after the opaque geometry
+	VkPipeline _transparentPipeline;
+	// set by draw() when a scene object has a transparent material, the opaque passes then keep their depth
+	bool _transparentPass{ false };
+
+	// emitted, simulated and drawn on the GPU, the CPU only passes this frame's emit count and time step
+	ParticleSystem _particles;
+	ParticleEmitter _particleEmitter;
+	// additive, depth tested without writes. Owned by the pipeline cache
+	VkPipeline _particlePipeline;
+	bool _particlesEnabled{ false };
+	// particles per second
+	float _particleEmitRate{ 100000.f };
+	// the fraction of a particle left over from the last frame's emission
+	float _particleEmitRemainder{ 0.f };
+	uint32_t _particleEmitCount{ 0 };
+	float _particleDeltaTime{ 0.f };
+	std::chrono::steady_clock::time_point _lastParticleTime;
+	// kills every particle in the next frame
+	bool _particleReset{ false };
+
+	// resolves the draw image for display, see tonemap.comp
+	VkDescriptorSetLayout _tonemapDescriptorLayout;
+	// one per swapchain image, or a single one for the intermediate image
+	std::vector<VkDescriptorSet> _tonemapDescriptors;
+	VkPipelineLayout _tonemapPipelineLayout;
+	VkPipeline _tonemapPipeline;
+	float _exposure{ 1.f };
+	Tonemapper _tonemapper{ Tonemapper::ACES };
 
 	GPUMeshBuffers rectangle;
+
+	WorkerPool _workerPool;
+	TransformHierarchy _transforms;
+	TransformHandle _sceneRoot;
+	TransformHandle _rectangleTransform;
+	std::vector<SceneObject> _sceneObjects;
+	// moves the grid objects on its own thread, body i drives _simulatedTransforms[i]
+	Simulation _simulation;
+	std::vector<TransformHandle> _simulatedTransforms;
+	std::vector<BodyState> _bodyStates;
+
+	RenderGraph _renderGraph;
+	RGResource _rgDrawImage;
+	RGResource _rgDepthImage;
+	RGResource _rgSwapchainImage;
+	RGResource _rgBackgroundImage;
+	RGResource _rgBackgroundCache;
+	RGResource _rgCaptureBuffer;
+	RGResource _rgMultiviewImage;
+	RGResource _rgTonemapImage;
+	RGResource _rgDepthPyramid;
+	RGResource _rgDrawCommands[2];
+	RGResource _rgDrawCounts;
+	RGResource _rgVisibility;
+	RGResource _rgPyramidCounter;
+	RGResource _rgMaterials;
+	RGResource _rgParticles;
+	RGResource _rgParticleAliveLists;
+	RGResource _rgParticleDeadList;
+	RGResource _rgParticleCounters;
+	RGResource _rgParticleDispatchArgs;
+	RGResource _rgParticleDrawArgs;
+
+	FrameCapture _capture;
+	CaptureFormat _captureFormat{ CaptureFormat::PPM };
+	// the swapchain image includes the UI, the draw image is the scene alone before the blit
+	bool _captureSwapchain{ false };
 	    
     VkEngine();
     ~VkEngine();
@@ -109,36 +376,114 @@ public:
 
     void draw();
     void run();
+	// one iteration of the main loop without the event polling: UI, then draw()
+	void frame();
+
+	// draws the next IDLE_REDRAW_FRAMES frames, for changes idle rendering does not notice itself
+	void request_redraw() { _redrawFrames = IDLE_REDRAW_FRAMES; }
 
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
 
+	GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+	void destroy_buffer(const AllocatedBuffer& buffer);
+
+	// Uploads the given levels of `data` through a staging buffer. A single level of an uncompressed
+	// format gets the rest of its mip chain generated on the GPU, when the format can be blitted.
+	// Empty when the device can not sample the format
+	std::optional<Texture> upload_texture(const char* name, VkFormat format, VkExtent2D extent, std::span<const uint8_t> data,
+		std::span<const TextureLevel> levels, const SamplerDesc& sampler = {});
+	// KTX2 files, see vkutil::load_ktx2
+	std::optional<Texture> load_texture(const char* path, const SamplerDesc& sampler = {});
+	void destroy_texture(const Texture& texture);
+
+	// colored_triangle shaders, in the variants given by the ShaderFeature bits. SHADER_FEATURE_TEXTURE
+	// and SHADER_FEATURE_MATERIAL select the fragment shader variant, the other bits the vertex shader one. False when a variant is missing
+	bool colored_pipeline_builder(PipelineBuilder& builder, VkPipelineLayout layout, uint32_t features, DepthMode depthMode, uint32_t viewMask = 0);
+	// shared through the pipeline cache and created on first use. With `background` it is created on
+	// the cache's compile thread and VK_NULL_HANDLE is returned until it is ready
+	VkPipeline colored_pipeline(VkPipelineLayout layout, uint32_t features, DepthMode depthMode, uint32_t viewMask = 0, bool background = false);
+	// a new pipeline, destroyed by the caller
+	VkPipeline build_colored_pipeline(VkPipelineLayout layout, uint32_t features, DepthMode depthMode, uint32_t viewMask = 0);
+	// owned by the pipeline cache
+	VkPipeline depth_prepass_pipeline();
+	// the Transparent material template, alpha blended and depth tested without writes. Owned by the pipeline cache
+	VkPipeline transparent_pipeline();
+	// draws the ParticleSystem's alive list, owned by the pipeline cache
+	VkPipeline particle_pipeline();
+
 private:
 	void init_vulkan();
+	// input, resizes and minimizing, the ImGui backend chains its own callbacks to these
+	void init_window_callbacks();
+	// something on screen would change, checked by the idle main loop
+	bool needs_redraw();
+	// low latency mode, before the input of the next frame is read
+	void wait_for_previous_frame();
 	
     void init_swapchain();
     void create_swapchain(uint32_t width, uint32_t height);
+	void init_background_images();
 	void destroy_swapchain();
 
 	void init_commands();
 	void init_sync_structures();
+	void init_transient_buffers();
 
     void init_descriptors();
+	void init_materials();
 
-    void draw_background(VkCommandBuffer cmd);
+    void draw_background(VkCommandBuffer cmd, VkDescriptorSet targetImage);
+	void submit_background_compute();
+	void read_gpu_timestamps();
+	void draw_profiler_panel();
 	void draw_geometry(VkCommandBuffer cmd);
+	void draw_depth_prepass(VkCommandBuffer cmd);
+	void draw_multiview_geometry(VkCommandBuffer cmd);
+	// one draw per scene object with a material of the template, with everything but the world matrix,
+	// vertex buffer and material taken from `pushConstants`
+	void draw_scene_objects(VkCommandBuffer cmd, GPUDrawPushConstants pushConstants, MaterialTemplate materialTemplate);
+	// back to front over the opaque geometry
+	void draw_transparent_geometry(VkCommandBuffer cmd);
+	void draw_culled_geometry(VkCommandBuffer cmd, CullPhase phase);
+	void draw_particles(VkCommandBuffer cmd);
+	// the transparent and particle passes test against the depth the opaque passes leave
+	bool blended_passes_enabled() const { return _transparentPass || _particlesEnabled; }
+	// the culler draws the scene objects itself, so the prepass is skipped while it is on
+	bool depth_prepass_enabled() const { return _depthPrepass && !_occlusionCulling; }
+	void update_multiview_cameras();
+	void draw_tonemap(VkCommandBuffer cmd, VkDescriptorSet descriptors, VkExtent2D extent);
 
     void init_pipelines();
 	void init_background_pipelines();
-	void init_triangle_pipeline();
+	void tune_background_effects();
+	void init_shader_reload();
 	void init_mesh_pipeline();
+	void init_culling();
+	void init_particles();
+	// creates the particle buffers the first time particles are enabled
+	void allocate_particles();
+	void init_shader_objects();
+	// the four colored_triangle shader objects in the order of the members, empty when creation failed
+	std::vector<VkShaderEXT> create_shader_objects();
+	void init_tonemap_pipeline();
+	VkPipeline build_tonemap_pipeline();
+	// after the render graph is compiled, the intermediate image is one of its transient images
+	void init_tonemap_descriptors();
+	void init_render_graph();
 
 	void init_imgui();
 	void draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView);
+	void draw_memory_panel();
 
-	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
-	void destroy_buffer(const AllocatedBuffer& buffer);
+	void init_capture();
+	void record_capture_copy(VkCommandBuffer cmd, VkImage image, VkExtent2D extent);
+	// waits for the GPU so no copy in flight is lost
+	void stop_capture();
+	void draw_capture_panel();
 
-	GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, MemoryCategory category);
 
 	void init_default_data();
+	void init_scene();
+	void draw_scene_panel();
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "vk_frame_pacing.h"
+
+#include <thread>
+
+// longer than the sleep overshoot of common schedulers
+static constexpr std::chrono::microseconds SPIN_MARGIN{ 2000 };
+
+void FramePacer::init(VkDevice device, bool presentWait)
+{
+    _device = device;
+    if (presentWait) {
+        _waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+    }
+    _frameStart = Clock::now();
+    _inputTime = _frameStart;
+}
+
+void FramePacer::limit(double targetFps)
+{
+    Clock::time_point now = Clock::now();
+    if (targetFps <= 0) {
+        _frameStart = now;
+        return;
+    }
+
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+    Clock::time_point deadline = _frameStart + period;
+    // a slow frame starts the schedule over instead of making up for it with shorter ones
+    if (deadline < now) {
+        _frameStart = now;
+        return;
+    }
+
+    if (now < deadline - SPIN_MARGIN) {
+        std::this_thread::sleep_until(deadline - SPIN_MARGIN);
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    _frameStart = deadline;
+}
+
+uint64_t FramePacer::next_present_id()
+{
+    if (!present_wait()) {
+        return 0;
+    }
+    _presentId++;
+    _pending.push_back({ _presentId, _inputTime });
+    return _presentId;
+}
+
+void FramePacer::wait_for_last_present(VkSwapchainKHR swapchain, uint64_t timeout)
+{
+    if (!present_wait() || _pending.empty()) {
+        return;
+    }
+    // presents complete in order, the ones before the last are done too
+    PendingPresent last = _pending.back();
+    VkResult result = _waitForPresent(_device, swapchain, last.id, timeout);
+    if (result == VK_SUCCESS) {
+        _pending.clear();
+        presented(last, false);
+    } else if (result != VK_TIMEOUT) {
+        // e.g. VK_ERROR_OUT_OF_DATE_KHR, the ids will never complete
+        _pending.clear();
+    }
+}
+
+void FramePacer::collect(VkSwapchainKHR swapchain)
+{
+    while (present_wait() && !_pending.empty()) {
+        VkResult result = _waitForPresent(_device, swapchain, _pending.front().id, 0);
+        if (result == VK_TIMEOUT) {
+            return;
+        }
+        if (result == VK_SUCCESS) {
+            presented(_pending.front(), true);
+        }
+        _pending.pop_front();
+    }
+}
+
+void FramePacer::presented(const PendingPresent& present, bool upperBound)
+{
+    // the average does not mix exact latencies with bounds
+    if (upperBound != _latencyUpperBound) {
+        _averageLatencyMs = 0;
+        _latencyUpperBound = upperBound;
+    }
+    _latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - present.inputTime).count();
+    _averageLatencyMs = _averageLatencyMs == 0 ? _latencyMs : _averageLatencyMs * 0.9 + _latencyMs * 0.1;
+}
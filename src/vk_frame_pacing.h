@@ -0,0 +1,59 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <chrono>
+
+// Frame start timing and input-to-present latency. With VK_KHR_present_wait every present
+// gets an id, and waiting on the id of the previous frame before input is read keeps the
+// swapchain queue short, so the input a frame shows is as fresh as possible. Without it the
+// pacer only limits the frame rate.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // presentWait when the device was created with VK_KHR_present_id and VK_KHR_present_wait
+    void init(VkDevice device, bool presentWait);
+
+    bool present_wait() const { return _waitForPresent != nullptr; }
+
+    // Sleeps until one period after the previous frame start, 0 does not limit. The OS sleep
+    // wakes up late by up to a scheduler tick, so the last stretch is spun
+    void limit(double targetFps);
+
+    // when the input of the frame being built was read
+    void input_sampled() { _inputTime = Clock::now(); }
+    // the id to chain to the present through VkPresentIdKHR, 0 without present wait
+    uint64_t next_present_id();
+
+    // blocks until the most recent present is on screen, or `timeout` nanoseconds passed
+    void wait_for_last_present(VkSwapchainKHR swapchain, uint64_t timeout);
+    // records the latency of the presents that are done, without blocking. Stamped when the
+    // next frame polls, not when the image was presented, so these are upper bounds that can be
+    // late by up to a frame
+    void collect(VkSwapchainKHR swapchain);
+
+    // input to present of the last frame that was measured, and a moving average
+    double _latencyMs{ 0 };
+    double _averageLatencyMs{ 0 };
+    // measured by collect() rather than by waiting on the present
+    bool _latencyUpperBound{ false };
+
+private:
+    struct PendingPresent {
+        uint64_t id;
+        Clock::time_point inputTime;
+    };
+
+    void presented(const PendingPresent& present, bool upperBound);
+
+    VkDevice _device;
+    PFN_vkWaitForPresentKHR _waitForPresent{ nullptr };
+
+    uint64_t _presentId{ 0 };
+    Clock::time_point _inputTime;
+    // in present order, which is also the order they complete in
+    std::deque<PendingPresent> _pending;
+
+    Clock::time_point _frameStart;
+};
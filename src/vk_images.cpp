@@ -2,14 +2,161 @@
 
 #include "vk_initializers.h"
 
+#include <algorithm>
+
+static constexpr VkAccessFlags2 WRITE_ACCESS_MASK =
+    VK_ACCESS_2_SHADER_WRITE_BIT |
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT |
+    VK_ACCESS_2_HOST_WRITE_BIT |
+    VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+vkutil::ImageUsageInfo vkutil::image_usage_info(ImageUsage usage)
+{
+    switch (usage) {
+    case ImageUsage::ComputeWrite:
+        return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, true };
+    case ImageUsage::ComputeRead:
+        return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, false };
+    case ImageUsage::ComputeSampled:
+        return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, false };
+    case ImageUsage::ColorAttachment:
+        return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, true };
+    case ImageUsage::DepthAttachment:
+        return { VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, true };
+    case ImageUsage::DepthRead:
+        return { VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, false };
+    case ImageUsage::FragmentSampled:
+        return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, false };
+    case ImageUsage::TransferSrc:
+        return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, false };
+    case ImageUsage::TransferDst:
+        return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, true };
+    case ImageUsage::Present:
+        // the present engine is outside of any stage, wait for everything before the semaphore signal
+        return { VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, false };
+    default:
+        return { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, false };
+    }
+}
+
+VkImageLayout vkutil::image_layout(ImageUsage usage)
+{
+    return image_usage_info(usage).layout;
+}
+
+bool vkutil::is_write_usage(ImageUsage usage)
+{
+    return image_usage_info(usage).write;
+}
+
+vkutil::ImageState vkutil::unknown_image_state(VkImageLayout layout)
+{
+    ImageState state = {};
+    state.layout = layout;
+    state.writeStage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    state.writeAccess = VK_ACCESS_2_MEMORY_WRITE_BIT;
+    return state;
+}
+
+bool vkutil::update_image_state(ImageState& state, ImageUsage usage, VkImageMemoryBarrier2& barrier)
+{
+    return update_image_state(state, image_usage_info(usage), barrier);
+}
+
+bool vkutil::update_image_state(ImageState& state, const ImageUsageInfo& usage, VkImageMemoryBarrier2& barrier)
+{
+    bool layoutChange = state.layout != usage.layout;
+    bool needed;
+
+    if (usage.write || layoutChange) {
+        // write after write, write after read and layout transitions wait on the last write and every read since
+        needed = layoutChange || state.writeStage != 0 || state.readStages != 0;
+        barrier.srcStageMask = state.writeStage | state.readStages;
+        barrier.srcAccessMask = state.writeAccess;
+    } else {
+        // read after write only needs a barrier if the write is not visible to this stage/access yet
+        needed = state.writeStage != 0 &&
+            ((usage.stage & ~state.visibleStages) != 0 || (usage.access & ~state.visibleAccess) != 0);
+        barrier.srcStageMask = state.writeStage;
+        barrier.srcAccessMask = state.writeAccess;
+    }
+
+    if (needed) {
+        barrier.dstStageMask = usage.stage;
+        barrier.dstAccessMask = usage.access;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = usage.layout;
+    }
+
+    if (usage.write) {
+        state.writeStage = usage.stage;
+        state.writeAccess = usage.access & WRITE_ACCESS_MASK;
+        state.readStages = 0;
+        state.visibleStages = 0;
+        state.visibleAccess = 0;
+    } else if (layoutChange) {
+        // the transition itself is the last write now, later readers chain through this stage
+        state.writeStage = usage.stage;
+        state.writeAccess = VK_ACCESS_2_NONE;
+        state.readStages = usage.stage;
+        state.visibleStages = usage.stage;
+        state.visibleAccess = usage.access;
+    } else {
+        state.readStages |= usage.stage;
+        if (needed) {
+            state.visibleStages |= usage.stage;
+            state.visibleAccess |= usage.access;
+        }
+    }
+    state.layout = usage.layout;
+
+    return needed;
+}
+
+// best guess at how an image in a given layout was used, for callers that only know layouts
+static vkutil::ImageUsageInfo usage_for_layout(VkImageLayout layout)
+{
+    switch (layout) {
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+        return vkutil::image_usage_info(vkutil::ImageUsage::ColorAttachment);
+    case VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL:
+        return vkutil::image_usage_info(vkutil::ImageUsage::DepthAttachment);
+    case VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL:
+        return vkutil::image_usage_info(vkutil::ImageUsage::DepthRead);
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        return { layout, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, false };
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        return vkutil::image_usage_info(vkutil::ImageUsage::TransferSrc);
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        return vkutil::image_usage_info(vkutil::ImageUsage::TransferDst);
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+        return vkutil::image_usage_info(vkutil::ImageUsage::Present);
+    default:
+        // GENERAL and UNDEFINED say nothing about the stage
+        return { layout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT, true };
+    }
+}
+
 void vkutil::transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout)
 {
+    ImageUsageInfo src = usage_for_layout(currentLayout);
+    ImageUsageInfo dst = usage_for_layout(newLayout);
+
     VkImageMemoryBarrier2 imageBarrier {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
     imageBarrier.pNext = nullptr;
-    imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-    imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
-    imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-    imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
+    imageBarrier.srcStageMask = src.stage;
+    imageBarrier.srcAccessMask = currentLayout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_ACCESS_2_NONE : src.access & WRITE_ACCESS_MASK;
+    imageBarrier.dstStageMask = dst.stage;
+    imageBarrier.dstAccessMask = dst.access;
     imageBarrier.oldLayout = currentLayout;
     imageBarrier.newLayout = newLayout;
 
@@ -26,6 +173,44 @@ void vkutil::transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout
     vkCmdPipelineBarrier2(cmd, &depInfo);
 }
 
+void vkutil::transition_image(VkCommandBuffer cmd, VkImage image, ImageState& state, ImageUsage usage, VkImageAspectFlags aspect)
+{
+    VkImageMemoryBarrier2 imageBarrier {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    if (!update_image_state(state, usage, imageBarrier)) {
+        return;
+    }
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = image;
+    imageBarrier.subresourceRange = vkinit::image_subresource_range(aspect);
+
+    VkDependencyInfo depInfo {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    depInfo.imageMemoryBarrierCount = 1;
+    depInfo.pImageMemoryBarriers = &imageBarrier;
+
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+void vkutil::copy_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D size)
+{
+    VkImageCopy2 copyRegion{ .sType = VK_STRUCTURE_TYPE_IMAGE_COPY_2, .pNext = nullptr };
+    copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.srcSubresource.layerCount = 1;
+    copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.dstSubresource.layerCount = 1;
+    copyRegion.extent = { size.width, size.height, 1 };
+
+    VkCopyImageInfo2 copyInfo{ .sType = VK_STRUCTURE_TYPE_COPY_IMAGE_INFO_2, .pNext = nullptr };
+    copyInfo.srcImage = source;
+    copyInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    copyInfo.dstImage = destination;
+    copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    copyInfo.regionCount = 1;
+    copyInfo.pRegions = &copyRegion;
+
+    vkCmdCopyImage2(cmd, &copyInfo);
+}
+
 void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize)
 {
 	VkImageBlit2 blitRegion{ .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2, .pNext = nullptr };
@@ -59,3 +244,167 @@ void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage de
 
 	vkCmdBlitImage2(cmd, &blitInfo);
 }
+
+void vkutil::generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D size, uint32_t mipLevels)
+{
+	VkImageMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+	barrier.subresourceRange.levelCount = 1;
+
+	VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	depInfo.imageMemoryBarrierCount = 1;
+	depInfo.pImageMemoryBarriers = &barrier;
+
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		VkExtent2D levelSize = { std::max(size.width >> level, 1u), std::max(size.height >> level, 1u) };
+
+		// the level is complete, it is read by the next blit and then sampled
+		barrier.subresourceRange.baseMipLevel = level;
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		if (level + 1 < mipLevels) {
+			barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+			barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		} else {
+			barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+		vkCmdPipelineBarrier2(cmd, &depInfo);
+		if (level + 1 == mipLevels) {
+			break;
+		}
+
+		VkExtent2D nextSize = { std::max(levelSize.width / 2, 1u), std::max(levelSize.height / 2, 1u) };
+
+		VkImageBlit2 blitRegion{ .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2 };
+		blitRegion.srcOffsets[1] = { (int32_t)levelSize.width, (int32_t)levelSize.height, 1 };
+		blitRegion.dstOffsets[1] = { (int32_t)nextSize.width, (int32_t)nextSize.height, 1 };
+		blitRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		blitRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level + 1, 0, 1 };
+
+		VkBlitImageInfo2 blitInfo{ .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2 };
+		blitInfo.srcImage = image;
+		blitInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		blitInfo.dstImage = image;
+		blitInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		blitInfo.filter = VK_FILTER_LINEAR;
+		blitInfo.regionCount = 1;
+		blitInfo.pRegions = &blitRegion;
+		vkCmdBlitImage2(cmd, &blitInfo);
+
+		// done as a source
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_NONE;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkCmdPipelineBarrier2(cmd, &depInfo);
+	}
+}
+
+void vkutil::blit_image_layer(VkCommandBuffer cmd, VkImage source, uint32_t sourceLayer, VkExtent2D srcSize, VkImage destination, VkRect2D dstRegion)
+{
+	VkImageBlit2 blitRegion{ .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2, .pNext = nullptr };
+
+	blitRegion.srcOffsets[1] = { (int32_t)srcSize.width, (int32_t)srcSize.height, 1 };
+
+	blitRegion.dstOffsets[0] = { dstRegion.offset.x, dstRegion.offset.y, 0 };
+	blitRegion.dstOffsets[1] = { dstRegion.offset.x + (int32_t)dstRegion.extent.width, dstRegion.offset.y + (int32_t)dstRegion.extent.height, 1 };
+
+	blitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	blitRegion.srcSubresource.baseArrayLayer = sourceLayer;
+	blitRegion.srcSubresource.layerCount = 1;
+
+	blitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	blitRegion.dstSubresource.layerCount = 1;
+
+	VkBlitImageInfo2 blitInfo{ .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2, .pNext = nullptr };
+	blitInfo.dstImage = destination;
+	blitInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	blitInfo.srcImage = source;
+	blitInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	blitInfo.filter = VK_FILTER_LINEAR;
+	blitInfo.regionCount = 1;
+	blitInfo.pRegions = &blitRegion;
+
+	vkCmdBlitImage2(cmd, &blitInfo);
+}
+
+void ImageStateTracker::track(VkImage image, VkImageAspectFlags aspect, VkImageLayout layout)
+{
+    _images[image] = { vkutil::unknown_image_state(layout), aspect };
+}
+
+void ImageStateTracker::forget(VkImage image)
+{
+    _images.erase(image);
+}
+
+void ImageStateTracker::use(VkImage image, vkutil::ImageUsage usage)
+{
+    TrackedImage& tracked = _images.at(image);
+    vkutil::ImageUsageInfo info = vkutil::image_usage_info(usage);
+
+    // barriers in one batch are unordered, so a second use before the flush changes the pending
+    // transition instead of adding another
+    for (auto it = _pending.begin(); it != _pending.end(); it++) {
+        if (it->image != image) {
+            continue;
+        }
+        if (it->usage.layout == info.layout) {
+            // the transition has to make the image visible to both uses
+            it->usage.stage |= info.stage;
+            it->usage.access |= info.access;
+            it->usage.write |= info.write;
+        } else {
+            // the image can only be in one layout after the flush, the earlier use is dropped
+            it->usage = info;
+        }
+        // redone from before the batch, so the state matches the one transition that is flushed
+        tracked.state = it->before;
+        VkImageMemoryBarrier2 barrier {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        if (!vkutil::update_image_state(tracked.state, it->usage, barrier)) {
+            _pending.erase(it);
+        }
+        return;
+    }
+
+    vkutil::ImageState before = tracked.state;
+    VkImageMemoryBarrier2 barrier {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    if (vkutil::update_image_state(tracked.state, info, barrier)) {
+        _pending.push_back({ image, tracked.aspect, before, info });
+    }
+}
+
+void ImageStateTracker::flush(VkCommandBuffer cmd)
+{
+    if (_pending.empty()) {
+        return;
+    }
+
+    std::vector<VkImageMemoryBarrier2> barriers;
+    barriers.reserve(_pending.size());
+    for (const PendingTransition& pending : _pending) {
+        vkutil::ImageState state = pending.before;
+        VkImageMemoryBarrier2& barrier = barriers.emplace_back(VkImageMemoryBarrier2 {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2});
+        vkutil::update_image_state(state, pending.usage, barrier);
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = pending.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(pending.aspect);
+    }
+
+    VkDependencyInfo depInfo {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    depInfo.imageMemoryBarrierCount = (uint32_t)barriers.size();
+    depInfo.pImageMemoryBarriers = barriers.data();
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+
+    _pending.clear();
+}
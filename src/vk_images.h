@@ -1,8 +1,98 @@
-#pragma once 
+#pragma once
 
 #include <vulkan/vulkan.h>
 
+#include <unordered_map>
+#include <vector>
+
 namespace vkutil {
+// how a pass touches an image, decides which layout it has to be in
+enum class ImageUsage {
+    Undefined,
+    ComputeWrite,
+    ComputeRead,
+    ComputeSampled,
+    ColorAttachment,
+    DepthAttachment,
+    DepthRead,
+    FragmentSampled,
+    TransferSrc,
+    TransferDst,
+    Present,
+};
+
+// layout, stages and access a usage needs. Write usages include their read access
+// so that read-modify-write (attachment loads, storage read/write) is covered
+struct ImageUsageInfo {
+    VkImageLayout layout;
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    bool write;
+};
+
+// Synchronization state of one image. Tracks the last write, which stages have read it
+// since, and which stages/accesses that write has already been made visible to.
+struct ImageState {
+    VkImageLayout layout;
+    VkPipelineStageFlags2 writeStage;
+    VkAccessFlags2 writeAccess;
+    VkPipelineStageFlags2 readStages;
+    VkPipelineStageFlags2 visibleStages;
+    VkAccessFlags2 visibleAccess;
+};
+
+ImageUsageInfo image_usage_info(ImageUsage usage);
+VkImageLayout image_layout(ImageUsage usage);
+bool is_write_usage(ImageUsage usage);
+
+// a state that makes the next barrier wait on everything, for images with unknown history
+ImageState unknown_image_state(VkImageLayout layout);
+
+// Moves the state to the given usage. Returns true and fills the stage/access/layout part of
+// the barrier when one is needed, read after read in the same layout needs none.
+bool update_image_state(ImageState& state, ImageUsage usage, VkImageMemoryBarrier2& barrier);
+// same, for a plain layout change with the given destination stage and access
+bool update_image_state(ImageState& state, const ImageUsageInfo& usage, VkImageMemoryBarrier2& barrier);
+
 void transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
+// records a barrier only if the tracked state needs one for this usage
+void transition_image(VkCommandBuffer cmd, VkImage image, ImageState& state, ImageUsage usage, VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT);
 void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
+// unscaled copy between two images of the same format, source in TRANSFER_SRC and destination in TRANSFER_DST
+void copy_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D size);
+// scaled blit of one layer of an array image into a region of the destination
+void blit_image_layer(VkCommandBuffer cmd, VkImage source, uint32_t sourceLayer, VkExtent2D srcSize, VkImage destination, VkRect2D dstRegion);
+// fills levels 1 and up by blitting each level from the one above. Every level starts in
+// TRANSFER_DST with level 0 written, and ends in SHADER_READ_ONLY
+void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D size, uint32_t mipLevels);
 }
+
+// Records the state of images used outside of the render graph and batches their transitions.
+// Every pending transition is flushed with a single vkCmdPipelineBarrier2.
+class ImageStateTracker {
+public:
+    void track(VkImage image, VkImageAspectFlags aspect, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+    void forget(VkImage image);
+
+    void use(VkImage image, vkutil::ImageUsage usage);
+    void flush(VkCommandBuffer cmd);
+
+    VkImageLayout layout(VkImage image) const { return _images.at(image).state.layout; }
+
+private:
+    struct TrackedImage {
+        vkutil::ImageState state;
+        VkImageAspectFlags aspect;
+    };
+
+    // the state before this batch and every use of the image in it, combined
+    struct PendingTransition {
+        VkImage image;
+        VkImageAspectFlags aspect;
+        vkutil::ImageState before;
+        vkutil::ImageUsageInfo usage;
+    };
+
+    std::unordered_map<VkImage, TrackedImage> _images;
+    std::vector<PendingTransition> _pending;
+};
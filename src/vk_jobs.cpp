@@ -0,0 +1,88 @@
+#include "vk_jobs.h"
+
+#include <algorithm>
+
+void WorkerPool::init(uint32_t workerCount)
+{
+    for (uint32_t i = 0; i < workerCount; i++) {
+        _workers.emplace_back(&WorkerPool::worker_loop, this);
+    }
+}
+
+void WorkerPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+    _workers.clear();
+}
+
+void WorkerPool::parallel_for(uint32_t count, uint32_t chunkSize, const std::function<void(uint32_t begin, uint32_t end)>& function)
+{
+    if (count == 0) {
+        return;
+    }
+    // not worth waking anyone up for a single chunk
+    if (_workers.empty() || count <= chunkSize) {
+        function(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _function = &function;
+        _count = count;
+        _chunkSize = chunkSize;
+        _nextChunk = 0;
+        _busyWorkers = (uint32_t)_workers.size();
+        _generation++;
+    }
+    _wake.notify_all();
+
+    run_chunks();
+
+    // the function lives on this stack frame, wait until no worker can touch it anymore
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _busyWorkers == 0; });
+    _function = nullptr;
+}
+
+void WorkerPool::worker_loop()
+{
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&]() { return _stopping || _generation != seenGeneration; });
+            if (_stopping) {
+                return;
+            }
+            seenGeneration = _generation;
+        }
+
+        run_chunks();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _busyWorkers--;
+        }
+        _done.notify_one();
+    }
+}
+
+void WorkerPool::run_chunks()
+{
+    while (true) {
+        uint32_t begin = _nextChunk.fetch_add(_chunkSize);
+        if (begin >= _count) {
+            return;
+        }
+        uint32_t end = std::min(begin + _chunkSize, _count);
+        (*_function)(begin, end);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops. The calling thread works on the
+// loop as well, so a pool with zero workers runs everything inline.
+class WorkerPool {
+public:
+    void init(uint32_t workerCount);
+    void shutdown();
+
+    uint32_t thread_count() const { return (uint32_t)_workers.size() + 1; }
+
+    // calls `function(begin, end)` over [0, count) in chunks of `chunkSize`, returns once all are done
+    void parallel_for(uint32_t count, uint32_t chunkSize, const std::function<void(uint32_t begin, uint32_t end)>& function);
+
+private:
+    void worker_loop();
+    void run_chunks();
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    bool _stopping{ false };
+
+    // the loop being worked on
+    const std::function<void(uint32_t, uint32_t)>* _function{ nullptr };
+    uint32_t _count{ 0 };
+    uint32_t _chunkSize{ 0 };
+    uint64_t _generation{ 0 };
+    std::atomic<uint32_t> _nextChunk{ 0 };
+    uint32_t _busyWorkers{ 0 };
+};
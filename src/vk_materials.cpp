@@ -0,0 +1,87 @@
+#include "vk_materials.h"
+
+#include <algorithm>
+#include <cstring>
+
+void MaterialSystem::init(VkDevice device, VmaAllocator allocator, uint32_t maxMaterials, MemoryTracker* tracker)
+{
+    _maxMaterials = maxMaterials;
+    _bufferSize = maxMaterials * sizeof(GPUMaterial);
+
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = _bufferSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_vk_result(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo, &_buffer.buffer, &_buffer.allocation, &_buffer.info));
+    if (tracker) {
+        tracker->track(_buffer.allocation, MemoryCategory::Material);
+    }
+
+    _parameters.reserve(maxMaterials);
+    _templates.reserve(maxMaterials);
+    _isDirty.reserve(maxMaterials);
+}
+
+void MaterialSystem::destroy(VmaAllocator allocator, MemoryTracker* tracker)
+{
+    if (tracker) {
+        tracker->untrack(_buffer.allocation);
+    }
+    vmaDestroyBuffer(allocator, _buffer.buffer, _buffer.allocation);
+}
+
+MaterialId MaterialSystem::create(MaterialTemplate materialTemplate, const GPUMaterial& parameters)
+{
+    if (_parameters.size() >= _maxMaterials) {
+        std::cout << "Material buffer is full, using material 0" << std::endl;
+        return 0;
+    }
+
+    MaterialId id = (MaterialId)_parameters.size();
+    _parameters.push_back(parameters);
+    _templates.push_back(materialTemplate);
+    _byTemplate[(size_t)materialTemplate].push_back(id);
+    _isDirty.push_back(true);
+    _dirty.push_back(id);
+    return id;
+}
+
+void MaterialSystem::update(MaterialId id, const GPUMaterial& parameters)
+{
+    _parameters[id] = parameters;
+    if (!_isDirty[id]) {
+        _isDirty[id] = true;
+        _dirty.push_back(id);
+    }
+}
+
+void MaterialSystem::record_upload(VkCommandBuffer cmd, const TransientAllocation& staging)
+{
+    // out of staging space, the materials stay dirty and go with the next frame
+    if (_dirty.empty() || !staging.mapped) {
+        return;
+    }
+    std::sort(_dirty.begin(), _dirty.end());
+
+    // one copy region per run of consecutive ids, the staging data is packed in the same order
+    std::vector<VkBufferCopy> regions;
+    uint8_t* mapped = (uint8_t*)staging.mapped;
+    for (size_t i = 0; i < _dirty.size(); i++) {
+        MaterialId id = _dirty[i];
+        VkDeviceSize stagingOffset = i * sizeof(GPUMaterial);
+        memcpy(mapped + stagingOffset, &_parameters[id], sizeof(GPUMaterial));
+        _isDirty[id] = false;
+
+        if (i > 0 && id == _dirty[i - 1] + 1) {
+            regions.back().size += sizeof(GPUMaterial);
+        } else {
+            regions.push_back({ staging.offset + stagingOffset, id * sizeof(GPUMaterial), sizeof(GPUMaterial) });
+        }
+    }
+    _dirty.clear();
+
+    vkCmdCopyBuffer(cmd, staging.buffer, _buffer.buffer, (uint32_t)regions.size(), regions.data());
+}
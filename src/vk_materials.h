@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_buffers.h"
+#include "vk_memory.h"
+
+// Parameters of one material, matches the std430 Material struct in colored_triangle.frag
+struct GPUMaterial {
+    // multiplies the vertex color, alpha is the opacity of transparent materials
+    glm::vec4 baseColor;
+    // added after the texture, in the HDR range
+    glm::vec3 emissive;
+    // how much of the mesh texture shows through, 0 ignores it
+    float textureStrength;
+};
+
+// The pipeline a material is drawn with. Draws are grouped by template, so the pipeline is
+// bound once per template however many materials use it
+enum class MaterialTemplate : uint32_t {
+    // depth tested and written, drawn by the prepass, the geometry pass and the culler
+    Opaque,
+    // alpha blended over the opaque geometry, depth tested but not written
+    Transparent,
+    Count
+};
+
+// index into the material buffer, what draws reference a material by
+using MaterialId = uint32_t;
+
+// Every material in one storage buffer indexed by MaterialId, so thousands of them cost one
+// descriptor. Changes are kept on the CPU and only the changed materials are copied to the
+// GPU, in contiguous runs, by record_upload().
+class MaterialSystem {
+public:
+    void init(VkDevice device, VmaAllocator allocator, uint32_t maxMaterials, MemoryTracker* tracker = nullptr);
+    void destroy(VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+
+    // material 0 when the buffer is full
+    MaterialId create(MaterialTemplate materialTemplate, const GPUMaterial& parameters);
+    void update(MaterialId id, const GPUMaterial& parameters);
+
+    const GPUMaterial& parameters(MaterialId id) const { return _parameters[id]; }
+    MaterialTemplate material_template(MaterialId id) const { return _templates[id]; }
+    // in creation order
+    std::span<const MaterialId> materials(MaterialTemplate materialTemplate) const { return _byTemplate[(size_t)materialTemplate]; }
+    uint32_t count() const { return (uint32_t)_parameters.size(); }
+
+    // bytes of staging memory the next record_upload() needs, 0 when nothing changed
+    VkDeviceSize upload_size() const { return _dirty.size() * sizeof(GPUMaterial); }
+    // copies the changed materials through `staging`, a mapped slice of at least upload_size() bytes.
+    // The buffer is written with a transfer
+    void record_upload(VkCommandBuffer cmd, const TransientAllocation& staging);
+
+    AllocatedBuffer _buffer;
+    VkDeviceSize _bufferSize;
+
+private:
+    uint32_t _maxMaterials;
+
+    std::vector<GPUMaterial> _parameters;
+    std::vector<MaterialTemplate> _templates;
+    std::array<std::vector<MaterialId>, (size_t)MaterialTemplate::Count> _byTemplate;
+
+    // changed since the last upload, each id once
+    std::vector<MaterialId> _dirty;
+    std::vector<bool> _isDirty;
+};
@@ -0,0 +1,170 @@
+#include "vk_memory.h"
+
+#include <fstream>
+#include <iostream>
+
+const char* memory_category_name(MemoryCategory category)
+{
+    switch (category) {
+    case MemoryCategory::Mesh: return "mesh";
+    case MemoryCategory::Image: return "image";
+    case MemoryCategory::Staging: return "staging";
+    case MemoryCategory::Transient: return "transient";
+    case MemoryCategory::Readback: return "readback";
+    case MemoryCategory::Texture: return "texture";
+    case MemoryCategory::Material: return "material";
+    case MemoryCategory::Particle: return "particle";
+    case MemoryCategory::Culling: return "culling";
+    default: return "unknown";
+    }
+}
+
+void MemoryTracker::init(VmaAllocator allocator, bool budgetExtension)
+{
+    this->allocator = allocator;
+    this->budgetExtension = budgetExtension;
+
+    const VkPhysicalDeviceMemoryProperties* memoryProperties;
+    vmaGetMemoryProperties(allocator, &memoryProperties);
+
+    heaps.resize(memoryProperties->memoryHeapCount);
+    for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++) {
+        heaps[i] = {};
+        heaps[i].deviceLocal = memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        heaps[i].size = memoryProperties->memoryHeaps[i].size;
+    }
+}
+
+void MemoryTracker::track(VmaAllocation allocation, MemoryCategory category)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(allocator, allocation, &info);
+
+    allocations[allocation] = category;
+    categories[(size_t)category].allocationCount++;
+    categories[(size_t)category].bytes += info.size;
+}
+
+void MemoryTracker::untrack(VmaAllocation allocation)
+{
+    auto it = allocations.find(allocation);
+    if (it == allocations.end()) {
+        return;
+    }
+
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(allocator, allocation, &info);
+
+    CategoryStats& stats = categories[(size_t)it->second];
+    stats.allocationCount--;
+    stats.bytes -= info.size;
+    allocations.erase(it);
+}
+
+void MemoryTracker::update(uint32_t frame)
+{
+    frameIndex = frame;
+    // lets VMA refresh the budget numbers from the driver every few frames
+    vmaSetCurrentFrameIndex(allocator, frameIndex);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(allocator, budgets);
+
+    bool pressure = false;
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        heaps[i].usage = budgets[i].usage;
+        heaps[i].budget = budgets[i].budget;
+        heaps[i].blockCount = budgets[i].statistics.blockCount;
+        heaps[i].allocationCount = budgets[i].statistics.allocationCount;
+        heaps[i].blockBytes = budgets[i].statistics.blockBytes;
+        heaps[i].allocationBytes = budgets[i].statistics.allocationBytes;
+
+        pressure |= is_heap_under_pressure(i);
+    }
+
+    if (pressure != underPressure) {
+        underPressure = pressure;
+        if (pressure) {
+            std::cout << "Device memory usage is above " << int(pressureThreshold * 100) << "% of the budget" << std::endl;
+        }
+        for (auto& callback : pressureCallbacks) {
+            callback(pressure);
+        }
+    }
+}
+
+void MemoryTracker::update_detailed()
+{
+    if (detailedFrameIndex != UINT32_MAX && frameIndex - detailedFrameIndex < detailedInterval) {
+        return;
+    }
+    detailedFrameIndex = frameIndex;
+
+    VmaTotalStatistics stats;
+    vmaCalculateStatistics(allocator, &stats);
+
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        const VmaDetailedStatistics& heap = stats.memoryHeap[i];
+        VkDeviceSize unusedBytes = heap.statistics.blockBytes - heap.statistics.allocationBytes;
+        if (unusedBytes == 0 || heap.unusedRangeCount == 0) {
+            heaps[i].fragmentation = 0.f;
+        } else {
+            heaps[i].fragmentation = 1.f - float(heap.unusedRangeSizeMax) / float(unusedBytes);
+        }
+    }
+}
+
+bool MemoryTracker::is_heap_under_pressure(uint32_t heapIndex) const
+{
+    const HeapStats& heap = heaps[heapIndex];
+    return heap.deviceLocal && heap.budget > 0 && heap.usage > heap.budget * pressureThreshold;
+}
+
+std::string MemoryTracker::to_json() const
+{
+    std::string json = "{\n";
+    char line[256];
+
+    snprintf(line, sizeof(line), "  \"budgetExtension\": %s,\n  \"underPressure\": %s,\n  \"heaps\": [\n",
+        budgetExtension ? "true" : "false", underPressure ? "true" : "false");
+    json += line;
+    for (size_t i = 0; i < heaps.size(); i++) {
+        const HeapStats& heap = heaps[i];
+        snprintf(line, sizeof(line),
+            "    { \"index\": %zu, \"deviceLocal\": %s, \"size\": %llu, \"usage\": %llu, \"budget\": %llu, "
+            "\"blockCount\": %u, \"allocationCount\": %u, \"blockBytes\": %llu, \"allocationBytes\": %llu, \"fragmentation\": %.4f }%s\n",
+            i, heap.deviceLocal ? "true" : "false",
+            (unsigned long long)heap.size, (unsigned long long)heap.usage, (unsigned long long)heap.budget,
+            heap.blockCount, heap.allocationCount,
+            (unsigned long long)heap.blockBytes, (unsigned long long)heap.allocationBytes,
+            heap.fragmentation, i + 1 < heaps.size() ? "," : "");
+        json += line;
+    }
+    json += "  ],\n  \"categories\": {\n";
+    for (size_t i = 0; i < categories.size(); i++) {
+        snprintf(line, sizeof(line), "    \"%s\": { \"allocationCount\": %u, \"bytes\": %llu }%s\n",
+            memory_category_name((MemoryCategory)i), categories[i].allocationCount,
+            (unsigned long long)categories[i].bytes, i + 1 < categories.size() ? "," : "");
+        json += line;
+    }
+    json += "  },\n  \"vma\": ";
+
+    // VMA already knows how to dump its full block/allocation layout as JSON
+    char* vmaStats;
+    vmaBuildStatsString(allocator, &vmaStats, VK_FALSE);
+    json += vmaStats;
+    vmaFreeStatsString(allocator, vmaStats);
+
+    json += "\n}\n";
+    return json;
+}
+
+bool MemoryTracker::write_json(const char* path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << to_json();
+    return true;
+}
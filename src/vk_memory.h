@@ -0,0 +1,78 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <unordered_map>
+
+enum class MemoryCategory : uint8_t {
+    Mesh,
+    Image,
+    Staging,
+    Transient,
+    Readback,
+    Texture,
+    Material,
+    Particle,
+    Culling,
+    Count
+};
+
+const char* memory_category_name(MemoryCategory category);
+
+// Keeps per-category allocation counts and per-heap usage/budget for the engine allocator.
+// Budgets come from VK_EXT_memory_budget when it is enabled, otherwise VMA estimates them.
+struct MemoryTracker {
+
+    struct CategoryStats {
+        uint32_t allocationCount;
+        VkDeviceSize bytes;
+    };
+
+    struct HeapStats {
+        bool deviceLocal;
+        VkDeviceSize size;
+        VkDeviceSize usage;
+        VkDeviceSize budget;
+        uint32_t blockCount;
+        uint32_t allocationCount;
+        VkDeviceSize blockBytes;
+        VkDeviceSize allocationBytes;
+        // 0 when all free space is one contiguous range, approaching 1 as it gets scattered
+        float fragmentation;
+    };
+
+    VmaAllocator allocator;
+    bool budgetExtension;
+    // fraction of a device local heap budget past which we report pressure
+    float pressureThreshold{ 0.9f };
+    bool underPressure{ false };
+    // frames between two update_detailed walks
+    uint32_t detailedInterval{ 60 };
+    uint32_t frameIndex{ 0 };
+    // UINT32_MAX until the first walk
+    uint32_t detailedFrameIndex{ UINT32_MAX };
+
+    std::array<CategoryStats, (size_t)MemoryCategory::Count> categories{};
+    std::unordered_map<VmaAllocation, MemoryCategory> allocations;
+    std::vector<HeapStats> heaps;
+
+    // called with true when pressure starts and false when it goes away
+    std::vector<std::function<void(bool)>> pressureCallbacks;
+
+    void init(VmaAllocator allocator, bool budgetExtension);
+
+    void track(VmaAllocation allocation, MemoryCategory category);
+    void untrack(VmaAllocation allocation);
+
+    // cheap, call once per frame. Refreshes usage/budget and pressure state
+    void update(uint32_t frame);
+    // walks every block to compute fragmentation, only call when the numbers are shown. Does
+    // nothing until detailedInterval frames have passed since the last walk
+    void update_detailed();
+
+    bool is_under_pressure() const { return underPressure; }
+    bool is_heap_under_pressure(uint32_t heapIndex) const;
+
+    std::string to_json() const;
+    bool write_json(const char* path) const;
+};
@@ -0,0 +1,225 @@
+#include "vk_particles.h"
+#include "vk_pipelines.h"
+
+// threads per workgroup of the emit, simulate and reset shaders
+constexpr uint32_t PARTICLE_GROUP_SIZE = 64;
+
+// matches the Counters block of the particle shaders
+struct ParticleCounters {
+    // alive before this frame's emission
+    uint32_t aliveCount;
+    uint32_t emitCount;
+    uint32_t deadCount;
+    uint32_t pad;
+};
+
+struct ParticleResetPushConstants {
+    VkDeviceAddress deadBuffer;
+    VkDeviceAddress counterBuffer;
+    VkDeviceAddress drawBuffer;
+    uint32_t maxParticles;
+    uint32_t pad;
+};
+
+struct ParticleBeginPushConstants {
+    VkDeviceAddress counterBuffer;
+    VkDeviceAddress dispatchBuffer;
+    VkDeviceAddress drawBuffer;
+    uint32_t emitCount;
+    uint32_t groupSize;
+};
+
+struct ParticleEmitPushConstants {
+    VkDeviceAddress particleBuffer;
+    VkDeviceAddress aliveBuffer;
+    VkDeviceAddress deadBuffer;
+    VkDeviceAddress counterBuffer;
+    glm::vec4 positionSpread;
+    glm::vec4 velocityLifetime;
+    glm::vec4 color;
+    uint32_t seed;
+    uint32_t pad[3];
+};
+
+struct ParticleSimulatePushConstants {
+    VkDeviceAddress particleBuffer;
+    VkDeviceAddress aliveInBuffer;
+    VkDeviceAddress aliveOutBuffer;
+    VkDeviceAddress deadBuffer;
+    VkDeviceAddress counterBuffer;
+    VkDeviceAddress drawBuffer;
+    glm::vec3 gravity;
+    float deltaTime;
+};
+
+struct ParticleDrawPushConstants {
+    VkDeviceAddress particleBuffer;
+    VkDeviceAddress aliveBuffer;
+    glm::vec2 size;
+    glm::vec2 pad;
+};
+
+AllocatedBuffer ParticleSystem::create_buffer(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, MemoryTracker* tracker)
+{
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = size;
+    bufferInfo.usage = usage | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    AllocatedBuffer buffer;
+    check_vk_result(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo, &buffer.buffer, &buffer.allocation, &buffer.info));
+    if (tracker) {
+        tracker->track(buffer.allocation, MemoryCategory::Particle);
+    }
+    return buffer;
+}
+
+void ParticleSystem::init(VkDevice device, VkShaderModule resetShader, VkShaderModule beginShader, VkShaderModule emitShader,
+    VkShaderModule simulateShader, LayoutCache& layouts)
+{
+    // pipelines, everything is reached through buffer device addresses in the push constants
+    VkPushConstantRange pushConstant = {};
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    pushConstant.size = sizeof(ParticleResetPushConstants);
+    _resetLayout = layouts.get_pipeline_layout({}, { &pushConstant, 1 });
+    pushConstant.size = sizeof(ParticleBeginPushConstants);
+    _beginLayout = layouts.get_pipeline_layout({}, { &pushConstant, 1 });
+    pushConstant.size = sizeof(ParticleEmitPushConstants);
+    _emitLayout = layouts.get_pipeline_layout({}, { &pushConstant, 1 });
+    pushConstant.size = sizeof(ParticleSimulatePushConstants);
+    _simulateLayout = layouts.get_pipeline_layout({}, { &pushConstant, 1 });
+
+    pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstant.size = sizeof(ParticleDrawPushConstants);
+    _drawLayout = layouts.get_pipeline_layout({}, { &pushConstant, 1 });
+
+    _resetPipeline = vkutil::build_compute_pipeline(device, _resetLayout, resetShader, PARTICLE_GROUP_SIZE, 1);
+    // a single thread, it only writes the counters and the indirect arguments
+    _beginPipeline = vkutil::build_compute_pipeline(device, _beginLayout, beginShader, 1, 1);
+    _emitPipeline = vkutil::build_compute_pipeline(device, _emitLayout, emitShader, PARTICLE_GROUP_SIZE, 1);
+    _simulatePipeline = vkutil::build_compute_pipeline(device, _simulateLayout, simulateShader, PARTICLE_GROUP_SIZE, 1);
+}
+
+void ParticleSystem::allocate(VkDevice device, VmaAllocator allocator, uint32_t maxParticles, MemoryTracker* tracker)
+{
+    _maxParticles = maxParticles;
+    _current = 0;
+
+    _particles = create_buffer(allocator, maxParticles * sizeof(GPUParticle), 0, tracker);
+    _aliveLists = create_buffer(allocator, 2 * maxParticles * sizeof(uint32_t), 0, tracker);
+    _deadList = create_buffer(allocator, maxParticles * sizeof(uint32_t), 0, tracker);
+    _counters = create_buffer(allocator, sizeof(ParticleCounters), 0, tracker);
+    _dispatchArgs = create_buffer(allocator, 2 * sizeof(VkDispatchIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, tracker);
+    _drawArgs = create_buffer(allocator, sizeof(VkDrawIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, tracker);
+
+    auto address_of = [&](const AllocatedBuffer& buffer) {
+        VkBufferDeviceAddressInfo addressInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer.buffer};
+        return vkGetBufferDeviceAddress(device, &addressInfo);
+    };
+    _particlesAddress = address_of(_particles);
+    _aliveListsAddress = address_of(_aliveLists);
+    _deadListAddress = address_of(_deadList);
+    _countersAddress = address_of(_counters);
+    _dispatchArgsAddress = address_of(_dispatchArgs);
+    _drawArgsAddress = address_of(_drawArgs);
+}
+
+void ParticleSystem::release(VmaAllocator allocator, MemoryTracker* tracker)
+{
+    if (!allocated()) {
+        return;
+    }
+    for (AllocatedBuffer* buffer : { &_particles, &_aliveLists, &_deadList, &_counters, &_dispatchArgs, &_drawArgs }) {
+        if (tracker) {
+            tracker->untrack(buffer->allocation);
+        }
+        vmaDestroyBuffer(allocator, buffer->buffer, buffer->allocation);
+    }
+    _maxParticles = 0;
+}
+
+void ParticleSystem::destroy(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker)
+{
+    for (VkPipeline pipeline : { _resetPipeline, _beginPipeline, _emitPipeline, _simulatePipeline }) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    release(allocator, tracker);
+}
+
+void ParticleSystem::reset(VkCommandBuffer cmd)
+{
+    ParticleResetPushConstants pushConstants = {};
+    pushConstants.deadBuffer = _deadListAddress;
+    pushConstants.counterBuffer = _countersAddress;
+    pushConstants.drawBuffer = _drawArgsAddress;
+    pushConstants.maxParticles = _maxParticles;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _resetPipeline);
+    vkCmdPushConstants(cmd, _resetLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleResetPushConstants), &pushConstants);
+    vkCmdDispatch(cmd, (_maxParticles + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1, 1);
+}
+
+void ParticleSystem::begin(VkCommandBuffer cmd, uint32_t emitCount)
+{
+    ParticleBeginPushConstants pushConstants = {};
+    pushConstants.counterBuffer = _countersAddress;
+    pushConstants.dispatchBuffer = _dispatchArgsAddress;
+    pushConstants.drawBuffer = _drawArgsAddress;
+    pushConstants.emitCount = emitCount;
+    pushConstants.groupSize = PARTICLE_GROUP_SIZE;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _beginPipeline);
+    vkCmdPushConstants(cmd, _beginLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleBeginPushConstants), &pushConstants);
+    vkCmdDispatch(cmd, 1, 1, 1);
+}
+
+void ParticleSystem::emit(VkCommandBuffer cmd, const ParticleEmitter& emitter, uint32_t seed)
+{
+    ParticleEmitPushConstants pushConstants = {};
+    pushConstants.particleBuffer = _particlesAddress;
+    pushConstants.aliveBuffer = alive_list(_current);
+    pushConstants.deadBuffer = _deadListAddress;
+    pushConstants.counterBuffer = _countersAddress;
+    pushConstants.positionSpread = glm::vec4(emitter.position, emitter.spread);
+    pushConstants.velocityLifetime = glm::vec4(emitter.velocity, emitter.lifetime);
+    pushConstants.color = emitter.color;
+    pushConstants.seed = seed;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _emitPipeline);
+    vkCmdPushConstants(cmd, _emitLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleEmitPushConstants), &pushConstants);
+    vkCmdDispatchIndirect(cmd, _dispatchArgs.buffer, 0);
+}
+
+void ParticleSystem::simulate(VkCommandBuffer cmd, const ParticleEmitter& emitter, float deltaTime)
+{
+    ParticleSimulatePushConstants pushConstants = {};
+    pushConstants.particleBuffer = _particlesAddress;
+    pushConstants.aliveInBuffer = alive_list(_current);
+    pushConstants.aliveOutBuffer = alive_list(1 - _current);
+    pushConstants.deadBuffer = _deadListAddress;
+    pushConstants.counterBuffer = _countersAddress;
+    pushConstants.drawBuffer = _drawArgsAddress;
+    pushConstants.gravity = emitter.gravity;
+    pushConstants.deltaTime = deltaTime;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _simulatePipeline);
+    vkCmdPushConstants(cmd, _simulateLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleSimulatePushConstants), &pushConstants);
+    vkCmdDispatchIndirect(cmd, _dispatchArgs.buffer, sizeof(VkDispatchIndirectCommand));
+
+    // the survivors are in the other list now, it is drawn and next frame appended to
+    _current = 1 - _current;
+}
+
+void ParticleSystem::draw(VkCommandBuffer cmd, glm::vec2 size)
+{
+    ParticleDrawPushConstants pushConstants = {};
+    pushConstants.particleBuffer = _particlesAddress;
+    pushConstants.aliveBuffer = alive_list(_current);
+    pushConstants.size = size;
+
+    vkCmdPushConstants(cmd, _drawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ParticleDrawPushConstants), &pushConstants);
+    vkCmdDrawIndirect(cmd, _drawArgs.buffer, 0, 1, sizeof(VkDrawIndirectCommand));
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+#include "vk_memory.h"
+
+// matches the Particle struct of the particle shaders. Only ever read and written on the GPU,
+// the CPU uses it for the buffer size
+struct GPUParticle {
+    glm::vec3 position;
+    float age;
+    glm::vec3 velocity;
+    float lifetime;
+    glm::vec4 color;
+};
+
+// where particles spawn and what moves them, in the scene's space where the view-projection is
+// the identity: x and y are NDC, with y down, and z is the reversed-Z depth
+struct ParticleEmitter {
+    glm::vec3 position{ 0.f, 0.7f, 0.5f };
+    // the emission velocity is offset by up to this much along each axis
+    float spread{ 0.35f };
+    glm::vec3 velocity{ 0.f, -1.2f, 0.f };
+    // longest, each particle lives between half of it and all of it
+    float lifetime{ 1.5f };
+    glm::vec4 color{ 1.f, 0.45f, 0.1f, 0.5f };
+    glm::vec3 gravity{ 0.f, 1.4f, 0.f };
+    // half the quad's height, in NDC
+    float size{ 0.004f };
+};
+
+// Particles emitted, simulated and drawn entirely on the GPU. The CPU records the same few
+// dispatches and one indirect draw every frame and only passes scalars, how many to spawn and the
+// time step, so its cost does not depend on the particle count.
+//
+// Every particle index is either on the dead list or on one of two alive lists. Each frame
+//  begin    - clamps the emission to the dead list and sizes the indirect dispatches
+//  emit     - pops indices off the dead list and appends them to the current alive list
+//  simulate - ages and moves the alive particles, compacting the survivors into the other alive
+//             list and pushing the dead ones back, and counts the draw's vertices
+// and the draw reads the list simulate wrote, which is the current one next frame.
+class ParticleSystem {
+public:
+    // the shaders stay owned by the caller, the layouts by the cache
+    void init(VkDevice device, VkShaderModule resetShader, VkShaderModule beginShader, VkShaderModule emitShader,
+        VkShaderModule simulateShader, LayoutCache& layouts);
+    // creates the buffers, separate from init so they only take memory once particles are used.
+    // Record reset() before the first frame that uses them
+    void allocate(VkDevice device, VmaAllocator allocator, uint32_t maxParticles, MemoryTracker* tracker = nullptr);
+    // frees the buffers and keeps the pipelines, allocate() again before the next use. The GPU must
+    // be done with them
+    void release(VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+    void destroy(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+
+    bool allocated() const { return _maxParticles > 0; }
+
+    // kills every particle, record before the first frame
+    void reset(VkCommandBuffer cmd);
+    // spawns up to `emitCount` particles this frame, fewer when the dead list runs out
+    void begin(VkCommandBuffer cmd, uint32_t emitCount);
+    // `seed` changes every frame so the emitted particles differ
+    void emit(VkCommandBuffer cmd, const ParticleEmitter& emitter, uint32_t seed);
+    void simulate(VkCommandBuffer cmd, const ParticleEmitter& emitter, float deltaTime);
+    // pipeline, created with _drawLayout, bound by the caller. `size` is the half extent of a quad in NDC
+    void draw(VkCommandBuffer cmd, glm::vec2 size);
+
+    uint32_t max_particles() const { return _maxParticles; }
+
+    // particle.vert push constants, no descriptor sets
+    VkPipelineLayout _drawLayout;
+
+    AllocatedBuffer _particles;
+    // both alive lists, the one emit appends to selected by _current
+    AllocatedBuffer _aliveLists;
+    AllocatedBuffer _deadList;
+    // alive, emitted and dead counts
+    AllocatedBuffer _counters;
+    // VkDispatchIndirectCommand of emit, then of simulate
+    AllocatedBuffer _dispatchArgs;
+    // VkDrawIndirectCommand, six vertices per alive particle
+    AllocatedBuffer _drawArgs;
+
+private:
+    AllocatedBuffer create_buffer(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, MemoryTracker* tracker);
+    VkDeviceAddress alive_list(uint32_t list) const { return _aliveListsAddress + list * _maxParticles * sizeof(uint32_t); }
+
+    // 0 until allocate()
+    uint32_t _maxParticles{ 0 };
+    // alive list emit appends to and simulate reads, flipped by simulate()
+    uint32_t _current{ 0 };
+
+    VkPipelineLayout _resetLayout;
+    VkPipeline _resetPipeline;
+    VkPipelineLayout _beginLayout;
+    VkPipeline _beginPipeline;
+    VkPipelineLayout _emitLayout;
+    VkPipeline _emitPipeline;
+    VkPipelineLayout _simulateLayout;
+    VkPipeline _simulatePipeline;
+
+    VkDeviceAddress _particlesAddress;
+    VkDeviceAddress _aliveListsAddress;
+    VkDeviceAddress _deadListAddress;
+    VkDeviceAddress _countersAddress;
+    VkDeviceAddress _dispatchArgsAddress;
+    VkDeviceAddress _drawArgsAddress;
+};
@@ -15,8 +15,14 @@ void PipelineBuilder::clear()
     _shaderStages.clear();
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device) const
 {
+    // the builder may have been copied, point the formats at this copy
+    VkPipelineRenderingCreateInfo renderInfo = _renderInfo;
+    if (renderInfo.colorAttachmentCount > 0) {
+        renderInfo.pColorAttachmentFormats = &_colorAttachmentformat;
+    }
+
     // make viewport state from our stored viewport and scissor.
     // at the moment we wont support multiple viewports or scissors
     VkPipelineViewportStateCreateInfo viewportState = {};
@@ -34,7 +40,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
 
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
+    colorBlending.attachmentCount = _renderInfo.colorAttachmentCount;
     colorBlending.pAttachments = &_colorBlendAttachment;
 
     // completely clear VertexInputStateCreateInfo, as we have no need for it
@@ -45,7 +51,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
     // to create the pipeline
     VkGraphicsPipelineCreateInfo pipelineInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
     // connect the renderInfo to the pNext extension mechanism
-    pipelineInfo.pNext = &_renderInfo;
+    pipelineInfo.pNext = &renderInfo;
 
     pipelineInfo.stageCount = (uint32_t)_shaderStages.size();
     pipelineInfo.pStages = _shaderStages.data();
@@ -77,6 +83,45 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
     }
 }
 
+PipelineKey PipelineBuilder::key() const
+{
+    PipelineKey key = {};
+    for (const VkPipelineShaderStageCreateInfo& stage : _shaderStages) {
+        if (stage.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+            key.vertexShader = stage.module;
+        } else if (stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+            key.fragmentShader = stage.module;
+        }
+    }
+    key.layout = _pipelineLayout;
+
+    key.topology = _inputAssembly.topology;
+    key.polygonMode = _rasterizer.polygonMode;
+    key.cullMode = _rasterizer.cullMode;
+    key.frontFace = _rasterizer.frontFace;
+    key.samples = _multisampling.rasterizationSamples;
+
+    // blend state is ignored without a color attachment
+    if (_renderInfo.colorAttachmentCount > 0) {
+        key.blendEnable = _colorBlendAttachment.blendEnable;
+        key.srcColorBlendFactor = _colorBlendAttachment.srcColorBlendFactor;
+        key.dstColorBlendFactor = _colorBlendAttachment.dstColorBlendFactor;
+        key.colorBlendOp = _colorBlendAttachment.colorBlendOp;
+        key.srcAlphaBlendFactor = _colorBlendAttachment.srcAlphaBlendFactor;
+        key.dstAlphaBlendFactor = _colorBlendAttachment.dstAlphaBlendFactor;
+        key.alphaBlendOp = _colorBlendAttachment.alphaBlendOp;
+        key.colorWriteMask = _colorBlendAttachment.colorWriteMask;
+        key.colorFormat = _colorAttachmentformat;
+    }
+
+    key.depthTestEnable = _depthStencil.depthTestEnable;
+    key.depthWriteEnable = _depthStencil.depthWriteEnable;
+    key.depthCompareOp = _depthStencil.depthCompareOp;
+    key.depthFormat = _renderInfo.depthAttachmentFormat;
+    key.viewMask = _renderInfo.viewMask;
+    return key;
+}
+
 void PipelineBuilder::set_shaders(VkShaderModule vertexShader, VkShaderModule fragmentShader)
 {
     _shaderStages.clear();
@@ -88,6 +133,14 @@ void PipelineBuilder::set_shaders(VkShaderModule vertexShader, VkShaderModule fr
         vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
 }
 
+void PipelineBuilder::set_vertex_shader(VkShaderModule vertexShader)
+{
+    _shaderStages.clear();
+
+    _shaderStages.push_back(
+        vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertexShader));
+}
+
 void PipelineBuilder::set_input_topology(VkPrimitiveTopology topology)
 {
     _inputAssembly.topology = topology;
@@ -128,6 +181,32 @@ void PipelineBuilder::disable_blending()
     _colorBlendAttachment.blendEnable = VK_FALSE;
 }
 
+void PipelineBuilder::enable_blending_additive()
+{
+    _colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    _colorBlendAttachment.blendEnable = VK_TRUE;
+    // outColor = srcColor.alpha * srcColor + dstColor
+    _colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    _colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    _colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    _colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    _colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    _colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+}
+
+void PipelineBuilder::enable_blending_alphablend()
+{
+    _colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    _colorBlendAttachment.blendEnable = VK_TRUE;
+    // outColor = srcColor.alpha * srcColor + (1 - srcColor.alpha) * dstColor
+    _colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    _colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    _colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    _colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    _colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    _colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+}
+
 void PipelineBuilder::set_color_attachment_format(VkFormat format)
 {
     _colorAttachmentformat = format;
@@ -141,6 +220,11 @@ void PipelineBuilder::set_depth_format(VkFormat format)
     _renderInfo.depthAttachmentFormat = format;
 }
 
+void PipelineBuilder::set_view_mask(uint32_t viewMask)
+{
+    _renderInfo.viewMask = viewMask;
+}
+
 void PipelineBuilder::disable_depthtest()
 {
     _depthStencil.depthTestEnable = VK_FALSE;
@@ -167,19 +251,144 @@ void PipelineBuilder::enable_depthtest(bool depthWriteEnable, VkCompareOp op)
     _depthStencil.maxDepthBounds = 1.f;
 }
 
+static void hash_combine(size_t& seed, uint64_t value)
+{
+    seed ^= std::hash<uint64_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
 
-bool vkutil::load_shader_module(const char* filePath, VkDevice device, VkShaderModule* outShaderModule)
+size_t PipelineCache::KeyHash::operator()(const PipelineKey& key) const
+{
+    size_t hash = 0;
+    hash_combine(hash, (uint64_t)key.vertexShader);
+    hash_combine(hash, (uint64_t)key.fragmentShader);
+    hash_combine(hash, (uint64_t)key.layout);
+    hash_combine(hash, key.topology | key.polygonMode << 8 | key.cullMode << 16 | (uint64_t)key.frontFace << 24 | (uint64_t)key.samples << 32);
+    hash_combine(hash, key.blendEnable | key.srcColorBlendFactor << 1 | key.dstColorBlendFactor << 6 | key.colorBlendOp << 11
+        | (uint64_t)key.srcAlphaBlendFactor << 32 | (uint64_t)key.dstAlphaBlendFactor << 37 | (uint64_t)key.alphaBlendOp << 42
+        | (uint64_t)key.colorWriteMask << 52);
+    hash_combine(hash, key.depthTestEnable | key.depthWriteEnable << 1 | key.depthCompareOp << 2 | (uint64_t)key.viewMask << 32);
+    hash_combine(hash, key.colorFormat | (uint64_t)key.depthFormat << 32);
+    return hash;
+}
+
+void PipelineCache::init(VkDevice device)
+{
+    _device = device;
+    _stopping = false;
+    _thread = std::thread(&PipelineCache::compile_loop, this);
+}
+
+void PipelineCache::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    for (auto& [key, entry] : _pipelines) {
+        if (entry.pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(_device, entry.pipeline, nullptr);
+        }
+    }
+    _pipelines.clear();
+}
+
+VkPipeline PipelineCache::get(const PipelineBuilder& builder)
+{
+    PipelineKey key = builder.key();
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_pipelines.contains(key)) {
+            // the compile thread or another caller may be on it, a second compile would be wasted
+            _ready.wait(lock, [&]() { return !_pipelines.at(key).pending; });
+            return _pipelines.at(key).pipeline;
+        }
+        _pipelines[key] = { VK_NULL_HANDLE, true };
+    }
+
+    // created outside the lock, other keys stay available meanwhile
+    VkPipeline pipeline = builder.build_pipeline(_device);
+    finish(key, pipeline);
+    return pipeline;
+}
+
+VkPipeline PipelineCache::get_async(const PipelineBuilder& builder)
+{
+    PipelineKey key = builder.key();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _pipelines.find(key);
+        if (it != _pipelines.end()) {
+            return it->second.pending ? VK_NULL_HANDLE : it->second.pipeline;
+        }
+        _pipelines[key] = { VK_NULL_HANDLE, true };
+        _queue.push_back(builder);
+    }
+    _wake.notify_one();
+    return VK_NULL_HANDLE;
+}
+
+size_t PipelineCache::size()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pipelines.size();
+}
+
+void PipelineCache::finish(const PipelineKey& key, VkPipeline pipeline)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pipelines[key] = { pipeline, false };
+    }
+    _ready.notify_all();
+}
+
+void PipelineCache::compile_loop()
+{
+    while (true) {
+        PipelineBuilder builder;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+            if (_stopping) {
+                return;
+            }
+            builder = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        finish(builder.key(), builder.build_pipeline(_device));
+    }
+}
+
+bool vkutil::load_spirv(const char* filePath, std::vector<uint32_t>& code)
 {
     std::ifstream file(filePath, std::ios::ate | std::ios::binary);
     if (!file.is_open()) {
         return false;
     }
     size_t fileSize = (size_t)file.tellg();
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+    code.resize(fileSize / sizeof(uint32_t));
     file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
-    file.close();
+    file.read((char*)code.data(), fileSize);
+    return true;
+}
+
+bool vkutil::load_shader_module(const char* filePath, VkDevice device, VkShaderModule* outShaderModule)
+{
+    std::vector<uint32_t> buffer;
+    if (!load_spirv(filePath, buffer)) {
+        return false;
+    }
+    return create_shader_module(buffer, device, outShaderModule);
+}
 
+bool vkutil::create_shader_module(std::span<const uint32_t> buffer, VkDevice device, VkShaderModule* outShaderModule)
+{
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.pNext = nullptr;
@@ -194,3 +403,39 @@ bool vkutil::load_shader_module(const char* filePath, VkDevice device, VkShaderM
     
     return true;
 }
+
+VkPipeline vkutil::build_compute_pipeline(VkDevice device, VkPipelineLayout layout, VkShaderModule shader, uint32_t localSizeX, uint32_t localSizeY)
+{
+    uint32_t localSize[2] = { localSizeX, localSizeY };
+    VkSpecializationMapEntry entries[2] = {
+        { 0, 0, sizeof(uint32_t) },
+        { 1, sizeof(uint32_t), sizeof(uint32_t) },
+    };
+
+    VkSpecializationInfo specialization = {};
+    specialization.mapEntryCount = 2;
+    specialization.pMapEntries = entries;
+    specialization.dataSize = sizeof(localSize);
+    specialization.pData = localSize;
+
+    VkPipelineShaderStageCreateInfo stageinfo{};
+    stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageinfo.pNext = nullptr;
+    stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageinfo.module = shader;
+    stageinfo.pName = "main";
+    stageinfo.pSpecializationInfo = &specialization;
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo{};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.pNext = nullptr;
+    computePipelineCreateInfo.layout = layout;
+    computePipelineCreateInfo.stage = stageinfo;
+
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS) {
+        std::cout << "Failed to create compute pipeline" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
+}
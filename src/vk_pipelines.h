@@ -2,6 +2,46 @@
 
 #include "vk_types.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// The PipelineBuilder state a graphics pipeline depends on, builders with equal keys build the same pipeline
+struct PipelineKey {
+    VkShaderModule vertexShader;
+    // VK_NULL_HANDLE for depth only pipelines
+    VkShaderModule fragmentShader;
+    VkPipelineLayout layout;
+
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygonMode;
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+    VkSampleCountFlagBits samples;
+
+    VkBool32 blendEnable;
+    VkBlendFactor srcColorBlendFactor;
+    VkBlendFactor dstColorBlendFactor;
+    VkBlendOp colorBlendOp;
+    VkBlendFactor srcAlphaBlendFactor;
+    VkBlendFactor dstAlphaBlendFactor;
+    VkBlendOp alphaBlendOp;
+    VkColorComponentFlags colorWriteMask;
+
+    VkBool32 depthTestEnable;
+    VkBool32 depthWriteEnable;
+    VkCompareOp depthCompareOp;
+
+    // VK_FORMAT_UNDEFINED when there is no such attachment
+    VkFormat colorFormat;
+    VkFormat depthFormat;
+    uint32_t viewMask;
+
+    bool operator==(const PipelineKey& other) const = default;
+};
+
 class PipelineBuilder {
 public:
     std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
@@ -19,9 +59,12 @@ public:
 
     void clear();
 
-    VkPipeline build_pipeline(VkDevice device);
+    VkPipeline build_pipeline(VkDevice device) const;
+    PipelineKey key() const;
 
     void set_shaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+    // for depth only pipelines, which have no fragment stage
+    void set_vertex_shader(VkShaderModule vertexShader);
     void set_input_topology(VkPrimitiveTopology topology);
     void set_polygon_mode(VkPolygonMode mode);
     void set_cull_mode(VkCullModeFlags cullMode, VkFrontFace frontFace);
@@ -31,10 +74,60 @@ public:
     void enable_blending_alphablend();
     void set_color_attachment_format(VkFormat format);
 	void set_depth_format(VkFormat format);
+    // renders every view in the mask with one draw, see VK_KHR_multiview
+    void set_view_mask(uint32_t viewMask);
 	void disable_depthtest();
     void enable_depthtest(bool depthWriteEnable,VkCompareOp op);
 };
 
+// Graphics pipelines keyed on the builder state that made them. A pipeline is created the first
+// time its key is asked for and shared from then on, so every place that needs the same
+// combination of shaders and state gets one compile between them. The pipelines stay owned by
+// the cache until destroy().
+class PipelineCache {
+public:
+    void init(VkDevice device);
+    void destroy();
+
+    // creates the pipeline on first use, VK_NULL_HANDLE when that failed
+    VkPipeline get(const PipelineBuilder& builder);
+    // like get(), but a missing pipeline is created on the compile thread. Returns VK_NULL_HANDLE
+    // until it is ready, the caller skips the draw or uses a fallback meanwhile
+    VkPipeline get_async(const PipelineBuilder& builder);
+
+    size_t size();
+
+private:
+    struct Entry {
+        VkPipeline pipeline;
+        // being created by get() on another thread or by the compile thread
+        bool pending;
+    };
+
+    struct KeyHash {
+        size_t operator()(const PipelineKey& key) const;
+    };
+
+    void compile_loop();
+    void finish(const PipelineKey& key, VkPipeline pipeline);
+
+    VkDevice _device;
+
+    // get() is also called from the shader hot reload thread
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::unordered_map<PipelineKey, Entry, KeyHash> _pipelines;
+
+    std::thread _thread;
+    std::condition_variable _wake;
+    bool _stopping{ false };
+    std::deque<PipelineBuilder> _queue;
+};
+
 namespace vkutil {
+bool load_spirv(const char* filePath, std::vector<uint32_t>& code);
 bool load_shader_module(const char* filePath, VkDevice device, VkShaderModule* outShaderModule);
+bool create_shader_module(std::span<const uint32_t> code, VkDevice device, VkShaderModule* outShaderModule);
+// compute shaders declare local_size_x_id = 0 and local_size_y_id = 1, the size is set at pipeline creation
+VkPipeline build_compute_pipeline(VkDevice device, VkPipelineLayout layout, VkShaderModule shader, uint32_t localSizeX, uint32_t localSizeY);
 }
\ No newline at end of file
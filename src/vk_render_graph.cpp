@@ -0,0 +1,418 @@
+#include "vk_render_graph.h"
+
+#include "vk_initializers.h"
+
+#include <algorithm>
+#include <cstring>
+
+static VkImageAspectFlags aspect_for_format(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_D32_SFLOAT:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+        return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:
+        return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+RGResource RenderGraph::import_image(const char* name, const AllocatedImage& image, VkImageLayout initialLayout,
+    VkImageLayout finalLayout, VkPipelineStageFlags2 initialStage)
+{
+    ImageResource resource = {};
+    resource.name = name;
+    resource.image = image;
+    resource.aspect = aspect_for_format(image.imageFormat);
+    resource.arrayLayers = 1;
+    resource.imported = true;
+    resource.initialLayout = initialLayout;
+    resource.finalLayout = finalLayout;
+    resource.initialStage = initialStage;
+    resource.memorySlot = -1;
+    resource.state = vkutil::unknown_image_state(initialLayout);
+
+    _images.push_back(resource);
+    _dirty = true;
+    return (RGResource)_images.size() - 1;
+}
+
+RGResource RenderGraph::create_image(const char* name, const RGImageDesc& desc)
+{
+    ImageResource resource = {};
+    resource.name = name;
+    resource.image.imageFormat = desc.format;
+    resource.image.imageExtent = desc.extent;
+    resource.aspect = aspect_for_format(desc.format);
+    resource.arrayLayers = desc.arrayLayers;
+    resource.imported = false;
+    resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.initialStage = VK_PIPELINE_STAGE_2_NONE;
+    resource.desc = desc;
+    resource.memorySlot = -1;
+    resource.state = vkutil::unknown_image_state(VK_IMAGE_LAYOUT_UNDEFINED);
+
+    _images.push_back(resource);
+    _dirty = true;
+    return (RGResource)_images.size() - 1;
+}
+
+RGResource RenderGraph::import_buffer(const char* name, VkBuffer buffer, VkDeviceSize size)
+{
+    BufferResource resource = {};
+    resource.name = name;
+    resource.buffer = buffer;
+    resource.size = size;
+    resource.state = vkutil::unknown_buffer_state();
+
+    _buffers.push_back(resource);
+    _dirty = true;
+    return (RGResource)_buffers.size() - 1;
+}
+
+void RenderGraph::set_image(RGResource resource, VkImage image, VkImageView view)
+{
+    _images[resource].image.image = image;
+    _images[resource].image.imageView = view;
+}
+
+void RenderGraph::set_buffer(RGResource resource, VkBuffer buffer)
+{
+    _buffers[resource].buffer = buffer;
+}
+
+RGPass& RenderGraph::add_pass(const char* name, std::function<void(VkCommandBuffer cmd)>&& execute)
+{
+    RGPass& pass = _passes.emplace_back();
+    pass.name = name;
+    pass.execute = std::move(execute);
+    _dirty = true;
+    return pass;
+}
+
+RGPass* RenderGraph::find_pass(const char* name)
+{
+    for (RGPass& pass : _passes) {
+        if (strcmp(pass.name, name) == 0) {
+            return &pass;
+        }
+    }
+    return nullptr;
+}
+
+void RenderGraph::set_pass_enabled(const char* name, bool enabled)
+{
+    RGPass* pass = find_pass(name);
+    if (pass && pass->enabled != enabled) {
+        pass->enabled = enabled;
+        _dirty = true;
+    }
+}
+
+void RenderGraph::set_output(RGResource image)
+{
+    _outputs.push_back(image);
+    _dirty = true;
+}
+
+void RenderGraph::cull_passes()
+{
+    // walk backwards from the outputs. A pass is kept if it writes something a later kept pass
+    // needs, and a full overwrite ends the need for whatever was written before it
+    std::vector<bool> imageNeeded(_images.size(), false);
+    std::vector<bool> bufferNeeded(_buffers.size(), false);
+    for (RGResource output : _outputs) {
+        imageNeeded[output] = true;
+    }
+
+    for (auto it = _passes.rbegin(); it != _passes.rend(); it++) {
+        RGPass& pass = *it;
+        if (!pass.enabled) {
+            pass.culled = true;
+            continue;
+        }
+
+        bool alive = pass.sideEffects;
+        for (const RGImageAccess& access : pass.imageWrites) {
+            alive |= imageNeeded[access.resource];
+        }
+        for (const RGBufferAccess& access : pass.bufferWrites) {
+            alive |= bufferNeeded[access.resource];
+        }
+
+        pass.culled = !alive;
+        if (!alive) {
+            continue;
+        }
+
+        for (const RGImageAccess& access : pass.imageWrites) {
+            imageNeeded[access.resource] = false;
+        }
+        for (const RGBufferAccess& access : pass.bufferWrites) {
+            bufferNeeded[access.resource] = false;
+        }
+        for (const RGImageAccess& access : pass.imageReads) {
+            imageNeeded[access.resource] = true;
+        }
+        for (const RGBufferAccess& access : pass.bufferReads) {
+            bufferNeeded[access.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::compile(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker)
+{
+    cull_passes();
+    _dirty = false;
+
+    alias_transient_images(device, allocator, tracker);
+}
+
+void RenderGraph::alias_transient_images(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker)
+{
+    // lifetimes are taken over every declared pass, not only the live ones, so toggling a pass
+    // later can never make two images that share memory overlap
+    for (ImageResource& resource : _images) {
+        resource.firstPass = UINT32_MAX;
+        resource.lastPass = 0;
+    }
+    for (uint32_t i = 0; i < _passes.size(); i++) {
+        auto touch = [&](RGResource r) {
+            _images[r].firstPass = std::min(_images[r].firstPass, i);
+            _images[r].lastPass = std::max(_images[r].lastPass, i);
+        };
+        for (const RGImageAccess& access : _passes[i].imageReads) touch(access.resource);
+        for (const RGImageAccess& access : _passes[i].imageWrites) touch(access.resource);
+    }
+
+    std::vector<RGResource> transients;
+    std::vector<VkMemoryRequirements> requirements(_images.size());
+    for (RGResource r = 0; r < _images.size(); r++) {
+        ImageResource& resource = _images[r];
+        if (resource.imported || resource.image.image != VK_NULL_HANDLE) {
+            continue;
+        }
+        if (resource.firstPass == UINT32_MAX) {
+            // never used, keep it out of every other image's way
+            resource.firstPass = 0;
+            resource.lastPass = UINT32_MAX;
+        }
+
+        VkImageCreateInfo info = vkinit::image_create_info(resource.desc.format, resource.desc.usage, resource.desc.extent);
+        info.arrayLayers = resource.desc.arrayLayers;
+        check_vk_result(vkCreateImage(device, &info, nullptr, &resource.image.image));
+        vkGetImageMemoryRequirements(device, resource.image.image, &requirements[r]);
+
+        transients.push_back(r);
+    }
+
+    // greedy first fit, biggest images first. Images share a slot when their lifetimes are disjoint
+    std::sort(transients.begin(), transients.end(), [&](RGResource a, RGResource b) {
+        return requirements[a].size > requirements[b].size;
+    });
+
+    struct MemorySlot {
+        VkMemoryRequirements requirements;
+        std::vector<RGResource> members;
+    };
+    std::vector<MemorySlot> slots;
+
+    for (RGResource r : transients) {
+        ImageResource& resource = _images[r];
+        const VkMemoryRequirements& req = requirements[r];
+
+        int32_t chosen = -1;
+        for (int32_t s = 0; s < (int32_t)slots.size() && chosen < 0; s++) {
+            if ((slots[s].requirements.memoryTypeBits & req.memoryTypeBits) == 0) {
+                continue;
+            }
+            bool overlaps = false;
+            for (RGResource other : slots[s].members) {
+                overlaps |= resource.firstPass <= _images[other].lastPass && _images[other].firstPass <= resource.lastPass;
+            }
+            if (!overlaps) {
+                chosen = s;
+            }
+        }
+
+        if (chosen < 0) {
+            slots.push_back({ req, {} });
+            chosen = (int32_t)slots.size() - 1;
+        } else {
+            VkMemoryRequirements& slotReq = slots[chosen].requirements;
+            slotReq.size = std::max(slotReq.size, req.size);
+            slotReq.alignment = std::max(slotReq.alignment, req.alignment);
+            slotReq.memoryTypeBits &= req.memoryTypeBits;
+        }
+        slots[chosen].members.push_back(r);
+        resource.memorySlot = (int32_t)_transientSlots.size() + chosen;
+    }
+
+    for (MemorySlot& slot : slots) {
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VmaAllocation allocation;
+        check_vk_result(vmaAllocateMemory(allocator, &slot.requirements, &allocInfo, &allocation, nullptr));
+        if (tracker) {
+            tracker->track(allocation, MemoryCategory::Image);
+        }
+        _transientMemory.push_back(allocation);
+        _transientSlots.push_back(slot.members);
+
+        for (RGResource r : slot.members) {
+            ImageResource& resource = _images[r];
+            check_vk_result(vmaBindImageMemory(allocator, allocation, resource.image.image));
+
+            VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(resource.desc.format, resource.image.image, resource.aspect);
+            if (resource.desc.arrayLayers > 1) {
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+                viewInfo.subresourceRange.layerCount = resource.desc.arrayLayers;
+            }
+            check_vk_result(vkCreateImageView(device, &viewInfo, nullptr, &resource.image.imageView));
+            resource.image.allocation = allocation;
+        }
+    }
+}
+
+void RenderGraph::transition(std::vector<VkImageMemoryBarrier2>& barriers, ImageResource& image, const vkutil::ImageUsageInfo& usage)
+{
+    if (!image.usedThisFrame && image.memorySlot >= 0) {
+        // the first use of an aliased image has to wait for everything that touched its memory
+        // through the other images of the slot
+        for (RGResource other : _transientSlots[image.memorySlot]) {
+            const vkutil::ImageState& state = _images[other].state;
+            image.state.writeStage |= state.writeStage | state.readStages;
+            image.state.writeAccess |= state.writeAccess;
+        }
+        image.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+    image.usedThisFrame = true;
+
+    VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    if (vkutil::update_image_state(image.state, usage, barrier)) {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image.image.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(image.aspect);
+        barriers.push_back(barrier);
+    }
+}
+
+void RenderGraph::transition(std::vector<VkBufferMemoryBarrier2>& barriers, BufferResource& buffer, vkutil::BufferUsage usage)
+{
+    VkBufferMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+    if (vkutil::update_buffer_state(buffer.state, usage, barrier)) {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = buffer.buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        barriers.push_back(barrier);
+    }
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+    if (_dirty) {
+        cull_passes();
+        _dirty = false;
+    }
+
+    // resources keep the stages/accesses of their last use in the previous frame, so the first
+    // barrier of this frame waits on exactly that. Only the layout is reset to what the owner hands over
+    for (ImageResource& image : _images) {
+        image.usedThisFrame = false;
+        if (image.imported && image.initialStage != VK_PIPELINE_STAGE_2_NONE) {
+            // e.g. the swapchain image, available once the acquire semaphore wait at this stage is done
+            image.state = {};
+            image.state.readStages = image.initialStage;
+        }
+        image.state.layout = image.imported ? image.initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+
+    auto flush = [&]() {
+        if (imageBarriers.empty() && bufferBarriers.empty()) {
+            return;
+        }
+        VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+        depInfo.pImageMemoryBarriers = imageBarriers.data();
+        depInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+        depInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+
+        imageBarriers.clear();
+        bufferBarriers.clear();
+    };
+
+    for (RGPass& pass : _passes) {
+        if (pass.culled || !pass.enabled) {
+            continue;
+        }
+
+        // a resource that is both read and written is covered by its write transition
+        for (const RGImageAccess& access : pass.imageWrites) {
+            transition(imageBarriers, _images[access.resource], vkutil::image_usage_info(access.usage));
+        }
+        for (const RGImageAccess& access : pass.imageReads) {
+            bool alsoWritten = std::any_of(pass.imageWrites.begin(), pass.imageWrites.end(),
+                [&](const RGImageAccess& w) { return w.resource == access.resource; });
+            if (!alsoWritten) {
+                transition(imageBarriers, _images[access.resource], vkutil::image_usage_info(access.usage));
+            }
+        }
+        for (const RGBufferAccess& access : pass.bufferWrites) {
+            transition(bufferBarriers, _buffers[access.resource], access.usage);
+        }
+        for (const RGBufferAccess& access : pass.bufferReads) {
+            bool alsoWritten = std::any_of(pass.bufferWrites.begin(), pass.bufferWrites.end(),
+                [&](const RGBufferAccess& w) { return w.resource == access.resource; });
+            if (!alsoWritten) {
+                transition(bufferBarriers, _buffers[access.resource], access.usage);
+            }
+        }
+        flush();
+
+        pass.execute(cmd);
+    }
+
+    // hand imported images back in the layout their owner expects, e.g. PRESENT_SRC for the swapchain
+    for (ImageResource& image : _images) {
+        if (!image.imported || image.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || image.state.layout == image.finalLayout) {
+            continue;
+        }
+        // whoever takes the image over synchronizes with a semaphore or fence, which waits on
+        // all commands, so the transition only has to happen before the end of the submission
+        transition(imageBarriers, image, { image.finalLayout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, false });
+    }
+    flush();
+}
+
+void RenderGraph::destroy(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker)
+{
+    for (ImageResource& resource : _images) {
+        if (resource.imported || resource.image.image == VK_NULL_HANDLE) {
+            continue;
+        }
+        vkDestroyImageView(device, resource.image.imageView, nullptr);
+        vkDestroyImage(device, resource.image.image, nullptr);
+        resource.image.image = VK_NULL_HANDLE;
+    }
+    for (VmaAllocation allocation : _transientMemory) {
+        if (tracker) {
+            tracker->untrack(allocation);
+        }
+        vmaFreeMemory(allocator, allocation);
+    }
+    _transientMemory.clear();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_images.h"
+#include "vk_buffers.h"
+#include "vk_memory.h"
+
+using RGResource = uint32_t;
+constexpr RGResource RG_INVALID_RESOURCE = ~0u;
+
+struct RGImageDesc {
+    VkFormat format;
+    VkExtent3D extent;
+    VkImageUsageFlags usage;
+    uint32_t arrayLayers{ 1 };
+};
+
+struct RGImageAccess {
+    RGResource resource;
+    vkutil::ImageUsage usage;
+};
+
+struct RGBufferAccess {
+    RGResource resource;
+    vkutil::BufferUsage usage;
+};
+
+struct RGPass {
+    const char* name;
+    std::function<void(VkCommandBuffer cmd)> execute;
+
+    std::vector<RGImageAccess> imageReads;
+    std::vector<RGImageAccess> imageWrites;
+    std::vector<RGBufferAccess> bufferReads;
+    std::vector<RGBufferAccess> bufferWrites;
+
+    // passes with side effects outside of the graph are never culled
+    bool sideEffects{ false };
+    bool enabled{ true };
+    bool culled{ false };
+
+    RGPass& read(RGResource image, vkutil::ImageUsage usage) { imageReads.push_back({ image, usage }); return *this; }
+    RGPass& write(RGResource image, vkutil::ImageUsage usage) { imageWrites.push_back({ image, usage }); return *this; }
+    // for passes that keep the previous contents, like an attachment with a LOAD op
+    RGPass& read_write(RGResource image, vkutil::ImageUsage usage) { read(image, usage); return write(image, usage); }
+
+    RGPass& read(RGResource buffer, vkutil::BufferUsage usage) { bufferReads.push_back({ buffer, usage }); return *this; }
+    RGPass& write(RGResource buffer, vkutil::BufferUsage usage) { bufferWrites.push_back({ buffer, usage }); return *this; }
+    RGPass& read_write(RGResource buffer, vkutil::BufferUsage usage) { read(buffer, usage); return write(buffer, usage); }
+};
+
+// Frame graph over the passes recorded into one command buffer.
+// Passes declare what they read and write, the graph culls passes whose results are never
+// consumed, batches the barriers in front of each pass, and aliases the memory of graph
+// owned (transient) images whose lifetimes do not overlap.
+class RenderGraph {
+public:
+    struct ImageResource {
+        const char* name;
+        AllocatedImage image;
+        VkImageAspectFlags aspect;
+        uint32_t arrayLayers;
+
+        bool imported;
+        VkImageLayout initialLayout;
+        VkImageLayout finalLayout;
+        // stage the owner hands the image over in every frame, NONE to carry the state over from the last frame
+        VkPipelineStageFlags2 initialStage;
+
+        // transient only
+        RGImageDesc desc;
+        uint32_t firstPass;
+        uint32_t lastPass;
+        int32_t memorySlot;
+
+        vkutil::ImageState state;
+        bool usedThisFrame;
+    };
+
+    struct BufferResource {
+        const char* name;
+        VkBuffer buffer;
+        VkDeviceSize size;
+
+        vkutil::BufferState state;
+    };
+
+    std::deque<RGPass> _passes;
+    std::vector<ImageResource> _images;
+    std::vector<BufferResource> _buffers;
+    std::vector<RGResource> _outputs;
+    std::vector<VmaAllocation> _transientMemory;
+    std::vector<std::vector<RGResource>> _transientSlots;
+    bool _dirty{ true };
+
+    RGResource import_image(const char* name, const AllocatedImage& image, VkImageLayout initialLayout,
+        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED, VkPipelineStageFlags2 initialStage = VK_PIPELINE_STAGE_2_NONE);
+    RGResource create_image(const char* name, const RGImageDesc& desc);
+    RGResource import_buffer(const char* name, VkBuffer buffer, VkDeviceSize size);
+
+    // imported resources can be re-pointed every frame, for example to the acquired swapchain image
+    void set_image(RGResource resource, VkImage image, VkImageView view);
+    void set_buffer(RGResource resource, VkBuffer buffer);
+
+    const AllocatedImage& get_image(RGResource resource) const { return _images[resource].image; }
+    VkBuffer get_buffer(RGResource resource) const { return _buffers[resource].buffer; }
+
+    RGPass& add_pass(const char* name, std::function<void(VkCommandBuffer cmd)>&& execute);
+    RGPass* find_pass(const char* name);
+    void set_pass_enabled(const char* name, bool enabled);
+
+    void set_output(RGResource image);
+
+    // creates and binds transient images. Call once after all passes and resources are declared
+    void compile(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+    void execute(VkCommandBuffer cmd);
+    void destroy(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker = nullptr);
+
+private:
+    void cull_passes();
+    void alias_transient_images(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker);
+
+    void transition(std::vector<VkImageMemoryBarrier2>& barriers, ImageResource& image, const vkutil::ImageUsageInfo& usage);
+    void transition(std::vector<VkBufferMemoryBarrier2>& barriers, BufferResource& buffer, vkutil::BufferUsage usage);
+};
@@ -0,0 +1,210 @@
+#include "vk_scene.h"
+
+#include <glm/trigonometric.hpp>
+
+#include <algorithm>
+#include <numeric>
+
+// nodes per job, large enough that a chunk streams through a few pages of each array
+constexpr uint32_t TRANSFORM_CHUNK_SIZE = 4096;
+
+// local matrix straight from TRS, without going through three matrix multiplies
+static glm::mat4 compose_trs(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    glm::mat3 r = glm::mat3_cast(rotation);
+    return glm::mat4(
+        glm::vec4(r[0] * scale.x, 0.f),
+        glm::vec4(r[1] * scale.y, 0.f),
+        glm::vec4(r[2] * scale.z, 0.f),
+        glm::vec4(position, 1.f));
+}
+
+// a * b for matrices whose last row is (0, 0, 0, 1). Only column multiply-adds, which vectorize well
+static glm::mat4 affine_multiply(const glm::mat4& a, const glm::mat4& b)
+{
+    glm::mat4 result;
+    result[0] = a[0] * b[0].x + a[1] * b[0].y + a[2] * b[0].z;
+    result[1] = a[0] * b[1].x + a[1] * b[1].y + a[2] * b[1].z;
+    result[2] = a[0] * b[2].x + a[1] * b[2].y + a[2] * b[2].z;
+    result[3] = a[0] * b[3].x + a[1] * b[3].y + a[2] * b[3].z + a[3];
+    return result;
+}
+
+TransformHandle TransformHierarchy::create(TransformHandle parent)
+{
+    uint32_t index = (uint32_t)_parents.size();
+    TransformHandle handle = (TransformHandle)_handleToIndex.size();
+
+    uint32_t parentIndex = parent == INVALID_TRANSFORM ? INVALID_TRANSFORM : _handleToIndex[parent];
+    uint32_t depth = parentIndex == INVALID_TRANSFORM ? 0 : _depths[parentIndex] + 1;
+
+    // appending keeps the order as long as nodes are created breadth first
+    if (!_depths.empty() && depth < _depths.back()) {
+        _unsorted = true;
+    }
+
+    _positions.push_back(glm::vec3(0.f));
+    _rotations.push_back(glm::quat(1.f, 0.f, 0.f, 0.f));
+    _scales.push_back(glm::vec3(1.f));
+    _parents.push_back(parentIndex);
+    _depths.push_back(depth);
+    _worlds.push_back(glm::mat4(1.f));
+    _dirty.push_back(1);
+
+    _handleToIndex.push_back(index);
+    _indexToHandle.push_back(handle);
+
+    _anyDirty = true;
+    _levelsDirty = true;
+    return handle;
+}
+
+void TransformHierarchy::set_local(TransformHandle node, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    uint32_t index = _handleToIndex[node];
+    _positions[index] = position;
+    _rotations[index] = rotation;
+    _scales[index] = scale;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::set_position(TransformHandle node, const glm::vec3& position)
+{
+    uint32_t index = _handleToIndex[node];
+    _positions[index] = position;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::set_rotation(TransformHandle node, const glm::quat& rotation)
+{
+    uint32_t index = _handleToIndex[node];
+    _rotations[index] = rotation;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::set_scale(TransformHandle node, const glm::vec3& scale)
+{
+    uint32_t index = _handleToIndex[node];
+    _scales[index] = scale;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::mark_dirty(uint32_t index)
+{
+    _dirty[index] = 1;
+    _anyDirty = true;
+}
+
+void TransformHierarchy::update(WorkerPool* pool)
+{
+    if (_unsorted) {
+        sort_by_depth();
+    }
+    if (_levelsDirty) {
+        build_levels();
+    }
+    if (!_anyDirty) {
+        return;
+    }
+
+    // a level only reads the dirty flags and world matrices of the one before it
+    for (uint32_t level = 0; level + 1 < _levelStarts.size(); level++) {
+        uint32_t begin = _levelStarts[level];
+        uint32_t count = _levelStarts[level + 1] - begin;
+        if (pool) {
+            pool->parallel_for(count, TRANSFORM_CHUNK_SIZE, [&](uint32_t chunkBegin, uint32_t chunkEnd) {
+                update_range(begin + chunkBegin, begin + chunkEnd);
+            });
+        } else {
+            update_range(begin, begin + count);
+        }
+    }
+
+    std::fill(_dirty.begin(), _dirty.end(), 0);
+    _anyDirty = false;
+}
+
+void TransformHierarchy::update_range(uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        uint32_t parent = _parents[i];
+        if (parent == INVALID_TRANSFORM) {
+            if (_dirty[i]) {
+                _worlds[i] = compose_trs(_positions[i], _rotations[i], _scales[i]);
+            }
+            continue;
+        }
+        if (!_dirty[i] && !_dirty[parent]) {
+            continue;
+        }
+        // pass the change on to the children in the next level
+        _dirty[i] = 1;
+        _worlds[i] = affine_multiply(_worlds[parent], compose_trs(_positions[i], _rotations[i], _scales[i]));
+    }
+}
+
+void TransformHierarchy::sort_by_depth()
+{
+    uint32_t count = size();
+
+    // stable, so siblings keep their relative order
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return _depths[a] < _depths[b]; });
+
+    std::vector<uint32_t> newIndex(count);
+    for (uint32_t i = 0; i < count; i++) {
+        newIndex[order[i]] = i;
+    }
+
+    auto reorder = [&](auto& values) {
+        std::remove_reference_t<decltype(values)> sorted(count);
+        for (uint32_t i = 0; i < count; i++) {
+            sorted[i] = values[order[i]];
+        }
+        values.swap(sorted);
+    };
+    reorder(_positions);
+    reorder(_rotations);
+    reorder(_scales);
+    reorder(_parents);
+    reorder(_depths);
+    reorder(_worlds);
+    reorder(_dirty);
+    reorder(_indexToHandle);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (_parents[i] != INVALID_TRANSFORM) {
+            _parents[i] = newIndex[_parents[i]];
+        }
+        _handleToIndex[_indexToHandle[i]] = i;
+    }
+
+    _unsorted = false;
+    _levelsDirty = true;
+}
+
+void TransformHierarchy::build_levels()
+{
+    _levelStarts.clear();
+    for (uint32_t i = 0; i < size(); i++) {
+        while (_levelStarts.size() <= _depths[i]) {
+            _levelStarts.push_back(i);
+        }
+    }
+    _levelStarts.push_back(size());
+    _levelsDirty = false;
+}
+
+glm::mat4 perspective_reversed_z(float fovy, float aspect, float zNear)
+{
+    float f = 1.f / glm::tan(fovy * 0.5f);
+
+    // clip w is the distance along -z and clip z is the near distance, so depth = zNear / distance
+    glm::mat4 projection(0.f);
+    projection[0][0] = f / aspect;
+    projection[1][1] = -f;
+    projection[2][3] = -1.f;
+    projection[3][2] = zNear;
+    return projection;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_jobs.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+using TransformHandle = uint32_t;
+constexpr TransformHandle INVALID_TRANSFORM = ~0u;
+
+// Transform hierarchy stored as separate arrays, ordered by depth so every parent comes before
+// its children. An update walks the levels in order and only recomputes nodes that changed
+// or whose parent did, each level split in chunks over the worker pool.
+// Handles stay valid when the arrays are reordered.
+class TransformHierarchy {
+public:
+    // the parent must already exist
+    TransformHandle create(TransformHandle parent = INVALID_TRANSFORM);
+
+    void set_local(TransformHandle node, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    void set_position(TransformHandle node, const glm::vec3& position);
+    void set_rotation(TransformHandle node, const glm::quat& rotation);
+    void set_scale(TransformHandle node, const glm::vec3& scale);
+
+    const glm::vec3& position(TransformHandle node) const { return _positions[_handleToIndex[node]]; }
+    const glm::quat& rotation(TransformHandle node) const { return _rotations[_handleToIndex[node]]; }
+    const glm::vec3& scale(TransformHandle node) const { return _scales[_handleToIndex[node]]; }
+
+    // valid after update()
+    const glm::mat4& world(TransformHandle node) const { return _worlds[_handleToIndex[node]]; }
+
+    uint32_t size() const { return (uint32_t)_parents.size(); }
+    uint32_t depth_count() const { return _levelStarts.empty() ? 0 : (uint32_t)_levelStarts.size() - 1; }
+
+    // recomputes the world matrices of changed subtrees, in parallel when a pool is given
+    void update(WorkerPool* pool = nullptr);
+
+private:
+    void mark_dirty(uint32_t index);
+    void sort_by_depth();
+    void build_levels();
+    void update_range(uint32_t begin, uint32_t end);
+
+    std::vector<glm::vec3> _positions;
+    std::vector<glm::quat> _rotations;
+    std::vector<glm::vec3> _scales;
+    // array index of the parent, INVALID_TRANSFORM for roots
+    std::vector<uint32_t> _parents;
+    std::vector<uint32_t> _depths;
+    std::vector<glm::mat4> _worlds;
+    std::vector<uint8_t> _dirty;
+
+    // first node of every depth, followed by the node count
+    std::vector<uint32_t> _levelStarts;
+
+    std::vector<uint32_t> _handleToIndex;
+    std::vector<TransformHandle> _indexToHandle;
+
+    bool _anyDirty{ false };
+    bool _unsorted{ false };
+    bool _levelsDirty{ false };
+};
+
+// Perspective projection for the reversed-Z depth buffer: the near plane maps to depth 1 and the
+// far plane is at infinity, depth 0. Vulkan clip space, y points down
+glm::mat4 perspective_reversed_z(float fovy, float aspect, float zNear);
@@ -0,0 +1,125 @@
+#include "vk_shader_objects.h"
+
+#include <array>
+#include <type_traits>
+
+bool ShaderObjects::init(VkDevice device)
+{
+    _device = device;
+
+    auto load = [device](auto& function, const char* name) {
+        function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(vkGetDeviceProcAddr(device, name));
+        return function != nullptr;
+    };
+    return load(_createShaders, "vkCreateShadersEXT")
+        && load(_destroyShader, "vkDestroyShaderEXT")
+        && load(_cmdBindShaders, "vkCmdBindShadersEXT")
+        && load(_cmdSetVertexInput, "vkCmdSetVertexInputEXT")
+        && load(_cmdSetPolygonMode, "vkCmdSetPolygonModeEXT")
+        && load(_cmdSetRasterizationSamples, "vkCmdSetRasterizationSamplesEXT")
+        && load(_cmdSetSampleMask, "vkCmdSetSampleMaskEXT")
+        && load(_cmdSetAlphaToCoverageEnable, "vkCmdSetAlphaToCoverageEnableEXT")
+        && load(_cmdSetAlphaToOneEnable, "vkCmdSetAlphaToOneEnableEXT")
+        && load(_cmdSetDepthClampEnable, "vkCmdSetDepthClampEnableEXT")
+        && load(_cmdSetLogicOpEnable, "vkCmdSetLogicOpEnableEXT")
+        && load(_cmdSetColorBlendEnable, "vkCmdSetColorBlendEnableEXT")
+        && load(_cmdSetColorWriteMask, "vkCmdSetColorWriteMaskEXT");
+}
+
+std::vector<VkShaderEXT> ShaderObjects::create(std::span<const ShaderObjectStage> stages, bool linked,
+    std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstants) const
+{
+    std::vector<VkShaderCreateInfoEXT> infos;
+    for (const ShaderObjectStage& stage : stages) {
+        VkShaderCreateInfoEXT info = {.sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT};
+        info.flags = linked ? VK_SHADER_CREATE_LINK_STAGE_BIT_EXT : 0;
+        info.stage = stage.stage;
+        // only vertex and fragment pipelines are drawn
+        info.nextStage = stage.stage == VK_SHADER_STAGE_VERTEX_BIT ? VK_SHADER_STAGE_FRAGMENT_BIT : 0;
+        info.codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+        info.codeSize = stage.code.size() * sizeof(uint32_t);
+        info.pCode = stage.code.data();
+        info.pName = "main";
+        info.setLayoutCount = (uint32_t)setLayouts.size();
+        info.pSetLayouts = setLayouts.data();
+        info.pushConstantRangeCount = (uint32_t)pushConstants.size();
+        info.pPushConstantRanges = pushConstants.data();
+        infos.push_back(info);
+    }
+
+    std::vector<VkShaderEXT> shaders(infos.size(), VK_NULL_HANDLE);
+    VkResult result = _createShaders(_device, (uint32_t)infos.size(), infos.data(), nullptr, shaders.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "failed to create shader objects" << std::endl;
+        // unlinked creation can fail part way, with the shaders before the failing one created
+        destroy(shaders);
+        return {};
+    }
+    return shaders;
+}
+
+void ShaderObjects::destroy(std::span<const VkShaderEXT> shaders) const
+{
+    for (VkShaderEXT shader : shaders) {
+        if (shader != VK_NULL_HANDLE) {
+            _destroyShader(_device, shader, nullptr);
+        }
+    }
+}
+
+void ShaderObjects::bind(VkCommandBuffer cmd, VkShaderEXT vertexShader, VkShaderEXT fragmentShader) const
+{
+    std::array<VkShaderStageFlagBits, 5> stages = {
+        VK_SHADER_STAGE_VERTEX_BIT,
+        VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+        VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+        VK_SHADER_STAGE_GEOMETRY_BIT,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+    std::array<VkShaderEXT, 5> shaders = { vertexShader, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, fragmentShader };
+    _cmdBindShaders(cmd, (uint32_t)stages.size(), stages.data(), shaders.data());
+}
+
+void ShaderObjects::set_state(VkCommandBuffer cmd, const GraphicsState& state, VkExtent2D extent) const
+{
+    VkViewport viewport = { 0.f, 0.f, (float)extent.width, (float)extent.height, 0.f, 1.f };
+    vkCmdSetViewportWithCount(cmd, 1, &viewport);
+    VkRect2D scissor = { { 0, 0 }, extent };
+    vkCmdSetScissorWithCount(cmd, 1, &scissor);
+
+    // vertices are pulled through buffer device addresses, there are no vertex attributes
+    _cmdSetVertexInput(cmd, 0, nullptr, 0, nullptr);
+    vkCmdSetPrimitiveTopology(cmd, state.topology);
+    vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
+
+    vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
+    // off is valid whether or not the depthClamp, alphaToOne and logicOp features are enabled,
+    // and the draws read this state when they are
+    _cmdSetDepthClampEnable(cmd, VK_FALSE);
+    _cmdSetPolygonMode(cmd, state.polygonMode);
+    vkCmdSetLineWidth(cmd, 1.f);
+    vkCmdSetCullMode(cmd, state.cullMode);
+    vkCmdSetFrontFace(cmd, state.frontFace);
+    vkCmdSetDepthBiasEnable(cmd, VK_FALSE);
+
+    _cmdSetRasterizationSamples(cmd, VK_SAMPLE_COUNT_1_BIT);
+    VkSampleMask sampleMask = ~0u;
+    _cmdSetSampleMask(cmd, VK_SAMPLE_COUNT_1_BIT, &sampleMask);
+    _cmdSetAlphaToCoverageEnable(cmd, VK_FALSE);
+    _cmdSetAlphaToOneEnable(cmd, VK_FALSE);
+
+    vkCmdSetDepthTestEnable(cmd, state.depthTest);
+    vkCmdSetDepthWriteEnable(cmd, state.depthWrite);
+    vkCmdSetDepthCompareOp(cmd, state.depthCompareOp);
+    vkCmdSetDepthBoundsTestEnable(cmd, VK_FALSE);
+    vkCmdSetStencilTestEnable(cmd, VK_FALSE);
+
+    _cmdSetLogicOpEnable(cmd, VK_FALSE);
+    if (state.colorAttachmentCount > 0) {
+        std::vector<VkBool32> blendEnables(state.colorAttachmentCount, VK_FALSE);
+        std::vector<VkColorComponentFlags> writeMasks(state.colorAttachmentCount,
+            VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT);
+        _cmdSetColorBlendEnable(cmd, 0, state.colorAttachmentCount, blendEnables.data());
+        _cmdSetColorWriteMask(cmd, 0, state.colorAttachmentCount, writeMasks.data());
+    }
+}
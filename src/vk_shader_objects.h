@@ -0,0 +1,60 @@
+#pragma once
+
+#include "vk_types.h"
+
+// What PipelineBuilder bakes into a pipeline, set on the command buffer instead when drawing
+// with shader objects. Blending is off and every color component is written
+struct GraphicsState {
+    VkPrimitiveTopology topology{ VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST };
+    VkPolygonMode polygonMode{ VK_POLYGON_MODE_FILL };
+    VkCullModeFlags cullMode{ VK_CULL_MODE_NONE };
+    VkFrontFace frontFace{ VK_FRONT_FACE_CLOCKWISE };
+    bool depthTest{ false };
+    bool depthWrite{ false };
+    VkCompareOp depthCompareOp{ VK_COMPARE_OP_NEVER };
+    uint32_t colorAttachmentCount{ 1 };
+};
+
+struct ShaderObjectStage {
+    VkShaderStageFlagBits stage;
+    std::span<const uint32_t> code;
+};
+
+// Graphics without pipelines, through VK_EXT_shader_object. Each stage is created once as a
+// shader object and bound on its own, and the state a pipeline would bake in is set at record
+// time, so a state change is a few commands instead of another pipeline. The extension
+// functions are loaded here, the core 1.3 dynamic state is called directly.
+class ShaderObjects {
+public:
+    // false when the device was created without VK_EXT_shader_object
+    bool init(VkDevice device);
+
+    // Unlinked shaders pair with any shader of the next stage that has a matching interface.
+    // Linked ones are compiled together, which lets the driver optimize across the stages, and
+    // are always bound together. Empty when creation failed, the caller destroys the shaders
+    std::vector<VkShaderEXT> create(std::span<const ShaderObjectStage> stages, bool linked,
+        std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstants) const;
+    void destroy(std::span<const VkShaderEXT> shaders) const;
+
+    // the other graphics stages are unbound
+    void bind(VkCommandBuffer cmd, VkShaderEXT vertexShader, VkShaderEXT fragmentShader) const;
+    // every piece of state the draws read, viewport and scissor cover `extent`
+    void set_state(VkCommandBuffer cmd, const GraphicsState& state, VkExtent2D extent) const;
+
+private:
+    VkDevice _device;
+
+    PFN_vkCreateShadersEXT _createShaders;
+    PFN_vkDestroyShaderEXT _destroyShader;
+    PFN_vkCmdBindShadersEXT _cmdBindShaders;
+    PFN_vkCmdSetVertexInputEXT _cmdSetVertexInput;
+    PFN_vkCmdSetPolygonModeEXT _cmdSetPolygonMode;
+    PFN_vkCmdSetRasterizationSamplesEXT _cmdSetRasterizationSamples;
+    PFN_vkCmdSetSampleMaskEXT _cmdSetSampleMask;
+    PFN_vkCmdSetAlphaToCoverageEnableEXT _cmdSetAlphaToCoverageEnable;
+    PFN_vkCmdSetAlphaToOneEnableEXT _cmdSetAlphaToOneEnable;
+    PFN_vkCmdSetDepthClampEnableEXT _cmdSetDepthClampEnable;
+    PFN_vkCmdSetLogicOpEnableEXT _cmdSetLogicOpEnable;
+    PFN_vkCmdSetColorBlendEnableEXT _cmdSetColorBlendEnable;
+    PFN_vkCmdSetColorWriteMaskEXT _cmdSetColorWriteMask;
+};
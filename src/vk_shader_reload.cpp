@@ -0,0 +1,90 @@
+#include "vk_shader_reload.h"
+
+#include <chrono>
+#include <cstdlib>
+
+// how often the sources are checked for changes
+constexpr std::chrono::milliseconds WATCH_INTERVAL{ 250 };
+
+void ShaderWatcher::add(const std::string& shaderName, RebuildFunction&& rebuild)
+{
+    _targets[shaderName].push_back(std::move(rebuild));
+}
+
+void ShaderWatcher::start(const std::filesystem::path& sourceDir, const std::filesystem::path& outputDir)
+{
+    _sourceDir = sourceDir;
+    _outputDir = outputDir;
+
+    // only changes made after startup trigger a reload
+    std::error_code error;
+    for (const auto& [name, rebuilds] : _targets) {
+        _writeTimes[name] = std::filesystem::last_write_time(_sourceDir / name, error);
+    }
+
+    _running = true;
+    _thread = std::thread(&ShaderWatcher::watch, this);
+}
+
+void ShaderWatcher::stop()
+{
+    _running = false;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void ShaderWatcher::apply()
+{
+    std::vector<std::function<void()>> pending;
+    {
+        std::lock_guard<std::mutex> lock(_pendingMutex);
+        pending.swap(_pending);
+    }
+    for (std::function<void()>& swap : pending) {
+        swap();
+    }
+}
+
+bool ShaderWatcher::has_pending()
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    return !_pending.empty();
+}
+
+void ShaderWatcher::watch()
+{
+    while (_running) {
+        for (auto& [name, rebuilds] : _targets) {
+            std::error_code error;
+            std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(_sourceDir / name, error);
+            if (error || writeTime == _writeTimes[name]) {
+                continue;
+            }
+            _writeTimes[name] = writeTime;
+
+            std::filesystem::path output = _outputDir / (name + ".spv");
+            if (!compile(_sourceDir / name, output)) {
+                std::cout << "Error when compiling " << name << ", keeping the current pipelines" << std::endl;
+                continue;
+            }
+            std::cout << "Reloading " << name << std::endl;
+
+            for (RebuildFunction& rebuild : rebuilds) {
+                std::function<void()> swap = rebuild(output.string());
+                if (swap) {
+                    std::lock_guard<std::mutex> lock(_pendingMutex);
+                    _pending.push_back(std::move(swap));
+                }
+            }
+        }
+        std::this_thread::sleep_for(WATCH_INTERVAL);
+    }
+}
+
+bool ShaderWatcher::compile(const std::filesystem::path& source, const std::filesystem::path& output) const
+{
+    // same invocation as the CMake custom command
+    std::string command = "glslc \"" + source.string() + "\" -o \"" + output.string() + "\"";
+    return std::system(command.c_str()) == 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Watches the GLSL sources and recompiles changed shaders with glslc on a worker thread.
+// Pipelines that use a shader are rebuilt on that thread too, only the swap is left for the
+// render thread, which runs it at a frame boundary through apply().
+class ShaderWatcher {
+public:
+    // Called on the watcher thread once the shader compiled to `spirvPath`. Returns the swap to
+    // run on the render thread, or nothing when the rebuild failed
+    using RebuildFunction = std::function<std::function<void()>(const std::string& spirvPath)>;
+
+    // register every shader before start(), e.g. add("sky.comp", ...)
+    void add(const std::string& shaderName, RebuildFunction&& rebuild);
+
+    void start(const std::filesystem::path& sourceDir, const std::filesystem::path& outputDir);
+    void stop();
+
+    // runs the swaps of everything that was rebuilt since the last call
+    void apply();
+    // rebuilt pipelines are waiting for apply()
+    bool has_pending();
+
+private:
+    void watch();
+    bool compile(const std::filesystem::path& source, const std::filesystem::path& output) const;
+
+    std::filesystem::path _sourceDir;
+    std::filesystem::path _outputDir;
+
+    // read only while the thread runs
+    std::unordered_map<std::string, std::vector<RebuildFunction>> _targets;
+    std::unordered_map<std::string, std::filesystem::file_time_type> _writeTimes;
+
+    std::thread _thread;
+    std::atomic<bool> _running{ false };
+
+    std::mutex _pendingMutex;
+    std::vector<std::function<void()>> _pending;
+};
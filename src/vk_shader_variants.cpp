@@ -0,0 +1,154 @@
+#include "vk_shader_variants.h"
+#include "vk_pipelines.h"
+
+#include <cstdlib>
+
+static const char* feature_define(uint32_t bit)
+{
+    switch (bit) {
+    case SHADER_FEATURE_VERTEX_BUFFER:
+        return "VERTEX_BUFFER";
+    case SHADER_FEATURE_MULTIVIEW:
+        return "MULTIVIEW";
+    case SHADER_FEATURE_OBJECT_BUFFER:
+        return "OBJECT_BUFFER";
+    case SHADER_FEATURE_TEXTURE:
+        return "TEXTURE";
+    case SHADER_FEATURE_MATERIAL:
+        return "MATERIAL";
+    default:
+        return nullptr;
+    }
+}
+
+void ShaderVariantCache::init(VkDevice device, const std::filesystem::path& sourceDir, const std::filesystem::path& cacheDir)
+{
+    _device = device;
+    _sourceDir = sourceDir;
+    _cacheDir = cacheDir;
+
+    if (!_sourceDir.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(_cacheDir, error);
+    }
+}
+
+void ShaderVariantCache::destroy()
+{
+    for (auto& [key, variant] : _variants) {
+        vkDestroyShaderModule(_device, variant.module, nullptr);
+    }
+    _variants.clear();
+    for (VkShaderModule module : _retired) {
+        vkDestroyShaderModule(_device, module, nullptr);
+    }
+    _retired.clear();
+}
+
+static std::string variant_key(const std::string& shader, uint32_t features)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%08x", features);
+    return shader + suffix;
+}
+
+VkShaderModule ShaderVariantCache::get(const std::string& shader, uint32_t features)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return get_locked(shader, features);
+}
+
+std::vector<uint32_t> ShaderVariantCache::get_code(const std::string& shader, uint32_t features)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (get_locked(shader, features) == VK_NULL_HANDLE) {
+        return {};
+    }
+    return _variants[variant_key(shader, features)].code;
+}
+
+VkShaderModule ShaderVariantCache::get_locked(const std::string& shader, uint32_t features)
+{
+    std::string key = variant_key(shader, features);
+
+    std::error_code error;
+    std::filesystem::file_time_type sourceTime = {};
+    if (!_sourceDir.empty()) {
+        sourceTime = std::filesystem::last_write_time(_sourceDir / shader, error);
+    }
+
+    auto it = _variants.find(key);
+    if (it != _variants.end() && it->second.sourceTime == sourceTime) {
+        return it->second.module;
+    }
+
+    // what the build compiled next to the executable, unless the source was edited since. glslc is
+    // only needed at run time for those edits and for permutations the build does not list
+    std::filesystem::path path = prebuilt_path(shader, features);
+    std::filesystem::file_time_type prebuiltTime = std::filesystem::last_write_time(path, error);
+    bool prebuilt = !error && prebuiltTime >= sourceTime;
+    if (!prebuilt && _sourceDir.empty()) {
+        std::cout << "Shader variant " << key << " was not built and needs the shader sources to be compiled" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    if (!prebuilt) {
+        path = variant_path(shader, features);
+        std::filesystem::file_time_type cachedTime = std::filesystem::last_write_time(path, error);
+        if (error || cachedTime < sourceTime) {
+            if (!compile(shader, features, path)) {
+                std::cout << "Error when compiling shader variant " << key << std::endl;
+                return VK_NULL_HANDLE;
+            }
+        }
+    }
+
+    std::vector<uint32_t> code;
+    VkShaderModule module;
+    if (!vkutil::load_spirv(path.string().c_str(), code) || !vkutil::create_shader_module(code, _device, &module)) {
+        std::cout << "Error when loading shader variant " << key << std::endl;
+        return VK_NULL_HANDLE;
+    }
+
+    // kept until destroy(), the pipeline cache keys on module handles and a destroyed one could
+    // come back as the handle of a different shader
+    if (it != _variants.end()) {
+        _retired.push_back(it->second.module);
+    }
+    _variants[key] = { module, std::move(code), sourceTime };
+    return module;
+}
+
+std::filesystem::path ShaderVariantCache::prebuilt_path(const std::string& shader, uint32_t features) const
+{
+    if (features == 0) {
+        return "./" + shader + ".spv";
+    }
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%08x.spv", features);
+    return "./" + shader + suffix;
+}
+
+std::filesystem::path ShaderVariantCache::variant_path(const std::string& shader, uint32_t features) const
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%08x.spv", features);
+    return _cacheDir / (shader + suffix);
+}
+
+bool ShaderVariantCache::compile(const std::string& shader, uint32_t features, const std::filesystem::path& output) const
+{
+    std::string command = "glslc \"" + (_sourceDir / shader).string() + "\"";
+    for (uint32_t bit = 1; bit != 0; bit <<= 1) {
+        if ((features & bit) == 0) {
+            continue;
+        }
+        const char* define = feature_define(bit);
+        if (!define) {
+            std::cout << "Unknown shader feature bit " << bit << std::endl;
+            return false;
+        }
+        command += std::string(" -D") + define;
+    }
+    command += " -o \"" + output.string() + "\"";
+    return std::system(command.c_str()) == 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
+// Feature bits a shader can be compiled with. Each one is passed to glslc as a #define
+enum ShaderFeature : uint32_t {
+    // vertices are read through a buffer device address in the push constants
+    SHADER_FEATURE_VERTEX_BUFFER = 1 << 0,
+    // per-view matrices indexed by gl_ViewIndex, for pipelines with a view mask
+    SHADER_FEATURE_MULTIVIEW = 1 << 1,
+    // world matrix and vertex buffer of the object at the instance index, for indirect draws
+    SHADER_FEATURE_OBJECT_BUFFER = 1 << 2,
+    // fragment color modulated by the texture in set 0
+    SHADER_FEATURE_TEXTURE = 1 << 3,
+    // fragment color from the material buffer in set 0, indexed by the draw's material
+    SHADER_FEATURE_MATERIAL = 1 << 4,
+};
+
+// Shader modules keyed by source file and feature bits. The build compiles every permutation the
+// engine uses next to the executable, see SHADER_VARIANTS in CMakeLists.txt, and those are loaded
+// first. A variant whose source is newer than its build output, or that the build does not list,
+// is compiled with glslc and written to the cache directory, later runs load it from there until
+// the source changes. Without a source directory only the built variants are available.
+class ShaderVariantCache {
+public:
+    void init(VkDevice device, const std::filesystem::path& sourceDir, const std::filesystem::path& cacheDir);
+    void destroy();
+
+    // VK_NULL_HANDLE when the variant could not be compiled or loaded. The module stays owned by the cache
+    VkShaderModule get(const std::string& shader, uint32_t features = 0);
+    // SPIR-V of the same variant, for creating shader objects. Empty when get() would fail
+    std::vector<uint32_t> get_code(const std::string& shader, uint32_t features = 0);
+
+private:
+    struct Variant {
+        VkShaderModule module;
+        std::vector<uint32_t> code;
+        std::filesystem::file_time_type sourceTime;
+    };
+
+    VkShaderModule get_locked(const std::string& shader, uint32_t features);
+    // <shader>.spv, or <shader>.<features as 8 hex digits>.spv for a variant
+    std::filesystem::path prebuilt_path(const std::string& shader, uint32_t features) const;
+    std::filesystem::path variant_path(const std::string& shader, uint32_t features) const;
+    bool compile(const std::string& shader, uint32_t features, const std::filesystem::path& output) const;
+
+    VkDevice _device;
+    std::filesystem::path _sourceDir;
+    std::filesystem::path _cacheDir;
+
+    // pipelines are also rebuilt from the shader hot reload thread
+    std::mutex _mutex;
+    std::unordered_map<std::string, Variant> _variants;
+    // modules replaced by a newer compile of their source
+    std::vector<VkShaderModule> _retired;
+};
@@ -0,0 +1,107 @@
+#include "vk_simulation.h"
+
+// a tick that falls further behind than this is not caught up with, the clock is reset instead
+static constexpr uint32_t MAX_TICKS_BEHIND = 4;
+
+uint32_t Simulation::add_body(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& velocity, const glm::vec3& angularVelocity)
+{
+    _bodies.push_back({ position, rotation, velocity, angularVelocity });
+    return (uint32_t)_bodies.size() - 1;
+}
+
+void Simulation::start(double tickRate)
+{
+    if (_running) {
+        return;
+    }
+
+    // the snapshot the render thread blends from until the first tick is published
+    _current.tick = _tick;
+    _current.time = Clock::now();
+    _current.bodies.clear();
+    for (const Body& body : _bodies) {
+        _current.bodies.push_back({ body.position, body.rotation });
+    }
+    _previous = _current;
+
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / tickRate));
+    _running = true;
+    _thread = std::thread([this, period]() { run(period); });
+}
+
+void Simulation::stop()
+{
+    _running = false;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void Simulation::run(Clock::duration period)
+{
+    float dt = std::chrono::duration<float>(period).count();
+    Clock::time_point time = Clock::now();
+    while (_running) {
+        time += period;
+
+        Clock::time_point stepStart = Clock::now();
+        step(dt);
+
+        SimulationSnapshot& snapshot = _snapshots.write_buffer();
+        snapshot.tick = ++_tick;
+        snapshot.time = time;
+        snapshot.bodies.resize(_bodies.size());
+        for (size_t i = 0; i < _bodies.size(); i++) {
+            snapshot.bodies[i] = { _bodies[i].position, _bodies[i].rotation };
+        }
+        _snapshots.publish();
+        _stepMs = std::chrono::duration<double, std::milli>(Clock::now() - stepStart).count();
+
+        Clock::time_point now = Clock::now();
+        if (now > time + MAX_TICKS_BEHIND * period) {
+            time = now;
+        }
+        std::this_thread::sleep_until(time);
+    }
+}
+
+void Simulation::step(float dt)
+{
+    for (Body& body : _bodies) {
+        body.position += body.velocity * dt;
+        for (int axis = 0; axis < 3; axis++) {
+            if ((body.position[axis] > _bounds[axis] && body.velocity[axis] > 0.f)
+                || (body.position[axis] < -_bounds[axis] && body.velocity[axis] < 0.f)) {
+                body.velocity[axis] = -body.velocity[axis];
+            }
+        }
+
+        float angle = glm::length(body.angularVelocity) * dt;
+        if (angle > 0.f) {
+            body.rotation = glm::normalize(glm::angleAxis(angle, glm::normalize(body.angularVelocity)) * body.rotation);
+        }
+    }
+}
+
+void Simulation::interpolate(Clock::time_point now, std::vector<BodyState>& bodies)
+{
+    // the render thread only keeps the newest two, a snapshot it missed is never blended
+    if (_snapshots.acquire()) {
+        std::swap(_previous, _current);
+        _current = _snapshots.read_buffer();
+    }
+
+    float alpha = 1.f;
+    if (_current.time > _previous.time) {
+        alpha = std::chrono::duration<float>(now - _previous.time).count() / std::chrono::duration<float>(_current.time - _previous.time).count();
+        alpha = glm::clamp(alpha, 0.f, 1.f);
+    }
+
+    bodies.resize(_current.bodies.size());
+    for (size_t i = 0; i < _current.bodies.size(); i++) {
+        const BodyState& from = i < _previous.bodies.size() ? _previous.bodies[i] : _current.bodies[i];
+        const BodyState& to = _current.bodies[i];
+        bodies[i].position = glm::mix(from.position, to.position, alpha);
+        bodies[i].rotation = glm::slerp(from.rotation, to.rotation, alpha);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <glm/gtc/quaternion.hpp>
+
+// Hands snapshots from one producer thread to one consumer thread without locks. The producer
+// fills its own buffer and swaps it with the shared middle one, the consumer swaps its buffer
+// with the middle one when that holds something newer. Neither side ever waits for the other,
+// the consumer just skips the snapshots it was too slow to see.
+template<typename T>
+class TripleBuffer {
+public:
+    // producer side, filled and then handed over with publish()
+    T& write_buffer() { return _buffers[_writeIndex]; }
+    void publish()
+    {
+        uint32_t previous = _middle.exchange(_writeIndex | NEW_BIT, std::memory_order_acq_rel);
+        _writeIndex = previous & INDEX_MASK;
+    }
+
+    // consumer side, true when read_buffer() now holds a newer snapshot
+    bool acquire()
+    {
+        if ((_middle.load(std::memory_order_relaxed) & NEW_BIT) == 0) {
+            return false;
+        }
+        uint32_t previous = _middle.exchange(_readIndex, std::memory_order_acq_rel);
+        _readIndex = previous & INDEX_MASK;
+        return true;
+    }
+    const T& read_buffer() const { return _buffers[_readIndex]; }
+
+private:
+    static constexpr uint32_t INDEX_MASK = 3;
+    // set in the middle index when the producer published into it
+    static constexpr uint32_t NEW_BIT = 4;
+
+    std::array<T, 3> _buffers;
+    uint32_t _writeIndex{ 0 };
+    std::atomic<uint32_t> _middle{ 1 };
+    uint32_t _readIndex{ 2 };
+};
+
+struct BodyState {
+    glm::vec3 position;
+    glm::quat rotation;
+};
+
+// the simulation's state at one tick, never modified once published
+struct SimulationSnapshot {
+    uint64_t tick;
+    // the time the state is for
+    std::chrono::steady_clock::time_point time;
+    std::vector<BodyState> bodies;
+};
+
+// Moves bodies at a fixed timestep on its own thread, which publishes every tick as a snapshot.
+// The render thread blends the last two snapshots for the time it renders, so motion is smooth
+// at any frame rate and a slow frame never slows the simulation down, or the other way around.
+class Simulation {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // before start(), returns the index of the body in the snapshots
+    uint32_t add_body(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& velocity, const glm::vec3& angularVelocity);
+
+    // Continues from the state it was stopped at. Ticks are computed ahead of the clock, the
+    // state for a time is published before that time comes
+    void start(double tickRate);
+    void stop();
+    bool running() const { return _running; }
+
+    // Render thread: the bodies blended between the two latest snapshots at `now`. Holds
+    // the newest state when the simulation is late or stopped
+    void interpolate(Clock::time_point now, std::vector<BodyState>& bodies);
+
+    // bodies bounce off the box from -_bounds to _bounds
+    glm::vec3 _bounds{ 1.f };
+
+    // written by the simulation thread
+    std::atomic<uint64_t> _tick{ 0 };
+    std::atomic<double> _stepMs{ 0 };
+
+private:
+    struct Body {
+        glm::vec3 position;
+        glm::quat rotation;
+        glm::vec3 velocity;
+        // axis scaled by radians per second
+        glm::vec3 angularVelocity;
+    };
+
+    void run(Clock::duration period);
+    void step(float dt);
+
+    // only touched by the simulation thread while it runs
+    std::vector<Body> _bodies;
+
+    TripleBuffer<SimulationSnapshot> _snapshots;
+    // render thread copies of the latest two
+    SimulationSnapshot _previous;
+    SimulationSnapshot _current;
+
+    std::thread _thread;
+    std::atomic<bool> _running{ false };
+};
@@ -0,0 +1,248 @@
+#include "vk_textures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80);
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+bool vkutil::load_ktx2(const char* path, Ktx2Image& image, uint32_t maxDimension)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Error when opening " << path << std::endl;
+        return false;
+    }
+    size_t fileSize = (size_t)file.tellg();
+    image.data.resize(fileSize);
+    file.seekg(0);
+    file.read((char*)image.data.data(), fileSize);
+
+    Ktx2Header header;
+    if (fileSize < sizeof(header)) {
+        std::cout << path << " is not a KTX2 file" << std::endl;
+        return false;
+    }
+    memcpy(&header, image.data.data(), sizeof(header));
+    if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+        std::cout << path << " is not a KTX2 file" << std::endl;
+        return false;
+    }
+    // VK_FORMAT_UNDEFINED is Basis Universal, which needs transcoding
+    if (header.vkFormat == VK_FORMAT_UNDEFINED || header.supercompressionScheme != 0) {
+        std::cout << path << " is supercompressed, only plain KTX2 files are supported" << std::endl;
+        return false;
+    }
+    // a height of 0 is a 1D texture
+    if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1) {
+        std::cout << path << " is not a 2D texture" << std::endl;
+        return false;
+    }
+
+    if (header.pixelWidth > maxDimension || header.pixelHeight > maxDimension) {
+        std::cout << path << " is " << header.pixelWidth << "x" << header.pixelHeight << ", larger than the device supports" << std::endl;
+        return false;
+    }
+    VkExtent2D blockExtent;
+    uint32_t blockSize = texel_block_size((VkFormat)header.vkFormat, blockExtent);
+    if (blockSize == 0) {
+        std::cout << path << " is " << string_VkFormat((VkFormat)header.vkFormat) << ", which textures can not be loaded in" << std::endl;
+        return false;
+    }
+
+    image.format = (VkFormat)header.vkFormat;
+    image.extent = { header.pixelWidth, header.pixelHeight };
+
+    // a level count of 0 asks the loader to generate the mip chain
+    uint32_t levelCount = std::max(header.levelCount, 1u);
+    uint32_t fullChain = (uint32_t)std::floor(std::log2(std::max(header.pixelWidth, header.pixelHeight))) + 1;
+    if (levelCount > fullChain) {
+        std::cout << path << " has " << levelCount << " levels, more than its extent has" << std::endl;
+        return false;
+    }
+    if (fileSize < sizeof(header) + levelCount * sizeof(Ktx2LevelIndex)) {
+        std::cout << path << " is truncated" << std::endl;
+        return false;
+    }
+    image.levels.resize(levelCount);
+    for (uint32_t i = 0; i < levelCount; i++) {
+        Ktx2LevelIndex index;
+        memcpy(&index, image.data.data() + sizeof(header) + i * sizeof(index), sizeof(index));
+        if (index.byteOffset > fileSize || index.byteLength > fileSize - index.byteOffset) {
+            std::cout << path << " is truncated" << std::endl;
+            return false;
+        }
+        // the upload copies a whole level from its offset
+        uint64_t width = std::max(header.pixelWidth >> i, 1u);
+        uint64_t height = std::max(header.pixelHeight >> i, 1u);
+        uint64_t needed = blockSize * ((width + blockExtent.width - 1) / blockExtent.width) * ((height + blockExtent.height - 1) / blockExtent.height);
+        if (index.byteLength < needed) {
+            std::cout << path << " level " << i << " is " << index.byteLength << " bytes, it needs " << needed << std::endl;
+            return false;
+        }
+        image.levels[i] = { (size_t)index.byteOffset, (size_t)index.byteLength };
+    }
+    return true;
+}
+
+bool vkutil::is_block_compressed(VkFormat format)
+{
+    return (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+        || (format >= VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK && format <= VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK);
+}
+
+uint32_t vkutil::texel_block_size(VkFormat format, VkExtent2D& blockExtent)
+{
+    // in the order of VkFormat, the UNORM and SRGB variants of each ASTC block size are adjacent
+    static const VkExtent2D ASTC_BLOCKS[] = { { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 },
+        { 8, 8 }, { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 } };
+
+    blockExtent = { 1, 1 };
+    if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+        blockExtent = ASTC_BLOCKS[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2];
+        return 16;
+    }
+    if (format >= VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK && format <= VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK) {
+        blockExtent = ASTC_BLOCKS[format - VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK];
+        return 16;
+    }
+
+    switch (format) {
+    case VK_FORMAT_R8_UNORM:
+    case VK_FORMAT_R8_SRGB:
+        return 1;
+    case VK_FORMAT_R8G8_UNORM:
+    case VK_FORMAT_R8G8_SRGB:
+    case VK_FORMAT_R16_SFLOAT:
+        return 2;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+    case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R32_SFLOAT:
+        return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32_SFLOAT:
+        return 8;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return 16;
+    default:
+        break;
+    }
+
+    blockExtent = { 4, 4 };
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+        return 8;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t SamplerCache::DescHash::operator()(const SamplerDesc& desc) const
+{
+    size_t hash = std::hash<uint32_t>()(desc.filter | desc.mipmapMode << 4 | desc.addressMode << 8 | desc.reductionMode << 12);
+    return hash ^ (std::hash<float>()(desc.maxAnisotropy) << 1);
+}
+
+void SamplerCache::init(VkDevice device, float maxAnisotropy)
+{
+    _device = device;
+    _maxAnisotropy = maxAnisotropy;
+}
+
+void SamplerCache::destroy()
+{
+    for (auto& [desc, sampler] : _samplers) {
+        vkDestroySampler(_device, sampler, nullptr);
+    }
+    _samplers.clear();
+}
+
+VkSampler SamplerCache::get(const SamplerDesc& desc)
+{
+    auto it = _samplers.find(desc);
+    if (it != _samplers.end()) {
+        return it->second;
+    }
+
+    VkSamplerCreateInfo samplerInfo = {.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter = desc.filter;
+    samplerInfo.minFilter = desc.filter;
+    samplerInfo.mipmapMode = desc.mipmapMode;
+    samplerInfo.addressModeU = desc.addressMode;
+    samplerInfo.addressModeV = desc.addressMode;
+    samplerInfo.addressModeW = desc.addressMode;
+    float anisotropy = std::min(desc.maxAnisotropy, _maxAnisotropy);
+    samplerInfo.anisotropyEnable = anisotropy > 1.f;
+    samplerInfo.maxAnisotropy = anisotropy;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkSamplerReductionModeCreateInfo reductionInfo = {.sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO};
+    reductionInfo.reductionMode = desc.reductionMode;
+    if (desc.reductionMode != VK_SAMPLER_REDUCTION_MODE_WEIGHTED_AVERAGE) {
+        samplerInfo.pNext = &reductionInfo;
+    }
+
+    VkSampler sampler;
+    check_vk_result(vkCreateSampler(_device, &samplerInfo, nullptr, &sampler));
+    _samplers[desc] = sampler;
+    return sampler;
+}
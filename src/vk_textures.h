@@ -0,0 +1,73 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <unordered_map>
+
+// An image sampled by shaders, with every mip level filled
+struct Texture {
+    std::string name;
+    AllocatedImage image;
+    uint32_t mipLevels;
+    // owned by the SamplerCache
+    VkSampler sampler;
+    // device memory of the image
+    VkDeviceSize memorySize;
+};
+
+// where one mip level is in the source data
+struct TextureLevel {
+    size_t offset;
+    size_t size;
+};
+
+// Contents of a KTX2 file, levels largest first. `data` is the whole file, the level offsets point into it
+struct Ktx2Image {
+    VkFormat format;
+    VkExtent2D extent;
+    std::vector<TextureLevel> levels;
+    std::vector<uint8_t> data;
+};
+
+namespace vkutil {
+// 2D textures without supercompression. Basis Universal and zstd files are rejected, and so are
+// files whose levels do not hold the data their format and extent need, or whose extent is above
+// `maxDimension`, the device's maxImageDimension2D
+bool load_ktx2(const char* path, Ktx2Image& image, uint32_t maxDimension);
+bool is_block_compressed(VkFormat format);
+// bytes per texel block, and the block's extent in texels, 1x1 for uncompressed formats. 0 for
+// formats textures can not be loaded in
+uint32_t texel_block_size(VkFormat format, VkExtent2D& blockExtent);
+}
+
+struct SamplerDesc {
+    VkFilter filter{ VK_FILTER_LINEAR };
+    VkSamplerMipmapMode mipmapMode{ VK_SAMPLER_MIPMAP_MODE_LINEAR };
+    VkSamplerAddressMode addressMode{ VK_SAMPLER_ADDRESS_MODE_REPEAT };
+    // 1 disables anisotropic filtering, clamped to the device limit
+    float maxAnisotropy{ 1.f };
+    // MIN/MAX filter to the smallest/largest texel instead of averaging, needs samplerFilterMinmax
+    VkSamplerReductionMode reductionMode{ VK_SAMPLER_REDUCTION_MODE_WEIGHTED_AVERAGE };
+
+    bool operator==(const SamplerDesc& other) const = default;
+};
+
+// One VkSampler per distinct SamplerDesc, shared by everything that asks for the same one
+class SamplerCache {
+public:
+    // `maxAnisotropy` is the device limit, 1 when samplerAnisotropy is not enabled
+    void init(VkDevice device, float maxAnisotropy);
+    void destroy();
+
+    VkSampler get(const SamplerDesc& desc);
+    size_t size() const { return _samplers.size(); }
+
+private:
+    struct DescHash {
+        size_t operator()(const SamplerDesc& desc) const;
+    };
+
+    VkDevice _device;
+    float _maxAnisotropy;
+    std::unordered_map<SamplerDesc, VkSampler, DescHash> _samplers;
+};
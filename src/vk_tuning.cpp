@@ -0,0 +1,168 @@
+#include "vk_tuning.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+// dispatches timed per candidate, after one untimed warm up
+constexpr uint32_t TUNING_RUNS = 8;
+
+void WorkgroupTuner::init(VkDevice device, VkPhysicalDevice gpu)
+{
+    _device = device;
+
+    VkPhysicalDeviceIDProperties idProperties = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+    VkPhysicalDeviceProperties2 properties = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    properties.pNext = &idProperties;
+    vkGetPhysicalDeviceProperties2(gpu, &properties);
+
+    char hex[3];
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+        snprintf(hex, sizeof(hex), "%02x", idProperties.deviceUUID[i]);
+        _deviceUUID += hex;
+    }
+
+    const VkPhysicalDeviceLimits& limits = properties.properties.limits;
+    if (limits.timestampComputeAndGraphics) {
+        _timestampPeriod = limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo queryPoolInfo = {.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = 2;
+        check_vk_result(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_queryPool));
+    }
+
+    const WorkgroupSize sizes[] = {
+        { 8, 8 }, { 16, 8 }, { 16, 16 }, { 32, 8 }, { 8, 32 },
+        { 32, 4 }, { 32, 16 }, { 32, 32 }, { 64, 1 }, { 64, 4 }, { 128, 1 },
+    };
+    for (const WorkgroupSize& size : sizes) {
+        if (size.x <= limits.maxComputeWorkGroupSize[0] && size.y <= limits.maxComputeWorkGroupSize[1]
+            && size.x * size.y <= limits.maxComputeWorkGroupInvocations) {
+            _candidates.push_back(size);
+        }
+    }
+}
+
+void WorkgroupTuner::destroy()
+{
+    if (_queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(_device, _queryPool, nullptr);
+        _queryPool = VK_NULL_HANDLE;
+    }
+}
+
+WorkgroupSize WorkgroupTuner::get(const std::string& effect) const
+{
+    auto it = _sizes.find(effect);
+    return it != _sizes.end() ? it->second : DEFAULT_SIZE;
+}
+
+void WorkgroupTuner::set(const std::string& effect, WorkgroupSize size)
+{
+    _sizes[effect] = size;
+}
+
+// one "<device uuid> <effect> <x> <y>" entry per line
+bool WorkgroupTuner::load(const char* path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream entry(line);
+        std::string uuid, effect;
+        WorkgroupSize size;
+        if (!(entry >> uuid >> effect >> size.x >> size.y)) {
+            continue;
+        }
+        if (uuid != _deviceUUID) {
+            _otherDevices.push_back(line);
+            continue;
+        }
+        // results from a driver with different limits may not fit anymore
+        bool valid = std::any_of(_candidates.begin(), _candidates.end(),
+            [&](const WorkgroupSize& c) { return c.x == size.x && c.y == size.y; });
+        if (valid) {
+            _sizes[effect] = size;
+        }
+    }
+    return true;
+}
+
+bool WorkgroupTuner::save(const char* path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    for (const std::string& line : _otherDevices) {
+        file << line << "\n";
+    }
+    for (const auto& [effect, size] : _sizes) {
+        file << _deviceUUID << " " << effect << " " << size.x << " " << size.y << "\n";
+    }
+    return true;
+}
+
+WorkgroupSize WorkgroupTuner::tune(const std::string& effect,
+    const std::function<VkPipeline(WorkgroupSize)>& build,
+    const std::function<void(VkCommandBuffer cmd, VkPipeline pipeline, WorkgroupSize size)>& record,
+    const std::function<void(std::function<void(VkCommandBuffer cmd)>&&)>& submit)
+{
+    if (!supported()) {
+        return get(effect);
+    }
+
+    // keep the dispatches from overlapping, so each one is timed on its own
+    VkMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
+    VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    depInfo.memoryBarrierCount = 1;
+    depInfo.pMemoryBarriers = &barrier;
+
+    WorkgroupSize best = get(effect);
+    double bestTime = std::numeric_limits<double>::max();
+
+    for (const WorkgroupSize& size : _candidates) {
+        VkPipeline pipeline = build(size);
+        if (pipeline == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        submit([&](VkCommandBuffer cmd) {
+            vkCmdResetQueryPool(cmd, _queryPool, 0, 2);
+            record(cmd, pipeline, size);
+            vkCmdPipelineBarrier2(cmd, &depInfo);
+
+            vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, _queryPool, 0);
+            for (uint32_t i = 0; i < TUNING_RUNS; i++) {
+                record(cmd, pipeline, size);
+                vkCmdPipelineBarrier2(cmd, &depInfo);
+            }
+            vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, _queryPool, 1);
+        });
+
+        uint64_t timestamps[2];
+        check_vk_result(vkGetQueryPoolResults(_device, _queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        vkDestroyPipeline(_device, pipeline, nullptr);
+
+        double time = (timestamps[1] - timestamps[0]) * _timestampPeriod / 1000000.0 / TUNING_RUNS;
+        std::cout << "Tuning " << effect << " " << size.x << "x" << size.y << ": " << time << " ms" << std::endl;
+        if (time < bestTime) {
+            bestTime = time;
+            best = size;
+        }
+    }
+
+    _sizes[effect] = best;
+    return best;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <unordered_map>
+
+struct WorkgroupSize {
+    uint32_t x;
+    uint32_t y;
+};
+
+// Picks the compute workgroup size of each effect on the current device.
+// Candidates are timed with timestamp queries, the winners are stored in a text file keyed
+// by the device UUID so every device keeps its own results.
+class WorkgroupTuner {
+public:
+    static constexpr WorkgroupSize DEFAULT_SIZE = { 16, 16 };
+
+    void init(VkDevice device, VkPhysicalDevice gpu);
+    void destroy();
+
+    // candidates that fit the device limits
+    const std::vector<WorkgroupSize>& candidates() const { return _candidates; }
+
+    WorkgroupSize get(const std::string& effect) const;
+    void set(const std::string& effect, WorkgroupSize size);
+
+    bool load(const char* path);
+    bool save(const char* path) const;
+
+    // Times `record` with every candidate. `build` returns a pipeline specialized to the size, which
+    // the tuner destroys, `submit` runs a command buffer to completion. Stores and returns the fastest
+    WorkgroupSize tune(const std::string& effect,
+        const std::function<VkPipeline(WorkgroupSize)>& build,
+        const std::function<void(VkCommandBuffer cmd, VkPipeline pipeline, WorkgroupSize size)>& record,
+        const std::function<void(std::function<void(VkCommandBuffer cmd)>&&)>& submit);
+
+    bool supported() const { return _timestampPeriod > 0; }
+
+private:
+    VkDevice _device;
+    VkQueryPool _queryPool{ VK_NULL_HANDLE };
+    float _timestampPeriod{ 0 };
+    std::string _deviceUUID;
+
+    std::vector<WorkgroupSize> _candidates;
+    // results of this device
+    std::unordered_map<std::string, WorkgroupSize> _sizes;
+    // lines of other devices, written back untouched
+    std::vector<std::string> _otherDevices;
+};
@@ -62,4 +62,11 @@ struct GPUMeshBuffers {
 struct GPUDrawPushConstants {
     glm::mat4 worldMatrix;
     VkDeviceAddress vertexBuffer;
+    // one view-projection matrix per view, only read by the multiview variant
+    VkDeviceAddress viewBuffer;
+    // GPUObject array, only read by the object buffer variant
+    VkDeviceAddress objectBuffer;
+    // index into the material buffer, the object buffer variant reads it from the object instead
+    uint32_t materialIndex;
+    uint32_t pad;
 };